@@ -186,10 +186,20 @@ SECTIONS
    .cio             : > RAMGS15,    PAGE = 1
 
    FLASH_SECTOR_CACHE			  : > RAMGS7to14_combined,    PAGE = 1
+   /* RAMGS0to6 is filled exactly, flashdisk.h checks FLASHDISK_GS_WORDS    */
+   MSC_BLOCK_BUFFER			  : > RAMGS0to6_combined,    PAGE = 1
+   FLASH_READAHEAD			  : > RAMGS0to6_combined,    PAGE = 1
+   FLASH_BLOCK_CACHE			  : > RAMGS0to6_combined,    PAGE = 1
 
+   /* The flash API runs from RAM with the ramfuncs, the disk suspends its  */
+   /* erases and polls the FSM while bank 0 cannot be read                  */
 #ifdef __TI_COMPILER_VERSION__
     #if __TI_COMPILER_VERSION__ >= 15009000
-       .TI.ramfunc       : LOAD = FLASHE,
+       GROUP
+       {
+           .TI.ramfunc
+           { -l F021_API_F2837xD_FPU32.lib }
+       }                 LOAD = FLASHE,
                          RUN = RAMLS012,
                          LOAD_START(_RamfuncsLoadStart),
                          LOAD_SIZE(_RamfuncsLoadSize),
@@ -199,7 +209,11 @@ SECTIONS
                          RUN_END(_RamfuncsRunEnd),
                          PAGE = 0
     #else
-       ramfuncs            : LOAD = FLASHE,
+       GROUP
+       {
+           ramfuncs
+           { -l F021_API_F2837xD_FPU32.lib }
+       }                 LOAD = FLASHE,
                          RUN = RAMLS012,
                          LOAD_START(_RamfuncsLoadStart),
                          LOAD_SIZE(_RamfuncsLoadSize),
@@ -0,0 +1,275 @@
+//###########################################################################
+//
+// FILE:   dma.c
+//
+// TITLE:  C28x DMA driver.
+//
+//###########################################################################
+// $Copyright:
+// Copyright (C) 2022 Texas Instruments Incorporated - http://www.ti.com
+//
+// Redistribution and use in source and binary forms, with or without 
+// modification, are permitted provided that the following conditions 
+// are met:
+// 
+//   Redistributions of source code must retain the above copyright 
+//   notice, this list of conditions and the following disclaimer.
+// 
+//   Redistributions in binary form must reproduce the above copyright
+//   notice, this list of conditions and the following disclaimer in the 
+//   documentation and/or other materials provided with the   
+//   distribution.
+// 
+//   Neither the name of Texas Instruments Incorporated nor the names of
+//   its contributors may be used to endorse or promote products derived
+//   from this software without specific prior written permission.
+// 
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS 
+// "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT 
+// LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR
+// A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT 
+// OWNER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, 
+// SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT 
+// LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+// DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+// THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT 
+// (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE 
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+// $
+//###########################################################################
+
+#include "dma.h"
+
+//*****************************************************************************
+//
+// DMA_configChannel
+//
+//*****************************************************************************
+void
+DMA_configChannel(uint32_t base, const DMA_ConfigParams *transfParams)
+{
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+
+    //
+    // Configure DMA Channel
+    //
+    DMA_configAddresses(base, (const void *)transfParams->destAddr,
+                        (const void *)transfParams->srcAddr);
+
+    //
+    // Configure the size of each burst and the address step size
+    //
+    DMA_configBurst(base, (uint16_t)transfParams->burstSize,
+                    transfParams->srcBurstStep, transfParams->destBurstStep);
+
+    //
+    // Configure the transfer size and the address step that is
+    // made after each burst.
+    //
+    DMA_configTransfer(base, transfParams->transferSize,
+                       transfParams->srcTransferStep,
+                       transfParams->destTransferStep);
+
+    //
+    // Configure the DMA channel's wrap settings
+    //
+    DMA_configWrap(base, transfParams->srcWrapSize, transfParams->srcWrapStep,
+                   transfParams->destWrapSize, transfParams->destWrapStep);
+
+    //
+    // Configure the DMA channel's trigger and mode
+    //
+    DMA_configMode(base, transfParams->transferTrigger,
+                   transfParams->transferMode | transfParams->reinitMode |
+                   transfParams->configSize);
+
+    //
+    // Set the interrupt generation mode and enable the channel interrupt if
+    // requested.
+    //
+    DMA_setInterruptMode(base, transfParams->interruptMode);
+
+    if(transfParams->enableInterrupt)
+    {
+        DMA_enableInterrupt(base);
+    }
+    else
+    {
+        DMA_disableInterrupt(base);
+    }
+
+    //
+    // Enable the peripheral trigger.
+    //
+    DMA_enableTrigger(base);
+}
+
+//*****************************************************************************
+//
+// DMA_configAddresses
+//
+//*****************************************************************************
+void
+DMA_configAddresses(uint32_t base, const void *destAddr, const void *srcAddr)
+{
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+
+    EALLOW;
+
+    //
+    // Set up SOURCE address.
+    //
+    HWREG(base + DMA_O_SRC_BEG_ADDR_SHADOW) = (uint32_t)srcAddr;
+    HWREG(base + DMA_O_SRC_ADDR_SHADOW)     = (uint32_t)srcAddr;
+
+    //
+    // Set up DESTINATION address.
+    //
+    HWREG(base + DMA_O_DST_BEG_ADDR_SHADOW) = (uint32_t)destAddr;
+    HWREG(base + DMA_O_DST_ADDR_SHADOW)     = (uint32_t)destAddr;
+
+    EDIS;
+}
+
+//*****************************************************************************
+//
+// DMA_configBurst
+//
+//*****************************************************************************
+void
+DMA_configBurst(uint32_t base, uint16_t size, int16_t srcStep,
+                int16_t destStep)
+{
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+    ASSERT((size >= 1U) && (size <= 32U));
+
+    EALLOW;
+
+    //
+    // Set up BURST registers.
+    //
+    HWREGH(base + DMA_O_BURST_SIZE)     = size - 1U;
+    HWREGH(base + DMA_O_SRC_BURST_STEP) = (uint16_t)srcStep;
+    HWREGH(base + DMA_O_DST_BURST_STEP) = (uint16_t)destStep;
+
+    EDIS;
+}
+
+//*****************************************************************************
+//
+// DMA_configTransfer
+//
+//*****************************************************************************
+void
+DMA_configTransfer(uint32_t base, uint32_t transferSize, int16_t srcStep,
+                   int16_t destStep)
+{
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+    ASSERT((transferSize >= 1U) && (transferSize <= 0x10000U));
+
+    EALLOW;
+
+    //
+    // Set up TRANSFER registers.
+    //
+    HWREGH(base + DMA_O_TRANSFER_SIZE)     = (uint16_t)(transferSize - 1U);
+    HWREGH(base + DMA_O_SRC_TRANSFER_STEP) = (uint16_t)srcStep;
+    HWREGH(base + DMA_O_DST_TRANSFER_STEP) = (uint16_t)destStep;
+
+    EDIS;
+}
+
+//*****************************************************************************
+//
+// DMA_configWrap
+//
+//*****************************************************************************
+void
+DMA_configWrap(uint32_t base, uint32_t srcWrapSize, int16_t srcStep,
+               uint32_t destWrapSize, int16_t destStep)
+{
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+    ASSERT((srcWrapSize >= 1U) && (srcWrapSize <= 0x10000U));
+    ASSERT((destWrapSize >= 1U) && (destWrapSize <= 0x10000U));
+
+    EALLOW;
+
+    //
+    // Set up WRAP registers.
+    //
+    HWREGH(base + DMA_O_SRC_WRAP_SIZE) = (uint16_t)(srcWrapSize - 1U);
+    HWREGH(base + DMA_O_SRC_WRAP_STEP) = (uint16_t)srcStep;
+
+    HWREGH(base + DMA_O_DST_WRAP_SIZE) = (uint16_t)(destWrapSize - 1U);
+    HWREGH(base + DMA_O_DST_WRAP_STEP) = (uint16_t)destStep;
+
+    EDIS;
+}
+
+//*****************************************************************************
+//
+// DMA_configMode
+//
+//*****************************************************************************
+void
+DMA_configMode(uint32_t base, DMA_Trigger trigger, uint32_t config)
+{
+    uint32_t channel, shift, reg;
+
+    //
+    // Check the arguments.
+    //
+    ASSERT(DMA_isBaseValid(base));
+
+    //
+    // Channels 1 to 4 select their trigger in DMACHSRCSEL1 and channels 5
+    // and 6 in DMACHSRCSEL2, eight bits per channel.
+    //
+    channel = (base - DMA_CH1_BASE) / (DMA_CH2_BASE - DMA_CH1_BASE);
+    if(channel < 4U)
+    {
+        reg = DMACLASRCSEL_BASE + SYSCTL_O_DMACHSRCSEL1;
+        shift = channel * 8U;
+    }
+    else
+    {
+        reg = DMACLASRCSEL_BASE + SYSCTL_O_DMACHSRCSEL2;
+        shift = (channel - 4U) * 8U;
+    }
+
+    EALLOW;
+
+    //
+    // Set up the trigger selection, and the peripheral interrupt select bits
+    // to the channel number.
+    //
+    HWREG(reg) = (HWREG(reg) & ~((uint32_t)0xFFU << shift)) |
+                 ((uint32_t)trigger << shift);
+    HWREGH(base + DMA_O_MODE) =
+        (HWREGH(base + DMA_O_MODE) & ~DMA_MODE_PERINTSEL_M) |
+        (uint16_t)(channel + 1U);
+
+    //
+    // Write the configuration to the mode register.
+    //
+    HWREGH(base + DMA_O_MODE) &= ~(DMA_MODE_DATASIZE | DMA_MODE_CONTINUOUS |
+                                   DMA_MODE_ONESHOT);
+    HWREGH(base + DMA_O_MODE) |= (uint16_t)config;
+
+    EDIS;
+}
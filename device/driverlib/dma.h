@@ -183,6 +183,13 @@ typedef enum
     DMA_TRIGGER_CLB3INT      = 129,
     DMA_TRIGGER_CLB4INT      = 130,
 
+    DMA_TRIGGER_USBA_RX1     = 131,
+    DMA_TRIGGER_USBA_TX1     = 132,
+    DMA_TRIGGER_USBA_RX2     = 133,
+    DMA_TRIGGER_USBA_TX2     = 134,
+    DMA_TRIGGER_USBA_RX3     = 135,
+    DMA_TRIGGER_USBA_TX3     = 136,
+
 } DMA_Trigger;
 
 //*****************************************************************************
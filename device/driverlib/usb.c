@@ -2552,6 +2552,9 @@ USBEndpointDataAvail(uint32_t ui32Base, uint32_t ui32Endpoint)
 //! instead just returns a zero in the \e pui32Size parameter.  The only error
 //! case occurs when there is no data packet available.
 //!
+//! The FIFO is unloaded with 32-bit accesses, falling back to 16-bit and
+//! 8-bit accesses only for the last one to three bytes of the packet.
+//!
 //! \return This call returns 0, or -1 if no packet was received.
 //
 //*****************************************************************************
@@ -2559,7 +2562,7 @@ int32_t
 USBEndpointDataGet(uint32_t ui32Base, uint32_t ui32Endpoint,
                    uint8_t *pui8Data, uint32_t *pui32Size)
 {
-    uint32_t ui32Register, ui32ByteCount, ui32FIFO;
+    uint32_t ui32Register, ui32ByteCount, ui32FIFO, ui32Word;
 
     //
     // Check the arguments.
@@ -2624,14 +2627,35 @@ USBEndpointDataGet(uint32_t ui32Base, uint32_t ui32Endpoint,
     ui32FIFO = ui32Base + USB_O_FIFO0 + (ui32Endpoint >> 2);
 
     //
-    // Read the data out of the FIFO.
+    // Read the data out of the FIFO four bytes per access.  The FIFO sits
+    // behind the byte peripheral bridge, so the 32-bit read must go through
+    // HWREG_BP to keep the bytes in FIFO order.
     //
-    for(; ui32ByteCount > 0; ui32ByteCount--)
+    for(; ui32ByteCount >= 4U; ui32ByteCount -= 4U)
     {
-        //
-        // Read a byte at a time from the FIFO.
-        //
-        *pui8Data++ = HWREGB(ui32FIFO);
+        ui32Word = HWREG_BP(ui32FIFO);
+        pui8Data[0] = (uint8_t)(ui32Word & 0xFFU);
+        pui8Data[1] = (uint8_t)((ui32Word >> 8) & 0xFFU);
+        pui8Data[2] = (uint8_t)((ui32Word >> 16) & 0xFFU);
+        pui8Data[3] = (uint8_t)((ui32Word >> 24) & 0xFFU);
+        pui8Data += 4;
+    }
+
+    //
+    // Pick up a trailing half word, then a trailing byte.
+    //
+    if(ui32ByteCount >= 2U)
+    {
+        ui32Word = HWREGH(ui32FIFO);
+        pui8Data[0] = (uint8_t)(ui32Word & 0xFFU);
+        pui8Data[1] = (uint8_t)((ui32Word >> 8) & 0xFFU);
+        pui8Data += 2;
+        ui32ByteCount -= 2U;
+    }
+
+    if(ui32ByteCount > 0U)
+    {
+        *pui8Data = HWREGB(ui32FIFO);
     }
 
     //
@@ -2762,6 +2786,9 @@ USBHostEndpointDataAck(uint32_t ui32Base, uint32_t ui32Endpoint)
 //! must be taken to not write more data than can fit into the FIFO
 //! allocated by the call to USBFIFOConfigSet().
 //!
+//! The FIFO is loaded with 32-bit accesses, falling back to 16-bit and 8-bit
+//! accesses only for the last one to three bytes of the packet.
+//!
 //! \return This call returns 0 on success, or -1 to indicate that the FIFO
 //! is in use and cannot be written.
 //
@@ -2812,11 +2839,223 @@ USBEndpointDataPut(uint32_t ui32Base, uint32_t ui32Endpoint,
     ui32FIFO = ui32Base + USB_O_FIFO0 + (ui32Endpoint >> 2);
 
     //
-    // Write the data to the FIFO.
+    // Write the data to the FIFO four bytes per access, packing the buffer's
+    // one-byte-per-word layout into a 32-bit value first.
+    //
+    for(; ui32Size >= 4U; ui32Size -= 4U)
+    {
+        HWREG_BP(ui32FIFO) = ((uint32_t)(pui8Data[0] & 0xFFU)) |
+                             ((uint32_t)(pui8Data[1] & 0xFFU) << 8) |
+                             ((uint32_t)(pui8Data[2] & 0xFFU) << 16) |
+                             ((uint32_t)(pui8Data[3] & 0xFFU) << 24);
+        pui8Data += 4;
+    }
+
+    //
+    // Finish with a half word and a byte for any tail.
+    //
+    if(ui32Size >= 2U)
+    {
+        HWREGH(ui32FIFO) = (uint16_t)((pui8Data[0] & 0xFFU) |
+                                      ((pui8Data[1] & 0xFFU) << 8));
+        pui8Data += 2;
+        ui32Size -= 2U;
+    }
+
+    if(ui32Size > 0U)
+    {
+        HWREGB(ui32FIFO) = *pui8Data;
+    }
+
+    //
+    // Success.
+    //
+    return(0);
+}
+
+//*****************************************************************************
+//
+//! Retrieves packed data from the given endpoint's FIFO.
+//!
+//! \param ui32Base specifies the USB module base address.
+//! \param ui32Endpoint is the endpoint to access.
+//! \param pui16Data is a pointer to the data area used to return the data
+//! from the FIFO, two bytes per 16-bit word with the first byte in the low
+//! half.
+//! \param pui32Size is initially the size of the buffer passed into this call
+//! in bytes.  It is set to the number of bytes returned in the buffer.
+//!
+//! This function is the same as USBEndpointDataGet() except that the data is
+//! returned packed, so each 32-bit FIFO read is stored with a single 32-bit
+//! write and no per-byte work.  When an odd number of bytes is returned the
+//! upper half of the last word is zero.
+//!
+//! \return This call returns 0, or -1 if no packet was received.
+//
+//*****************************************************************************
+int32_t
+USBEndpointDataGetPacked(uint32_t ui32Base, uint32_t ui32Endpoint,
+                         uint16_t *pui16Data, uint32_t *pui32Size)
+{
+    uint32_t ui32Register, ui32ByteCount, ui32FIFO, ui32Word;
+
+    //
+    // Check the arguments.
+    //
+    ASSERT(ui32Base == USBA_BASE);
+    ASSERT((ui32Endpoint == USB_EP_0) || (ui32Endpoint == USB_EP_1) ||
+           (ui32Endpoint == USB_EP_2) || (ui32Endpoint == USB_EP_3) ||
+           (ui32Endpoint == USB_EP_4) || (ui32Endpoint == USB_EP_5) ||
+           (ui32Endpoint == USB_EP_6) || (ui32Endpoint == USB_EP_7) ||
+           (ui32Endpoint == USB_EP_8) || (ui32Endpoint == USB_EP_9) ||
+           (ui32Endpoint == USB_EP_10) || (ui32Endpoint == USB_EP_11) ||
+           (ui32Endpoint == USB_EP_12) || (ui32Endpoint == USB_EP_13) ||
+           (ui32Endpoint == USB_EP_14) || (ui32Endpoint == USB_EP_15));
+
+    //
+    // Get the address of the receive status register to use, based on the
+    // endpoint.
+    //
+    if(ui32Endpoint == USB_EP_0)
+    {
+        ui32Register = USB_O_CSRL0;
+    }
+    else
+    {
+        ui32Register = USB_O_RXCSRL1 + EP_OFFSET(ui32Endpoint);
+    }
+
+    //
+    // Don't allow reading of data if the RxPktRdy bit is not set.
+    //
+    if((HWREGH(ui32Base + ui32Register) & USB_CSRL0_RXRDY) == 0)
+    {
+        *pui32Size = 0;
+
+        return(-1);
+    }
+
+    //
+    // Determine how many bytes are copied.
+    //
+    ui32ByteCount = HWREGH(ui32Base + USB_O_COUNT0 + ui32Endpoint);
+    ui32ByteCount = (ui32ByteCount < *pui32Size) ? ui32ByteCount : *pui32Size;
+    *pui32Size = ui32ByteCount;
+
+    //
+    // Calculate the FIFO address.
+    //
+    ui32FIFO = ui32Base + USB_O_FIFO0 + (ui32Endpoint >> 2);
+
+    //
+    // Read the data out of the FIFO four bytes, or two words, at a time.
+    //
+    for(; ui32ByteCount >= 4U; ui32ByteCount -= 4U)
+    {
+        ui32Word = HWREG_BP(ui32FIFO);
+        pui16Data[0] = (uint16_t)ui32Word;
+        pui16Data[1] = (uint16_t)(ui32Word >> 16);
+        pui16Data += 2;
+    }
+
+    if(ui32ByteCount >= 2U)
+    {
+        *pui16Data++ = HWREGH(ui32FIFO);
+        ui32ByteCount -= 2U;
+    }
+
+    if(ui32ByteCount > 0U)
+    {
+        *pui16Data = HWREGB(ui32FIFO) & 0xFFU;
+    }
+
+    //
+    // Success.
+    //
+    return(0);
+}
+
+//*****************************************************************************
+//
+//! Puts packed data into the given endpoint's FIFO.
+//!
+//! \param ui32Base specifies the USB module base address.
+//! \param ui32Endpoint is the endpoint to access.
+//! \param pui16Data is a pointer to the data to put into the FIFO, two bytes
+//! per 16-bit word with the first byte in the low half.
+//! \param ui32Size is the number of bytes to put into the FIFO.
+//!
+//! This function is the same as USBEndpointDataPut() except that the data is
+//! taken packed, so each 32-bit FIFO write is loaded with a single 32-bit
+//! read and no per-byte work.
+//!
+//! \return This call returns 0 on success, or -1 to indicate that the FIFO
+//! is in use and cannot be written.
+//
+//*****************************************************************************
+int32_t
+USBEndpointDataPutPacked(uint32_t ui32Base, uint32_t ui32Endpoint,
+                         const uint16_t *pui16Data, uint32_t ui32Size)
+{
+    uint32_t ui32FIFO;
+    uint8_t ui8TxPktRdy;
+
+    //
+    // Check the arguments.
+    //
+    ASSERT(ui32Base == USBA_BASE);
+    ASSERT((ui32Endpoint == USB_EP_0) || (ui32Endpoint == USB_EP_1) ||
+           (ui32Endpoint == USB_EP_2) || (ui32Endpoint == USB_EP_3) ||
+           (ui32Endpoint == USB_EP_4) || (ui32Endpoint == USB_EP_5) ||
+           (ui32Endpoint == USB_EP_6) || (ui32Endpoint == USB_EP_7) ||
+           (ui32Endpoint == USB_EP_8) || (ui32Endpoint == USB_EP_9) ||
+           (ui32Endpoint == USB_EP_10) || (ui32Endpoint == USB_EP_11) ||
+           (ui32Endpoint == USB_EP_12) || (ui32Endpoint == USB_EP_13) ||
+           (ui32Endpoint == USB_EP_14) || (ui32Endpoint == USB_EP_15));
+
+    //
+    // Get the bit position of TxPktRdy based on the endpoint.
+    //
+    if(ui32Endpoint == USB_EP_0)
+    {
+        ui8TxPktRdy = USB_CSRL0_TXRDY;
+    }
+    else
+    {
+        ui8TxPktRdy = USB_TXCSRL1_TXRDY;
+    }
+
+    //
+    // Don't allow transmit of data if the TxPktRdy bit is already set.
+    //
+    if(HWREGB(ui32Base + USB_O_CSRL0 + ui32Endpoint) & ui8TxPktRdy)
+    {
+        return(-1);
+    }
+
+    //
+    // Calculate the FIFO address.
+    //
+    ui32FIFO = ui32Base + USB_O_FIFO0 + (ui32Endpoint >> 2);
+
+    //
+    // Write the data to the FIFO four bytes, or two words, at a time.
     //
-    for(; ui32Size > 0U; ui32Size--)
+    for(; ui32Size >= 4U; ui32Size -= 4U)
+    {
+        HWREG_BP(ui32FIFO) = ((uint32_t)pui16Data[1] << 16) | pui16Data[0];
+        pui16Data += 2;
+    }
+
+    if(ui32Size >= 2U)
+    {
+        HWREGH(ui32FIFO) = *pui16Data++;
+        ui32Size -= 2U;
+    }
+
+    if(ui32Size > 0U)
     {
-        HWREGB(ui32FIFO) = *pui8Data++;
+        HWREGB(ui32FIFO) = *pui16Data & 0xFFU;
     }
 
     //
@@ -442,6 +442,14 @@ extern int32_t USBEndpointDataGet(uint32_t ui32Base, uint32_t ui32Endpoint,
                                   uint8_t *pui8Data, uint32_t *pui32Size);
 extern int32_t USBEndpointDataPut(uint32_t ui32Base, uint32_t ui32Endpoint,
                                   uint8_t *pui8Data, uint32_t ui32Size);
+extern int32_t USBEndpointDataGetPacked(uint32_t ui32Base,
+                                        uint32_t ui32Endpoint,
+                                        uint16_t *pui16Data,
+                                        uint32_t *pui32Size);
+extern int32_t USBEndpointDataPutPacked(uint32_t ui32Base,
+                                        uint32_t ui32Endpoint,
+                                        const uint16_t *pui16Data,
+                                        uint32_t ui32Size);
 extern int32_t USBEndpointDataSend(uint32_t ui32Base, uint32_t ui32Endpoint,
                                    uint32_t ui32TransType);
 extern void USBEndpointDataToggleClear(uint32_t ui32Base,
@@ -43,26 +43,163 @@
 #include "device.h"
 #include <string.h>
 #include <flash_disk/flashdisk.h>
+#include <flash_disk/ftl.h>
 #include "F021_F2837xD_C28x.h"
 
-#define Bzero_64KSector_u32length   0x4000
-#define Bzero_16KSector_u32length   0x1000
-
-//320KB
-#define RAM_DISK_SIZE 0x50000
-#define SECTOR_SIZE 0x8000
-//#define BLOCK_SIZE 0x2000
-#define BLOCK_SIZE 0x1000
-#define TRANSFER_SIZE 64U
 #define MULT (SECTOR_SIZE / BLOCK_SIZE * 2)
 
+//
+// Logical blocks the host addresses in each block. The disk_* functions take
+// logical block numbers, everything below them works on whole blocks.
+//
+#define LBLOCK_SIZE FLASHDISK_LOGICAL_BLOCK_SIZE
+#define SUB_BLOCKS (BLOCK_SIZE / LBLOCK_SIZE)
+
+//
+// Blocks exported to the host
+//
+#if FLASHDISK_USE_FTL
+#define DISK_BLOCKS FTL_BLOCKS
+#else
+#define DISK_BLOCKS (RAM_DISK_SIZE / BLOCK_SIZE)
+#endif
+
+//
+// One bit per block, set once the host has unmapped the block and cleared
+// when it is written again. The contents of a trimmed block no longer matter.
+//
+static uint16_t trimmed_map[(DISK_BLOCKS + 15) / 16];
+#define block_trimmed(b)      ((trimmed_map[(b) >> 4] >> ((b) & 15)) & 1)
+#define block_set_trimmed(b)  (trimmed_map[(b) >> 4] |= 1U << ((b) & 15))
+#define block_clr_trimmed(b)  (trimmed_map[(b) >> 4] &= ~(1U << ((b) & 15)))
+
+#if !FLASHDISK_USE_FTL
 #pragma DATA_SECTION(sector_buffer, "FLASH_SECTOR_CACHE");
 uint16_t sector_buffer[SECTOR_SIZE];
-uint16_t *ram_disk = (uint16_t *)0x090000;
+
+#define SECTOR_NONE 0xFFFF
+//
+// Write-back state of the sector held in sector_buffer
+//
+static uint16_t cache_sector = SECTOR_NONE;
+static uint16_t cache_dirty = 0;
+static uint16_t cache_erase = 0;
+static uint16_t cache_partial = 0;
+static uint32_t cache_written = 0;     /* blocks of the sector written by the host */
+static uint32_t cache_dropped = 0;     /* trimmed blocks left erased by the flush */
+
+//
+// Write-back of sector_buffer, run a step at a time from disk_poll() so the
+// USB interrupt is only held off for one FSM operation at a time
+//
+#define FLUSH_IDLE          0
+#define FLUSH_ERASE         1
+#define FLUSH_PROGRAM       2
+#define FLUSH_VERIFY        3
+#define FLUSH_STEP_WORDS    0x100
+static uint16_t flush_state = FLUSH_IDLE;
+static uint32_t flush_chunk;
+
+//
+// One bit per block, set while the block is known to be erased in flash.
+// The bits of a sector are read from flash by sector_scan() the first time
+// they are used, so the mount does not read the whole disk and later erase
+// decisions never read flash.
+//
+static uint16_t erased_map[(DISK_BLOCKS + 15) / 16];
+#define SCANNED_WORDS ((DISK_BLOCKS / MULT + 15) / 16)
+static uint16_t scanned_map[SCANNED_WORDS];
+static void sector_scan(uint32_t sector);
+#define block_erased(b)       (sector_scan((b) / MULT), \
+                               (erased_map[(b) >> 4] >> ((b) & 15)) & 1)
+#define block_set_erased(b)   (sector_scan((b) / MULT), \
+                               erased_map[(b) >> 4] |= 1U << ((b) & 15))
+#define block_clr_erased(b)   (sector_scan((b) / MULT), \
+                               erased_map[(b) >> 4] &= ~(1U << ((b) & 15)))
+
+//
+// Blocks [stream_first, stream_end) of the current WRITE(10) cover whole
+// flash sectors and are programmed straight to flash as they arrive
+//
+static uint32_t stream_first = 0;
+static uint32_t stream_end = 0;
+static uint16_t stream_sector = SECTOR_NONE;
+#if FLASHDISK_SECTOR_VERIFY
+#define FLETCHER_INIT   0UL
+static uint32_t stream_sum;             /* checksum of the packets in stream_sector */
+#endif
+#endif
+
+#if FLASHDISK_USE_FTL && SUB_BLOCKS > 1
+static uint32_t write_end = 0;          /* logical block after the current WRITE(10) */
+#endif
+
+#if FLASHDISK_READAHEAD_BLOCKS
+//
+// Blocks after the last read, copied out of flash by disk_prefetch() while
+// the host is busy with the current ones. Slot n holds the block with
+// lba % FLASHDISK_READAHEAD_BLOCKS == n.
+//
+#define LBA_NONE 0xFFFFFFFFUL
+#pragma DATA_SECTION(readahead_buffer, "FLASH_READAHEAD");
+static uint16_t readahead_buffer[FLASHDISK_READAHEAD_BLOCKS][BLOCK_SIZE / 2];
+static uint32_t readahead_lba[FLASHDISK_READAHEAD_BLOCKS];
+static uint32_t readahead_next = LBA_NONE;  /* block after the last read */
+static uint16_t readahead_active = 0;       /* last read followed the one before */
+
+#define readahead_slot(lba)   ((uint16_t)((lba) % FLASHDISK_READAHEAD_BLOCKS))
+#endif
+#if FLASHDISK_CACHE_BLOCKS
+//
+// Block cache for the few blocks the host keeps coming back to, the FAT and
+// directories. Short reads are kept in it and, unless the FTL is used or the
+// policy is write-through, short writes are held in it until the block is
+// evicted or the cache is written back. The FTL never sees a write-back
+// since disk_close() may run in the USB interrupt.
+//
+#if FLASHDISK_USE_FTL
+#define BCACHE_WRITE_BACK   0
+#else
+#define BCACHE_WRITE_BACK   (FLASHDISK_CACHE_POLICY != FLASHDISK_CACHE_WRITE_THROUGH)
+#endif
+#define BCACHE_VALID        1
+#define BCACHE_DIRTY        2       /* newer than flash */
+#define BCACHE_FILLING      4       /* host is writing it, not evictable */
+#define BCACHE_NONE         0xFFFF
+#pragma DATA_SECTION(bcache_data, "FLASH_BLOCK_CACHE");
+static uint16_t bcache_data[FLASHDISK_CACHE_BLOCKS][BLOCK_SIZE / 2];
+static uint32_t bcache_lba[FLASHDISK_CACHE_BLOCKS];
+static uint32_t bcache_stamp[FLASHDISK_CACHE_BLOCKS];  /* bcache_clock when last used */
+static uint16_t bcache_flags[FLASHDISK_CACHE_BLOCKS];
+static uint32_t bcache_clock = 0;
+static uint16_t bcache_fill = BCACHE_NONE;  /* slot the host is writing */
+static uint16_t bcache_cacheable = 0;       /* current WRITE(10) goes to the cache */
+static uint16_t bcache_flushing = 0;        /* disk_poll() is writing blocks back */
+#endif
+disk_stats_t disk_stats;
+uint16_t *ram_disk = FLASH_ADDR(0x090000);
 //存放密码
-uint16_t *usb_password = (uint16_t *)0x0B8000;
+uint16_t *usb_password = FLASH_ADDR(0x0B8000);
 extern bool usb_unlocked;
 
+//
+// Unlock record, programmed right after the password in the same sector by
+// set_usb_password(). It points at the last key packet written to the disk,
+// so disk_initialize() checks that one packet instead of scanning the whole
+// disk for it.
+//
+#define UNLOCK_RECORD_MAGIC 0x4b59
+#define UNLOCK_RECORD_NONE  0xFFFFFFFFUL
+#define UNLOCK_RECORD_WORDS 8
+typedef struct {
+    uint16_t magic;         /* UNLOCK_RECORD_MAGIC */
+    uint16_t off;           /* word offset of the key packet in its block */
+    uint32_t lba;           /* block holding the key packet, or NONE */
+    uint16_t reserved[3];
+    uint16_t check;         /* ~sum of the password and the words above */
+} unlock_record_t;
+#define unlock_record ((unlock_record_t *)(usb_password + 0x20))
+
 char* memmem(char* haystack, uint32_t hlen,char* needle, uint32_t nlen) {
 	char* cur;
 	char* last;
@@ -109,93 +246,182 @@ void Init_Flash_Sectors(void)
     }
 }
 
-void disk_initialize(void)
+//
+// Erase suspend state. Erases started from the main loop (disk_poll() and
+// disk_background()) are suspended whenever erase_pending() reports a USB
+// interrupt, erase_serve() lets the interrupt run with the bank readable
+// and the erase is resumed afterwards.
+//
+#define ERASE_NONE          0
+#define ERASE_RUNNING       1
+#define ERASE_SUSPENDED     2
+#define ERASE_FINISHED      3
+#define FMSTAT_ESUSP        0x4
+static volatile uint16_t erase_state = ERASE_NONE;
+static uint16_t erase_preemptible = 0;
+static uint16_t *erase_sector;
+static uint32_t erase_length;
+static int (*erase_pending)(void);
+static void (*erase_serve)(void);
+
+//
+// The disk shares flash bank 0 with the program and the bank cannot be read
+// while it is erasing. The loop polling for a pending interrupt and the
+// suspend/resume around it run from RAM, like the flash API itself.
+//
+#pragma CODE_SECTION(erase_suspend, ".TI.ramfunc");
+#if !FLASHDISK_USE_FTL
+#pragma CODE_SECTION(erase_finish, ".TI.ramfunc");
+#endif
+#pragma CODE_SECTION(flash_erase_sector, ".TI.ramfunc");
+
+//
+// erase_blank_check - Verify that the sector erased by flash_erase_sector() is
+// blank. The erase step itself does verification as it goes. This verify is
+// a second verification that can be done.
+//
+static void erase_blank_check(void)
 {
-    Init_Flash_Sectors();
-    uint64_t magic = 0x3a4b4b43304c4e55;
-    char *password_in_disk = memmem(ram_disk,RAM_DISK_SIZE/2,&magic,4);
-    if (password_in_disk) {
-        usb_unlocked = verify_password(password_in_disk);
-    } else if (*usb_password == 0xFFFF) {
-        usb_unlocked = true;
+    Fapi_StatusType oReturnCheck;
+    Fapi_FlashStatusWordType  oFlashStatusWord;
+
+    oReturnCheck = Fapi_doBlankCheck((uint32 *)erase_sector,
+        erase_length,
+        &oFlashStatusWord);
+
+    if(oReturnCheck != Fapi_Status_Success)
+    {
+        //
+        // Check Flash API documentation for possible errors.
+        // If erase command fails, use Fapi_getFsmStatus() function to get the
+        // FMSTAT register contents to see if any of the EV bit, ESUSP bit,
+        // CSTAT bit or VOLTSTAT bit is set. Refer to API documentation for
+        // more details.
+        //
+        Example_Error(oReturnCheck);
     }
 }
 
-unsigned int disk_read(uint32_t lba, uint16_t *buf,
-                       uint32_t off,uint32_t len)
+//
+// erase_suspend - Suspend the running erase, let the pending interrupt in and
+// resume the erase unless the interrupt had to finish it
+//
+static void erase_suspend(void)
 {
-    uint32_t start,i;
+    EALLOW;
+    Fapi_issueFsmSuspendCommand();
+    while (Fapi_checkFsmForReady() != Fapi_Status_FsmReady)
+    {
+    }
+    //erase在suspend生效前已经完成
+    if (!(Fapi_getFsmStatus() & FMSTAT_ESUSP))
+        return;
 
-    start = lba * BLOCK_SIZE+off;
-    len = len * TRANSFER_SIZE;
+    erase_state = ERASE_SUSPENDED;
+    disk_stats.erase_suspends++;
+    erase_serve();
 
-    if (!usb_unlocked) {
-        memset(buf,0,len);
-        return len;
+    if (erase_state == ERASE_SUSPENDED) {
+        EALLOW;
+        Fapi_issueAsyncCommand(Fapi_EraseResume);
+        erase_state = ERASE_RUNNING;
     }
-    if (start + len <= RAM_DISK_SIZE )
+}
+
+#if !FLASHDISK_USE_FTL
+//
+// erase_finish - Called from the USB interrupt while an erase is suspended
+// under it. Resumes the erase and waits for it so the caller can use the FSM.
+// The FTL has no write-back for the interrupt to finish.
+//
+static void erase_finish(void)
+{
+    if (erase_state != ERASE_SUSPENDED)
+        return;
+
+    EALLOW;
+    Flash0EccRegs.ECC_ENABLE.bit.ENABLE = 0x0;
+    Fapi_issueAsyncCommand(Fapi_EraseResume);
+    while (Fapi_checkFsmForReady() != Fapi_Status_FsmReady)
     {
-        for (i=0;i<len;i+=2) {
-            uint16_t data = ram_disk[(start+i)/2];
-            buf[i] = data & 0xFF;
-            buf[i+1] = data >> 8;
-        }
     }
-    return len;
+    erase_blank_check();
+    erase_state = ERASE_FINISHED;
 }
-void set_usb_password(uint16_t *password) {
+#endif
+
+//
+// flash_erase_sector - Erase the flash sector at sector and blank check the
+// u32length 32-bit words that follow it
+//
+void flash_erase_sector(uint16_t *sector, uint32_t u32length)
+{
     EALLOW;
     Flash0EccRegs.ECC_ENABLE.bit.ENABLE = 0x0;
-    uint16_t buf[0x20];
-    uint32_t u32Index, i;
-    Fapi_StatusType oReturnCheck = Fapi_Status_Success;
-    Fapi_FlashStatusWordType  oFlashStatusWord ;
-    volatile Fapi_FlashStatusType oFlashStatus = 0;
 
-    if (*usb_password != 0xFFFF) {
-        // Erase Sector
-        oReturnCheck = Fapi_issueAsyncCommandWithAddress(Fapi_EraseSector,
-            (uint32 *)usb_password);
-        //
-        // Wait until FSM is done with erase sector operation.
-        //
-        while (Fapi_checkFsmForReady() != Fapi_Status_FsmReady)
-        {
+    erase_sector = sector;
+    erase_length = u32length;
 
-        }
-        //
-        // Verify that Sector is erased. The erase step itself does verification
-        // as it goes. This verify is a second verification that can be done.
-        //
-        oReturnCheck = Fapi_doBlankCheck((uint32 *)usb_password,
-            Bzero_16KSector_u32length,
-            &oFlashStatusWord);
+    // Erase Sector
+    Fapi_issueAsyncCommandWithAddress(Fapi_EraseSector,
+        (uint32 *)sector);
+    erase_state = ERASE_RUNNING;
 
-        if(oReturnCheck != Fapi_Status_Success)
-        {
-            //
-            // Check Flash API documentation for possible errors.
-            // If erase command fails, use Fapi_getFsmStatus() function to get the
-            // FMSTAT register contents to see if any of the EV bit, ESUSP bit,
-            // CSTAT bit or VOLTSTAT bit is set. Refer to API documentation for
-            // more details.
-            //
-            Example_Error(oReturnCheck);
-        }
+    //
+    // Wait until FSM is done with erase sector operation. From the main loop
+    // a pending USB interrupt suspends the erase instead of waiting for it.
+    //
+    while (Fapi_checkFsmForReady() != Fapi_Status_FsmReady)
+    {
+        if (erase_preemptible && erase_pending && erase_pending())
+            erase_suspend();
     }
-    memset(buf,0,0x20);
-    int len = strlen(password) + 1;
-    if (len > 0x20) len = 0x20;
-    memcpy(buf,password,len-1);
 
-    for (i = 0, u32Index = (uint32_t)usb_password;
-         (u32Index < ((uint32_t)usb_password + 0x20)) && (oReturnCheck == Fapi_Status_Success);
-         i += 8, u32Index += 8) {
-        oReturnCheck = Fapi_issueProgrammingCommand((uint32 *)u32Index,buf + i,
+    //
+    // The interrupt may already have finished and checked the erase
+    //
+    if (erase_state != ERASE_FINISHED)
+        erase_blank_check();
+    erase_state = ERASE_NONE;
+}
+
+//
+// disk_set_erase_preempt - Register how main loop erases find and serve a
+// pending USB interrupt. pending returns nonzero while the interrupt is
+// waiting, serve lets it run once.
+//
+void disk_set_erase_preempt(int (*pending)(void), void (*serve)(void))
+{
+    erase_pending = pending;
+    erase_serve = serve;
+}
+
+//
+// flash_program_only - Program words from src into flash at dst, 8 words
+// (128 bits) per FSM command. dst must be 128-bit aligned. Fapi_DataOnly
+// leaves the ECC alone, for data programmed over data already in flash.
+// Unless FLASHDISK_SECTOR_VERIFY is 0 the result is checked by flash_verify().
+// It waits on the FSM while the bank is programming, so it runs from RAM.
+//
+#pragma CODE_SECTION(flash_program_only, ".TI.ramfunc");
+static void flash_program_only(uint16_t *dst, uint16_t *src, uint32_t words,
+                               Fapi_FlashProgrammingCommandsType mode)
+{
+    uint32_t i;
+    Fapi_StatusType oReturnCheck = Fapi_Status_Success;
+#if !FLASHDISK_SECTOR_VERIFY
+    Fapi_FlashStatusWordType  oFlashStatusWord;
+#endif
+
+    EALLOW;
+    Flash0EccRegs.ECC_ENABLE.bit.ENABLE = 0x0;
+
+    for (i = 0; (i < words) && (oReturnCheck == Fapi_Status_Success); i += 8) {
+        oReturnCheck = Fapi_issueProgrammingCommand((uint32 *)(dst+i), src+i,
                                                     8,
                                                     0,
                                                     0,
-                                                    Fapi_AutoEccGeneration);
+                                                    mode);
 
         //
         // Wait until FSM is done with program operation.
@@ -204,55 +430,690 @@ void set_usb_password(uint16_t *password) {
         {
         }
 
-        if (oReturnCheck != Fapi_Status_Success)
-        {
+        if (oReturnCheck != Fapi_Status_Success) {
             //
             // Check Flash API documentation for possible errors.
             //
             Example_Error(oReturnCheck);
         }
-        oFlashStatus = Fapi_getFsmStatus();
 
-        oReturnCheck = Fapi_doVerify((uint32 *)u32Index,
+        //
+        // A program the FSM could not do, such as one needing a bit to go
+        // from 0 to 1, is reported in FMSTAT
+        //
+        if (Fapi_getFsmStatus() != 0)
+            Example_Error(Fapi_Error_Fail);
+
+#if !FLASHDISK_SECTOR_VERIFY
+        oReturnCheck = Fapi_doVerify((uint32 *)(dst+i),
                                      4,
-                                     (uint32_t *)(buf + i),
+                                     (uint32_t *)(src+i),
                                      &oFlashStatusWord);
-        if (oReturnCheck != Fapi_Status_Success)
-        {
+        if (oReturnCheck != Fapi_Status_Success) {
             //
             // Check Flash API documentation for possible errors.
             //
-            // Example_Error(oReturnCheck);
+            //Example_Error(oReturnCheck);
             __asm("    ESTOP0");
         }
+#endif
     }
 }
-unsigned int disk_write(uint32_t lba, uint16_t *buf,
-                        uint32_t off,uint32_t len)
+
+//
+// flash_verify - Check words of flash at dst against src. One Fletcher
+// checksum covers the whole range, Fapi_doVerify is only used to find the
+// failing chunk when the checksums differ.
+//
+static void flash_verify(uint16_t *dst, uint16_t *src, uint32_t words)
 {
-    static uint16_t erase = 0;
-    uint32_t u32Index, start,i;
-    Fapi_StatusType oReturnCheck = Fapi_Status_Success;
-    Fapi_FlashStatusWordType  oFlashStatusWord ;
-    volatile Fapi_FlashStatusType oFlashStatus = 0;
+#if FLASHDISK_SECTOR_VERIFY
+    uint32_t i;
+    Fapi_StatusType oReturnCheck;
+    Fapi_FlashStatusWordType  oFlashStatusWord;
 
-    start = lba * BLOCK_SIZE + off;
-    len = len * TRANSFER_SIZE;
+    if (Fapi_calculateFletcherChecksum(dst, words) ==
+        Fapi_calculateFletcherChecksum(src, words))
+        return;
 
-    if (!usb_unlocked) {
-        if (off + len == BLOCK_SIZE)
-            usb_unlocked = verify_password(buf);
-        goto end;
+    for (i = 0; i < words; i += 8) {
+        oReturnCheck = Fapi_doVerify((uint32 *)(dst + i),
+                                     4,
+                                     (uint32_t *)(src + i),
+                                     &oFlashStatusWord);
+        if (oReturnCheck != Fapi_Status_Success) {
+            //
+            // oFlashStatusWord holds the failing address and data
+            //
+            __asm("    ESTOP0");
+        }
+    }
+#endif
+}
+
+//
+// flash_program - Program words from src into flash at dst and verify them.
+// dst must be 128-bit aligned.
+//
+void flash_program(uint16_t *dst, uint16_t *src, uint32_t words)
+{
+    flash_program_only(dst, src, words, Fapi_AutoEccGeneration);
+    flash_verify(dst, src, words);
+}
+
+#if !FLASHDISK_USE_FTL
+//
+// sector_scan - Build the erased_map bits of a sector from its flash
+// contents, the first time one of them is used
+//
+static void sector_scan(uint32_t sector)
+{
+    uint32_t b,i;
+    uint16_t *p;
+
+    if ((scanned_map[sector >> 4] >> (sector & 15)) & 1)
+        return;
+    scanned_map[sector >> 4] |= 1U << (sector & 15);
+    for (b=sector*MULT;b<(sector+1)*MULT;b++) {
+        p = ram_disk + b * (BLOCK_SIZE / 2);
+        for (i=0;i<BLOCK_SIZE/2 && p[i] == 0xFFFF;i++)
+            ;
+        if (i == BLOCK_SIZE/2)
+            erased_map[b >> 4] |= 1U << (b & 15);
+        else
+            erased_map[b >> 4] &= ~(1U << (b & 15));
+    }
+}
+#endif
+
+//
+// unlock_magic - Check for "UNL0CKK:" at the start of a packed packet
+//
+static int unlock_magic(uint16_t *buf)
+{
+    return buf[0] == 0x4e55 && buf[1] == 0x304c &&
+           buf[2] == 0x4b43 && buf[3] == 0x3a4b;
+}
+
+//
+// block_stored - Newest copy of block lba below the RAM caches:
+// sector_buffer while it holds the block's sector, flash otherwise. Returns 0
+// past the end of the disk and, with the FTL, for a block never written.
+//
+static uint16_t *block_stored(uint32_t lba)
+{
+#if FLASHDISK_USE_FTL
+    return ftl_block_addr(lba);
+#else
+    uint32_t start;
+
+    if (lba >= DISK_BLOCKS)
+        return 0;
+    start = lba * (BLOCK_SIZE / 2);
+    //sector还在缓存中时从sector_buffer读取
+    if (start / SECTOR_SIZE == cache_sector)
+        return sector_buffer + start % SECTOR_SIZE;
+    return ram_disk + start;
+#endif
+}
+
+static uint16_t unlock_record_check(unlock_record_t *rec)
+{
+    uint16_t *w = (uint16_t *)rec;
+    uint16_t sum = 0;
+    uint16_t i;
+
+    for (i=0;i<0x20;i++)
+        sum += usb_password[i];
+    for (i=0;i<UNLOCK_RECORD_WORDS-1;i++)
+        sum += w[i];
+    return ~sum;
+}
+
+//
+// unlock_record_program - Record where the key packet for the current
+// password lives. The record words must still be erased.
+//
+static void unlock_record_program(uint32_t lba, uint16_t off)
+{
+    unlock_record_t rec;
+
+    memset(&rec,0xFFFF,UNLOCK_RECORD_WORDS);
+    rec.magic = UNLOCK_RECORD_MAGIC;
+    rec.off = off;
+    rec.lba = lba;
+    rec.check = unlock_record_check(&rec);
+    flash_program((uint16_t *)unlock_record, (uint16_t *)&rec,
+                  UNLOCK_RECORD_WORDS);
+}
+
+//
+// unlock_key_find - Return the key packet stored on the disk, 0 if there is
+// none. Only a password set by an older firmware has no record yet, then the
+// disk is scanned once and the result recorded for the next boot.
+//
+static uint16_t *unlock_key_find(void)
+{
+    uint64_t magic = 0x3a4b4b43304c4e55;
+    uint16_t *key;
+    uint16_t i;
+
+    if (unlock_record->magic == UNLOCK_RECORD_MAGIC &&
+        unlock_record->check == unlock_record_check(unlock_record)) {
+        if (unlock_record->lba == UNLOCK_RECORD_NONE)
+            return 0;
+        key = block_stored(unlock_record->lba);
+        if (!key || !unlock_magic(key + unlock_record->off))
+            return 0;
+        return key + unlock_record->off;
+    }
+
+    key = (uint16_t *)memmem((char *)ram_disk,RAM_DISK_SIZE/2,(char *)&magic,4);
+    if (*usb_password == 0xFFFF)
+        return key;
+    for (i=0;i<UNLOCK_RECORD_WORDS;i++) {
+        if (((uint16_t *)unlock_record)[i] != 0xFFFF)
+            return key;
     }
 
     EALLOW;
     DcsmCommonRegs.FLSEM.all = 0xA501;
     EDIS;
+#if FLASHDISK_USE_FTL
+    //FTL里扫描到的可能是旧页，没有逻辑地址，下次启动再扫描
+    if (!key)
+        unlock_record_program(UNLOCK_RECORD_NONE, 0);
+#else
+    if (key)
+        unlock_record_program((key - ram_disk) / (BLOCK_SIZE / 2),
+                              (key - ram_disk) % (BLOCK_SIZE / 2));
+    else
+        unlock_record_program(UNLOCK_RECORD_NONE, 0);
+#endif
+    EALLOW;
+    DcsmCommonRegs.FLSEM.all = 0xA500;
+    EDIS;
+    return key;
+}
+
+void disk_initialize(void)
+{
+#if FLASHDISK_READAHEAD_BLOCKS || FLASHDISK_CACHE_BLOCKS
+    uint16_t n;
+#endif
+#if FLASHDISK_READAHEAD_BLOCKS
+
+    for (n=0;n<FLASHDISK_READAHEAD_BLOCKS;n++)
+        readahead_lba[n] = LBA_NONE;
+    readahead_next = LBA_NONE;
+    readahead_active = 0;
+#endif
+#if FLASHDISK_CACHE_BLOCKS
+    for (n=0;n<FLASHDISK_CACHE_BLOCKS;n++)
+        bcache_flags[n] = 0;
+    bcache_fill = BCACHE_NONE;
+    bcache_cacheable = 0;
+    bcache_flushing = 0;
+#endif
+    Init_Flash_Sectors();
+#if FLASHDISK_USE_FTL
+    ftl_mount();
+#else
+    memset(scanned_map,0,SCANNED_WORDS);
+#endif
+    uint16_t *password_in_disk = unlock_key_find();
+    if (password_in_disk) {
+        usb_unlocked = verify_password((char *)password_in_disk);
+    } else if (*usb_password == 0xFFFF) {
+        usb_unlocked = true;
+    }
+}
+
+#if FLASHDISK_CACHE_BLOCKS
+static uint16_t bcache_find(uint32_t lba)
+{
+    uint16_t n;
+
+    for (n=0;n<FLASHDISK_CACHE_BLOCKS;n++) {
+        if ((bcache_flags[n] & BCACHE_VALID) && bcache_lba[n] == lba)
+            return n;
+    }
+    return BCACHE_NONE;
+}
+
+//
+// bcache_victim - Pick the slot for a new block: a free one, otherwise the
+// least recently used one. Dirty slots are only taken if dirty_ok.
+//
+static uint16_t bcache_victim(uint16_t dirty_ok)
+{
+    uint16_t n, v = BCACHE_NONE;
+
+    for (n=0;n<FLASHDISK_CACHE_BLOCKS;n++) {
+        if (bcache_flags[n] == 0)
+            return n;
+        if (bcache_flags[n] & BCACHE_FILLING)
+            continue;
+        if (!dirty_ok && (bcache_flags[n] & BCACHE_DIRTY))
+            continue;
+        if (v == BCACHE_NONE || (int32_t)(bcache_stamp[n] - bcache_stamp[v]) < 0)
+            v = n;
+    }
+    return v;
+}
+
+//
+// bcache_insert - Keep a copy of block lba just read from flash
+//
+static void bcache_insert(uint32_t lba, uint16_t *buf)
+{
+    uint16_t n = bcache_victim(0);
+
+    if (n == BCACHE_NONE)
+        return;
+    memcpy(bcache_data[n], buf, BLOCK_SIZE / 2);
+    bcache_lba[n] = lba;
+    bcache_flags[n] = BCACHE_VALID;
+    bcache_stamp[n] = ++bcache_clock;
+}
+#endif
+
+//
+// block_forget - Drop the RAM copies of block lba once its contents no
+// longer matter. A block the host is writing into the cache is kept.
+//
+static void block_forget(uint32_t lba)
+{
+#if FLASHDISK_CACHE_BLOCKS
+    uint16_t n = bcache_find(lba);
+
+    if (n != BCACHE_NONE && !(bcache_flags[n] & BCACHE_FILLING))
+        bcache_flags[n] = 0;
+#endif
+#if FLASHDISK_READAHEAD_BLOCKS
+    if (readahead_lba[readahead_slot(lba)] == lba)
+        readahead_lba[readahead_slot(lba)] = LBA_NONE;
+#endif
+}
+
+//
+// read_block - Copy block lba into buf. Returns 0 if lba is past the end of
+// the disk.
+//
+static int read_block(uint32_t lba, uint16_t *buf)
+{
+    uint16_t *src;
+
+    if (lba >= DISK_BLOCKS)
+        return 0;
+    src = block_stored(lba);
+    if (src)
+        memcpy(buf, src, BLOCK_SIZE / 2);
+    else
+        memset(buf, 0xFFFF, BLOCK_SIZE / 2);
+    return 1;
+}
+
+//
+// block_lookup - Newest copy of block lba for the host. A block written
+// through the block cache is newest there, otherwise in sector_buffer or
+// flash; the read-ahead buffer only ever holds copies of those two. A block
+// found in neither RAM cache is kept in the block cache if keep is set.
+// Returns 0 like block_stored().
+//
+static uint16_t *block_lookup(uint32_t lba, uint16_t keep)
+{
+    uint16_t *src;
+#if FLASHDISK_CACHE_BLOCKS
+    uint16_t slot;
+
+    slot = bcache_find(lba);
+    if (slot != BCACHE_NONE) {
+        bcache_stamp[slot] = ++bcache_clock;
+        disk_stats.cache_hits++;
+        return bcache_data[slot];
+    }
+    disk_stats.cache_misses++;
+#endif
+#if FLASHDISK_READAHEAD_BLOCKS
+    if (readahead_lba[readahead_slot(lba)] == lba) {
+        disk_stats.readahead_hits++;
+        return readahead_buffer[readahead_slot(lba)];
+    }
+    disk_stats.readahead_misses++;
+#endif
+    src = block_stored(lba);
+#if FLASHDISK_CACHE_BLOCKS
+    if (src && keep)
+        bcache_insert(lba, src);
+#endif
+    return src;
+}
+
+//
+// disk_read - Read count logical blocks starting at lba into buf. Data is
+// packed two bytes per word, low byte first, the same as in flash.
+//
+unsigned int disk_read(uint32_t lba, uint16_t *buf, uint32_t count)
+{
+    uint32_t len = count * LBLOCK_SIZE;
+    uint32_t n, blk = DISK_BLOCKS;
+    uint16_t keep;
+    uint16_t *src = 0;
+
+    if (!usb_unlocked) {
+        memset(buf,0,len / 2);
+        return len;
+    }
+#if FLASHDISK_READAHEAD_BLOCKS
+    //连续读取时让disk_prefetch()预读后面的block
+    readahead_active = (lba == readahead_next);
+    readahead_next = lba + count;
+#endif
+    //只缓存零散的短读取，顺序读取交给预读
+    keep = len <= FLASHDISK_CACHE_MAX_RUN * BLOCK_SIZE;
+#if FLASHDISK_READAHEAD_BLOCKS
+    keep = keep && !readahead_active;
+#endif
+    for (n=0;n<count;n++,lba++,buf+=LBLOCK_SIZE/2) {
+        if (lba / SUB_BLOCKS >= DISK_BLOCKS)
+            break;
+        //同一个block里的逻辑block只查找一次
+        if (lba / SUB_BLOCKS != blk) {
+            blk = lba / SUB_BLOCKS;
+            src = block_lookup(blk, keep);
+        }
+        if (src)
+            memcpy(buf, src + lba % SUB_BLOCKS * (LBLOCK_SIZE / 2),
+                   LBLOCK_SIZE / 2);
+        else
+            memset(buf, 0xFFFF, LBLOCK_SIZE / 2);
+    }
+    return len;
+}
+
+//
+// disk_prefetch - Copy the next block of a sequential read stream that is
+// not in the read-ahead buffer yet. Called from the main loop with the USB
+// interrupt masked, so it does one block at a time. Returns nonzero if a
+// block was read.
+//
+int disk_prefetch(void)
+{
+#if FLASHDISK_READAHEAD_BLOCKS
+    uint32_t lba;
+    uint16_t n, slot;
+
+    if (!readahead_active || !usb_unlocked)
+        return 0;
+    for (n=0;n<FLASHDISK_READAHEAD_BLOCKS;n++) {
+        lba = readahead_next / SUB_BLOCKS + n;
+        slot = readahead_slot(lba);
+        if (readahead_lba[slot] == lba)
+            continue;
+#if FLASHDISK_CACHE_BLOCKS
+        //已在block cache中，flash里的数据可能是旧的
+        if (bcache_find(lba) != BCACHE_NONE)
+            continue;
+#endif
+        readahead_lba[slot] = LBA_NONE;
+        if (!read_block(lba, readahead_buffer[slot]))
+            return 0;
+        readahead_lba[slot] = lba;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+//
+// set_usb_password - Store password and record that its key packet is at
+// word off of block lba.
+//
+void set_usb_password(uint16_t *password, uint32_t lba, uint16_t off) {
+    uint16_t buf[0x20];
 
-    //设置USB密码
-    if (!strncmp((char *)buf,"UNL0CKK:",8)) {
-        set_usb_password((char *)(buf+8));
+    if (*usb_password != 0xFFFF) {
+        flash_erase_sector(usb_password, Bzero_16KSector_u32length);
     }
+    memset(buf,0,0x20);
+    int len = strlen(password) + 1;
+    if (len > 0x20) len = 0x20;
+    memcpy(buf,password,len-1);
+
+    flash_program(usb_password, buf, 0x20);
+    unlock_record_program(lba, off);
+}
+#if !FLASHDISK_USE_FTL
+//
+// program_changed - Program the 128-bit chunks of src that differ from the
+// flash at dst and return how many were programmed. Chunks that already
+// match, such as all 0xFFFF chunks of an erased sector, are skipped. Flash
+// that was not erased first is programmed with mode Fapi_DataOnly.
+//
+static uint32_t program_changed(uint16_t *dst, uint16_t *src, uint32_t words,
+                                Fapi_FlashProgrammingCommandsType mode)
+{
+    uint32_t i;
+    uint32_t programmed = 0;
+
+    for (i=0;i<words;i+=8) {
+        if (memcmp(dst + i, src + i, 8)) {
+            flash_program_only(dst + i, src + i, 8, mode);
+            programmed++;
+            disk_stats.chunks_programmed++;
+            disk_stats.last_programmed++;
+        } else {
+            disk_stats.chunks_skipped++;
+            disk_stats.last_skipped++;
+        }
+    }
+    return programmed;
+}
+
+#if FLASHDISK_SECTOR_VERIFY
+//
+// fletcher - Continue the Fletcher checksum sum, started at FLETCHER_INIT,
+// over words at p. The sums are kept reduced mod 65535, so the result only
+// depends on the words and not on how they were split between calls.
+//
+static uint32_t fletcher(uint32_t sum, const uint16_t *p, uint32_t words)
+{
+    uint32_t a = sum & 0xFFFF, b = sum >> 16, n;
+
+    while (words) {
+        n = words < 256 ? words : 256;
+        words -= n;
+        do {
+            a += *p++;
+            b += a;
+        } while (--n);
+        a = (a & 0xFFFF) + (a >> 16);
+        b = (b & 0xFFFF) + (b >> 16);
+        b = (b & 0xFFFF) + (b >> 16);
+    }
+    return (b % 65535) << 16 | (a % 65535);
+}
+
+//
+// stream_verify - Check a streamed sector against the checksum of the
+// packets programmed into it, once its last packet is in flash. The packets
+// themselves are gone by then, so a mismatch cannot be narrowed down.
+//
+static void stream_verify(uint16_t *sector)
+{
+    disk_stats.stream_verifies++;
+    if (fletcher(FLETCHER_INIT, sector, SECTOR_SIZE) != stream_sum)
+        __asm("    ESTOP0");
+}
+#endif
+
+//
+// flush_begin - Start writing the cached sector back to flash if it holds
+// completed blocks that are not in flash yet. The work itself is done by
+// flush_step(). When the sector is erased, trimmed blocks are left blank
+// instead of being programmed back.
+//
+static void flush_begin(void)
+{
+    uint16_t i;
+
+    if (flush_state != FLUSH_IDLE || cache_sector == SECTOR_NONE ||
+        !cache_dirty)
+        return;
+
+    //如果需要erase
+    cache_dropped = 0;
+    if (cache_erase) {
+        //host已释放的block不再写回，erase后保持空白
+        for (i=0;i<MULT;i++) {
+            if (block_trimmed((uint32_t)cache_sector * MULT + i)) {
+                memset(sector_buffer + i * (BLOCK_SIZE / 2), 0xFFFF,
+                       BLOCK_SIZE / 2);
+                cache_dropped |= 1UL << i;
+            }
+        }
+        flush_state = FLUSH_ERASE;
+        disk_stats.erases++;
+    } else {
+        flush_state = FLUSH_PROGRAM;
+        disk_stats.erases_avoided++;
+    }
+    flush_chunk = 0;
+    disk_stats.last_programmed = 0;
+    disk_stats.last_skipped = 0;
+}
+
+//
+// flush_step - Do the next bounded piece of the write-back started by
+// flush_begin(): the erase, FLUSH_STEP_WORDS of programming, or the final
+// verify. The FSM is always idle again when this returns.
+//
+static void flush_step(void)
+{
+    uint16_t *sector_begin;
+    uint32_t i;
+
+    sector_begin = ram_disk + (uint32_t)cache_sector * SECTOR_SIZE;
+
+    switch (flush_state) {
+    case FLUSH_ERASE:
+        flash_erase_sector(sector_begin, Bzero_64KSector_u32length);
+        //中断里的disk_close()可能已经完成了写回
+        if (flush_state == FLUSH_ERASE)
+            flush_state = FLUSH_PROGRAM;
+        break;
+    case FLUSH_PROGRAM:
+        //新数据只把1变成0时直接在原位编程，ECC已关闭，原位编程不写ECC
+        program_changed(sector_begin + flush_chunk,
+                        sector_buffer + flush_chunk, FLUSH_STEP_WORDS,
+                        cache_erase ? Fapi_AutoEccGeneration : Fapi_DataOnly);
+        flush_chunk += FLUSH_STEP_WORDS;
+        if (flush_chunk >= SECTOR_SIZE)
+            flush_state = FLUSH_VERIFY;
+        break;
+    case FLUSH_VERIFY:
+        //整个sector只校验一次
+        flash_verify(sector_begin, sector_buffer, SECTOR_SIZE);
+        //未写入的block恢复原来的内容，状态不变
+        for (i=0;i<MULT;i++) {
+            if (cache_dropped & (1UL << i))
+                block_set_erased((uint32_t)cache_sector * MULT + i);
+            else if (cache_written & (1UL << i))
+                block_clr_erased((uint32_t)cache_sector * MULT + i);
+        }
+        cache_dirty = 0;
+        cache_erase = 0;
+        cache_written = 0;
+        flush_state = FLUSH_IDLE;
+        break;
+    default:
+        break;
+    }
+}
+
+//
+// sector_flush - Write the cached sector back to flash and wait for it
+//
+static void sector_flush(void)
+{
+    flush_begin();
+    while (flush_state != FLUSH_IDLE)
+        flush_step();
+}
+
+//
+// stream_write - Program len bytes at off of block lba directly to flash. The
+// sector is erased when its first block starts, the old contents are never
+// read back since the command overwrites all of them.
+//
+static void stream_write(uint32_t lba, uint16_t *buf,
+                         uint32_t off, uint32_t len)
+{
+    uint32_t start,i;
+    uint16_t lsector;
+
+    start = (lba * BLOCK_SIZE + off) / 2;
+    lsector = start / SECTOR_SIZE;
+
+    if (off == 0 && lba % MULT == 0) {
+        //整个sector会被覆盖，缓存里的旧数据直接丢弃
+        if (cache_sector == lsector) {
+            cache_sector = SECTOR_NONE;
+            cache_dirty = 0;
+            cache_partial = 0;
+            cache_written = 0;
+        }
+        for (i=0;i<MULT && block_erased(lba + i);i++)
+            ;
+        //已经是空白的sector不需要erase
+        if (i < MULT) {
+            flash_erase_sector(ram_disk + (uint32_t)lsector * SECTOR_SIZE,
+                               Bzero_64KSector_u32length);
+            disk_stats.erases++;
+            for (i=0;i<MULT;i++)
+                block_set_erased(lba + i);
+        } else {
+            disk_stats.erases_avoided++;
+        }
+        stream_sector = lsector;
+#if FLASHDISK_SECTOR_VERIFY
+        stream_sum = FLETCHER_INIT;
+#endif
+        disk_stats.last_programmed = 0;
+        disk_stats.last_skipped = 0;
+    }
+    if (stream_sector != lsector)
+        return;
+    if (off == 0)
+        block_clr_erased(lba);
+    //每收到一个包就直接编程
+    program_changed(ram_disk + start, buf, len / 2, Fapi_AutoEccGeneration);
+#if FLASHDISK_SECTOR_VERIFY
+    //只累计校验和，sector的最后一个包写完后整个sector校验一次
+    stream_sum = fletcher(stream_sum, buf, len / 2);
+    if ((start + len / 2) % SECTOR_SIZE == 0)
+        stream_verify(ram_disk + (uint32_t)lsector * SECTOR_SIZE);
+#endif
+}
+
+//
+// sector_write - Merge len bytes at off of block lba into the cached copy of
+// its flash sector. The sector is only written back when a block of another
+// sector arrives or disk_flush() is called. Returns 0 while the cached sector
+// is being written back and -1 if the data lies past the end of the disk.
+//
+static int sector_write(uint32_t lba, uint16_t *buf,
+                        uint32_t off, uint32_t len)
+{
+    uint32_t start,i;
+
+    if (lba >= stream_first && lba < stream_end) {
+        stream_write(lba, buf, off, len);
+        return 1;
+    }
+
+    start = lba * BLOCK_SIZE + off;
     if (start + len <= RAM_DISK_SIZE)
     {
         start = start / 2;
@@ -260,107 +1121,594 @@ unsigned int disk_write(uint32_t lba, uint16_t *buf,
         start = start % SECTOR_SIZE;
         uint16_t *sector_begin = ram_disk + lsector * SECTOR_SIZE;
 
-        //off = off % BLOCK_SIZE;
-        if (off == 0) {
-            //拷贝整个sector
-            memcpy(sector_buffer,sector_begin,SECTOR_SIZE);
-            //检查需要写入的区域是否已经格式化
-            for (i=0;i<BLOCK_SIZE/2;i++) {
-                uint16_t x = sector_begin[start + i];
-                if (x != 0xFFFF) {
-                    erase = 1;
-                    break;
-                }
+        if (off % LBLOCK_SIZE == 0) {
+            //写入另一个sector时先写回当前缓存，写回完成前不接收数据
+            if (cache_sector != lsector && cache_dirty) {
+                flush_begin();
+                return 0;
+            }
+            if (cache_sector != lsector) {
+                //拷贝整个sector
+                memcpy(sector_buffer,sector_begin,SECTOR_SIZE);
+                cache_sector = lsector;
+                cache_erase = 0;
+                cache_written = 0;
             }
+            cache_written |= 1UL << (lba % MULT);
+            cache_partial = 1;
         }
+        if (cache_sector != lsector)
+            return 1;
         //更新指定block区的数据
-        for (i=0;i<len;i+=2) {
-            uint16_t data1 = buf[i] & 0xFF;
-            uint16_t data2 = buf[i+1] & 0xFF;
-            sector_buffer[start+i/2] = data1 | (data2 << 8);
+        for (i=0;i<len/2;i++) {
+            uint16_t data = buf[i];
+            //flash中的某一位需要从0变成1时才erase
+            if (!cache_erase && !block_erased(lba) &&
+                (data & ~sector_begin[start+i]))
+                cache_erase = 1;
+            sector_buffer[start+i] = data;
         }
-        //向flash写入数据
-        if (off + len == BLOCK_SIZE) {
-            EALLOW;
-            Flash0EccRegs.ECC_ENABLE.bit.ENABLE = 0x0;
-            //如果需要erase
-            if (erase) {
-                // Erase Sector
-                oReturnCheck = Fapi_issueAsyncCommandWithAddress(Fapi_EraseSector,
-                    (uint32 *)sector_begin);
-                //
-                // Wait until FSM is done with erase sector operation.
-                //
-                while (Fapi_checkFsmForReady() != Fapi_Status_FsmReady)
-                {
-
-                }
-                
-                //
-                // Verify that Sector is erased. The erase step itself does verification
-                // as it goes. This verify is a second verification that can be done.
-                //
-                oReturnCheck = Fapi_doBlankCheck((uint32 *)sector_begin,
-                    Bzero_64KSector_u32length,
-                    &oFlashStatusWord);
-                    
-                if(oReturnCheck != Fapi_Status_Success)
-                {
-                    //
-                    // Check Flash API documentation for possible errors.
-                    // If erase command fails, use Fapi_getFsmStatus() function to get the
-                    // FMSTAT register contents to see if any of the EV bit, ESUSP bit,
-                    // CSTAT bit or VOLTSTAT bit is set. Refer to API documentation for
-                    // more details.
-                    //
-                    Example_Error(oReturnCheck);
-                }
-            }
+        if ((off + len) % LBLOCK_SIZE == 0) {
+            cache_dirty = 1;
+            cache_partial = 0;
+        }
+        return 1;
+    }
+    return -1;
+}
+#endif
 
-            for (i = 0, u32Index = (uint32_t)sector_begin;
-                    (u32Index < ((uint32_t)sector_begin + SECTOR_SIZE)) && (oReturnCheck == Fapi_Status_Success);
-                    i += 8, u32Index += 8) {
-                oReturnCheck = Fapi_issueProgrammingCommand((uint32 *)u32Index, sector_buffer+i,
-                                                            8,
-                                                            0,
-                                                            0,
-                                                            Fapi_AutoEccGeneration);
-
-                //
-                // Wait until FSM is done with program operation.
-                //
-                while (Fapi_checkFsmForReady() == Fapi_Status_FsmBusy)
-                {
-                }
-
-                if (oReturnCheck != Fapi_Status_Success) {
-                    //
-                    // Check Flash API documentation for possible errors.
-                    //
-                    Example_Error(oReturnCheck);
-                }
-                oFlashStatus = Fapi_getFsmStatus();
-
-                oReturnCheck = Fapi_doVerify((uint32 *)u32Index,
-                                             4,
-                                             (uint32_t *)(sector_buffer+i),
-                                             &oFlashStatusWord);
-                if (oReturnCheck != Fapi_Status_Success) {
-                    //
-                    // Check Flash API documentation for possible errors.
-                    //
-                    //Example_Error(oReturnCheck);
-                    __asm("    ESTOP0");
-                }
-            }
+#if FLASHDISK_CACHE_BLOCKS
+#if BCACHE_WRITE_BACK
+//
+// bcache_writeback - Pass dirty slot n on to sector_buffer. Returns 0 if the
+// sector in sector_buffer has to be written back first, flush_begin() has
+// then been called.
+//
+static int bcache_writeback(uint16_t n)
+{
+    //
+    // The current WRITE(10) erases and rewrites the whole sector of a block
+    // in the stream range, never write the old copy back into it
+    //
+    if (bcache_lba[n] >= stream_first && bcache_lba[n] < stream_end) {
+        bcache_flags[n] &= ~BCACHE_DIRTY;
+        return 1;
+    }
+    if (!sector_write(bcache_lba[n], bcache_data[n], 0, BLOCK_SIZE))
+        return 0;
+    bcache_flags[n] &= ~BCACHE_DIRTY;
+    disk_stats.cache_writebacks++;
+    return 1;
+}
+
+//
+// bcache_next_dirty - Next slot to write back, one of the sector already in
+// sector_buffer if there is one
+//
+static uint16_t bcache_next_dirty(void)
+{
+    uint16_t n, v = BCACHE_NONE;
+
+    for (n=0;n<FLASHDISK_CACHE_BLOCKS;n++) {
+        if ((bcache_flags[n] & (BCACHE_DIRTY | BCACHE_FILLING)) != BCACHE_DIRTY)
+            continue;
+        if (v == BCACHE_NONE || bcache_lba[n] / MULT == cache_sector)
+            v = n;
+    }
+    return v;
+}
+
+//
+// bcache_write - Store len bytes at off of block lba in the cache. A new
+// block takes the least recently used slot, whose block is written back
+// first if it is dirty, and starts out with the stored contents when only
+// part of it is written. Returns 0 while that has to wait for a sector flush.
+//
+static int bcache_write(uint32_t lba, uint16_t *buf,
+                        uint32_t off, uint32_t len)
+{
+    uint16_t n;
+
+    if (off % LBLOCK_SIZE == 0) {
+        bcache_fill = BCACHE_NONE;
+        n = bcache_find(lba);
+        if (n == BCACHE_NONE) {
+            n = bcache_victim(1);
+            if (n == BCACHE_NONE)
+                return sector_write(lba, buf, off, len);
+            if ((bcache_flags[n] & BCACHE_DIRTY) && !bcache_writeback(n))
+                return 0;
+            bcache_flags[n] = 0;
+            bcache_lba[n] = lba;
+#if SUB_BLOCKS > 1
+            //只写入一部分逻辑block，其余部分保留原来的数据
+            read_block(lba, bcache_data[n]);
+            bcache_flags[n] = BCACHE_VALID;
+#endif
+        } else if (bcache_flags[n] & BCACHE_DIRTY) {
+            //上一次写入还没进flash，省掉一次写flash
+            disk_stats.cache_absorbed++;
+        }
+        bcache_flags[n] |= BCACHE_FILLING;
+        bcache_fill = n;
+    }
+    n = bcache_fill;
+    if (n == BCACHE_NONE || bcache_lba[n] != lba)
+        return sector_write(lba, buf, off, len);
+
+    memcpy(bcache_data[n] + off / 2, buf, len / 2);
+    if ((off + len) % LBLOCK_SIZE == 0) {
+        bcache_flags[n] = BCACHE_VALID | BCACHE_DIRTY;
+        bcache_stamp[n] = ++bcache_clock;
+        bcache_fill = BCACHE_NONE;
+    }
+    return 1;
+}
+
+//
+// bcache_flush_step - Write back one dirty block for disk_poll(). Once none
+// is left the sector in sector_buffer is written back as well.
+//
+static void bcache_flush_step(void)
+{
+    uint16_t n = bcache_next_dirty();
+
+    if (n == BCACHE_NONE || cache_partial) {
+        bcache_flushing = 0;
+        if (!cache_partial)
+            flush_begin();
+        return;
+    }
+    bcache_writeback(n);
+}
+#endif
+
+//
+// bcache_update - Keep the cached copy of block lba, if any, in step with a
+// write that went to flash. The whole block is rewritten, so the copy is no
+// longer newer than flash.
+//
+static void bcache_update(uint32_t lba, uint16_t *buf,
+                          uint32_t off, uint32_t len)
+{
+    uint16_t n = bcache_find(lba);
+
+    if (n == BCACHE_NONE)
+        return;
+    if (off == 0)
+        bcache_flags[n] &= ~BCACHE_DIRTY;
+    memcpy(bcache_data[n] + off / 2, buf, len / 2);
+    if (off + len == BLOCK_SIZE)
+        bcache_stamp[n] = ++bcache_clock;
+}
+#endif
+
+//
+// block_write - Pass len bytes at off of block lba on to the block cache, the
+// FTL or sector_buffer. Returns 0 if the data has to be offered again and -1
+// if it could not be stored.
+//
+static int block_write(uint32_t lba, uint16_t *buf,
+                       uint32_t off, uint32_t len)
+{
+    int ret;
+
+    if (off % LBLOCK_SIZE == 0 && lba < DISK_BLOCKS)
+        block_clr_trimmed(lba);
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    if (bcache_cacheable)
+        return bcache_write(lba, buf, off, len);
+#if SUB_BLOCKS > 1
+    {
+        uint16_t n = bcache_find(lba);
+
+        //cache中更新的数据先写回，再合并这次写入的逻辑block
+        if (off % LBLOCK_SIZE == 0 && n != BCACHE_NONE &&
+            (bcache_flags[n] & BCACHE_DIRTY) && !bcache_writeback(n))
+            return 0;
+    }
+#endif
+#endif
+#if FLASHDISK_USE_FTL
+    ret = ftl_write(lba, buf, off, len) ? 1 : -1;
+#else
+    ret = sector_write(lba, buf, off, len);
+#endif
+    if (ret <= 0)
+        return ret;
+#if FLASHDISK_CACHE_BLOCKS
+    bcache_update(lba, buf, off, len);
+#endif
+    return 1;
+}
+
+//
+// disk_write - Write len packets at off of logical block lba. Called from the
+// main loop with the USB interrupt masked, a long erase is suspended to let
+// the interrupt queue more packets. Returns 0 while the disk cannot take data
+// and DISK_WRITE_FAILED if the data was dropped.
+//
+unsigned int disk_write(uint32_t lba, uint16_t *buf,
+                        uint32_t off,uint32_t len)
+{
+    char password[TRANSFER_SIZE - 8 + 1];
+    uint32_t i;
+    int ret;
+
+    len = len * TRANSFER_SIZE;
+
+    if (!usb_unlocked) {
+        if (off + len == LBLOCK_SIZE)
+            usb_unlocked = verify_password(buf);
+        goto end;
+    }
+    //逻辑block在所属block中的位置
+    off += lba % SUB_BLOCKS * LBLOCK_SIZE;
+    lba /= SUB_BLOCKS;
+
+    //erase被暂停时不能使用FSM
+    if (erase_state != ERASE_NONE)
+        return 0;
+#if !FLASHDISK_USE_FTL
+    //写回还没完成时暂不接收数据，USB层会保留这个包
+    if (flush_state != FLUSH_IDLE)
+        return 0;
+#endif
+
+    EALLOW;
+    DcsmCommonRegs.FLSEM.all = 0xA501;
+    EDIS;
+
+    erase_preemptible = FLASHDISK_ERASE_SUSPEND;
+    ret = block_write(lba, buf, off, len);
+    if (ret <= 0)
+        len = 0;
+    erase_preemptible = 0;
+#if FLASHDISK_USE_FTL && SUB_BLOCKS > 1
+    //命令的最后一个逻辑block写完后FTL补齐并提交这个block
+    if (len && (off + len) % LBLOCK_SIZE == 0 &&
+        lba * SUB_BLOCKS + (off + len) / LBLOCK_SIZE == write_end)
+        ftl_close();
+#endif
+#if FLASHDISK_READAHEAD_BLOCKS
+    //预读的旧数据作废
+    if (len && readahead_lba[readahead_slot(lba)] == lba)
+        readahead_lba[readahead_slot(lba)] = LBA_NONE;
+#endif
+    //设置USB密码，密码存储时每个word一个字节
+    if (len && unlock_magic(buf)) {
+        for (i=0;i<TRANSFER_SIZE-8;i+=2) {
+            password[i] = buf[4+i/2] & 0xFF;
+            password[i+1] = buf[4+i/2] >> 8;
         }
+        password[TRANSFER_SIZE-8] = 0;
+        set_usb_password((uint16_t *)password, lba, off / 2);
     }
     DcsmCommonRegs.FLSEM.all = 0xA500;
     EDIS;
+    //数据没有存下来，命令要以错误结束
+    if (ret < 0)
+        return DISK_WRITE_FAILED;
     end:
     return len;
 }
 
+//
+// flush_wait - Write back the cached sector and wait for it, and the dirty
+// blocks of the block cache as well if all is set
+//
+static void flush_wait(uint16_t all)
+{
+#if !FLASHDISK_USE_FTL
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    uint16_t n;
+    uint16_t cached = all && bcache_next_dirty() != BCACHE_NONE;
+#else
+    uint16_t cached = 0;
+#endif
+    uint16_t preemptible = erase_preemptible;
+    uint16_t suspended;
+
+    //
+    // Never write back a block that is still being received
+    //
+    if (flush_state == FLUSH_IDLE &&
+        ((!cache_dirty && !cached) || cache_partial))
+        return;
+
+    EALLOW;
+    DcsmCommonRegs.FLSEM.all = 0xA501;
+    EDIS;
+
+    //
+    // A main loop erase this interrupted is finished below, never suspend
+    // one started here
+    //
+    erase_preemptible = 0;
+
+    //
+    // Called from the USB interrupt while the write-back erase is suspended:
+    // finish that erase here, the main loop sees it done when it resumes
+    //
+    if (erase_state == ERASE_SUSPENDED) {
+        erase_finish();
+        if (flush_state == FLUSH_ERASE)
+            flush_state = FLUSH_PROGRAM;
+    }
+    suspended = erase_state;
+    sector_flush();
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    if (cached) {
+        while ((n = bcache_next_dirty()) != BCACHE_NONE) {
+            if (!bcache_writeback(n))
+                sector_flush();
+        }
+        sector_flush();
+    }
+#endif
+    //这里新做的erase不能让被打断的erase重新做blank check
+    erase_state = suspended;
+    erase_preemptible = preemptible;
+
+    DcsmCommonRegs.FLSEM.all = 0xA500;
+    EDIS;
+#endif
+}
+
+//
+// disk_flush - Write back everything cached, the block cache included, and
+// wait for it. Called from the main loop.
+//
+void disk_flush(void)
+{
+    flush_wait(1);
+}
+
+//
+// disk_close - Write back the cached sector and wait for it, at most one
+// erase and program. Called from the USB interrupt when the drive is closed,
+// the dirty blocks of the block cache are left to disk_poll() in the main
+// loop.
+//
+void disk_close(void)
+{
+#if !FLASHDISK_USE_FTL && FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    if (bcache_next_dirty() != BCACHE_NONE)
+        bcache_flushing = 1;
+#endif
+    flush_wait(0);
+}
+
+//
+// disk_flush_async - Start writing back the cached sector without waiting.
+// Called from the main loop once the host goes idle, disk_poll() finishes it.
+//
+void disk_flush_async(void)
+{
+#if !FLASHDISK_USE_FTL
+    if (cache_partial)
+        return;
+#if FLASHDISK_CACHE_BLOCKS && FLASHDISK_CACHE_POLICY == FLASHDISK_CACHE_WRITE_BACK_IDLE
+    //先写回block cache，最后再写回sector
+    bcache_flushing = 1;
+#else
+    flush_begin();
+#endif
+#endif
+}
+
+//
+// disk_sync - Start writing back everything cached, the block cache first,
+// and run the next step of it. Called from the main loop for SYNCHRONIZE
+// CACHE and START STOP UNIT until it returns 0, with the USB interrupt masked.
+//
+int disk_sync(void)
+{
+#if !FLASHDISK_USE_FTL
+    if (flush_state == FLUSH_IDLE && !cache_partial) {
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+        if (bcache_next_dirty() != BCACHE_NONE)
+            bcache_flushing = 1;
+        else
+#endif
+        flush_begin();
+    }
+#endif
+    return disk_poll();
+}
+
+//
+// disk_poll - Run the next step of a pending write-back. Called from the main
+// loop with the USB interrupt masked. Returns nonzero while a write-back is
+// still in progress and disk_write() is refusing data.
+//
+int disk_poll(void)
+{
+#if !FLASHDISK_USE_FTL
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    if (flush_state == FLUSH_IDLE && !bcache_flushing)
+        return 0;
+#else
+    if (flush_state == FLUSH_IDLE)
+        return 0;
+#endif
+
+    EALLOW;
+    DcsmCommonRegs.FLSEM.all = 0xA501;
+    EDIS;
+
+    erase_preemptible = FLASHDISK_ERASE_SUSPEND;
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    if (flush_state == FLUSH_IDLE)
+        bcache_flush_step();
+    else
+#endif
+    flush_step();
+    erase_preemptible = 0;
+
+    DcsmCommonRegs.FLSEM.all = 0xA500;
+    EDIS;
+
+#if FLASHDISK_CACHE_BLOCKS && BCACHE_WRITE_BACK
+    return flush_state != FLUSH_IDLE || bcache_flushing;
+#else
+    return flush_state != FLUSH_IDLE;
+#endif
+#else
+    return 0;
+#endif
+}
+
+//
+// disk_background - Idle-time maintenance, called from the main loop with the
+// USB interrupt masked while no SCSI command is in progress. Does at most one
+// erase so a new command is never held off for longer than that. Returns
+// nonzero if work was done.
+//
+int disk_background(void)
+{
+    int ret;
+#if FLASHDISK_USE_FTL
+    uint32_t lba;
+    uint16_t n = 0;
+#else
+    uint16_t s;
+    uint32_t lba, i;
+#endif
+
+#if !FLASHDISK_USE_FTL
+    if (flush_state != FLUSH_IDLE)
+        return 0;
+    //
+    // A sector whose blocks were all unmapped by the host is erased now, so
+    // the next write into it programs without an erase
+    //
+    for (s=0;s<DISK_BLOCKS/MULT;s++) {
+        lba = (uint32_t)s * MULT;
+        for (i=0;i<MULT && block_trimmed(lba + i);i++)
+            ;
+        if (i < MULT)
+            continue;
+        for (i=0;i<MULT && block_erased(lba + i);i++)
+            ;
+        if (i == MULT)
+            continue;
+        if (cache_sector == s) {
+            if (cache_dirty || cache_partial)
+                continue;
+            cache_sector = SECTOR_NONE;
+        }
+        break;
+    }
+    if (s == DISK_BLOCKS/MULT)
+        return 0;
+#endif
+
+    EALLOW;
+    DcsmCommonRegs.FLSEM.all = 0xA501;
+    EDIS;
+
+    erase_preemptible = FLASHDISK_ERASE_SUSPEND;
+#if FLASHDISK_USE_FTL
+    //
+    // Unmap trimmed blocks in the FTL a few at a time. The bit is cleared
+    // first, the USB interrupt may trim more while a checkpoint erase is
+    // suspended.
+    //
+    for (lba=0;lba<DISK_BLOCKS && n<MULT;lba++) {
+        if (!block_trimmed(lba))
+            continue;
+        block_clr_trimmed(lba);
+        ftl_trim(lba);
+        n++;
+    }
+    ret = n ? 1 : ftl_background();
+#else
+    flash_erase_sector(ram_disk + (uint32_t)s * SECTOR_SIZE,
+                       Bzero_64KSector_u32length);
+    for (i=0;i<MULT;i++) {
+        block_set_erased(lba + i);
+        block_forget(lba + i);
+    }
+    disk_stats.erases++;
+    disk_stats.pre_erases++;
+    ret = 1;
+#endif
+    erase_preemptible = 0;
+
+    DcsmCommonRegs.FLSEM.all = 0xA500;
+    EDIS;
+
+    return ret;
+}
+
+//
+// disk_write_start - Called when a WRITE(10) of count logical blocks at lba
+// starts. Flash sectors the command overwrites completely bypass
+// sector_buffer.
+//
+void disk_write_start(uint32_t lba, uint32_t count)
+{
+#if !FLASHDISK_USE_FTL
+    //只有整个被覆盖的block才算进去
+    stream_first = (lba + SUB_BLOCKS - 1) / SUB_BLOCKS;
+    stream_end = (lba + count) / SUB_BLOCKS;
+    stream_first = (stream_first + MULT - 1) / MULT * MULT;
+    stream_end = stream_end / MULT * MULT;
+    if (stream_end > RAM_DISK_SIZE / BLOCK_SIZE)
+        stream_end = RAM_DISK_SIZE / BLOCK_SIZE;
+    if (stream_first >= stream_end)
+        stream_first = stream_end = 0;
+    stream_sector = SECTOR_NONE;
+#elif SUB_BLOCKS > 1
+    write_end = lba + count;
+#endif
+#if FLASHDISK_CACHE_BLOCKS
+    uint16_t n;
+
+    //
+    // Short writes go to the cache, longer ones update cached copies as they
+    // pass. A block an aborted write left half done is dropped.
+    //
+    bcache_cacheable = BCACHE_WRITE_BACK &&
+                       count * LBLOCK_SIZE <= FLASHDISK_CACHE_MAX_RUN * BLOCK_SIZE;
+    bcache_fill = BCACHE_NONE;
+    for (n=0;n<FLASHDISK_CACHE_BLOCKS;n++) {
+        if (bcache_flags[n] & BCACHE_FILLING)
+            bcache_flags[n] = 0;
+    }
+#endif
+}
+
+//
+// disk_trim - Called with count logical blocks at lba the host has unmapped.
+// Only blocks unmapped as a whole are trimmed. Only RAM state is touched, so
+// this is safe from the USB interrupt; disk_background() does the flash work
+// later. The block holding the unlock key stays mapped so the disk still
+// unlocks after the key file is deleted.
+//
+void disk_trim(uint32_t lba, uint32_t count)
+{
+    uint32_t key = UNLOCK_RECORD_NONE;
+    uint32_t end = (lba + count) / SUB_BLOCKS;
+
+    if (!usb_unlocked)
+        return;
+    lba = (lba + SUB_BLOCKS - 1) / SUB_BLOCKS;
+    count = lba < end ? end - lba : 0;
+    if (unlock_record->magic == UNLOCK_RECORD_MAGIC &&
+        unlock_record->check == unlock_record_check(unlock_record))
+        key = unlock_record->lba;
+    for (;count && lba < DISK_BLOCKS;count--,lba++) {
+        if (lba == key)
+            continue;
+        block_set_trimmed(lba);
+        block_forget(lba);
+        disk_stats.blocks_trimmed++;
+    }
+}
+
 void disk_ioctl (unsigned int drive, unsigned int  command,  unsigned int *buffer)
 {
     switch(command)
@@ -368,15 +1716,21 @@ void disk_ioctl (unsigned int drive, unsigned int  command,  unsigned int *buffe
 
         case GET_SECTOR_COUNT:
         {
-            *buffer = (RAM_DISK_SIZE / BLOCK_SIZE);
+            *buffer = DISK_BLOCKS * SUB_BLOCKS;
             break;
         }
         case GET_SECTOR_SIZE:
         {
-           *buffer = BLOCK_SIZE;
+           *buffer = LBLOCK_SIZE;
 
             break;
         }
+        case GET_BLOCK_SIZE:
+        {
+            //一次erase的逻辑block数
+            *buffer = MULT * SUB_BLOCKS;
+            break;
+        }
         default:
         {
             buffer = 0;
@@ -38,13 +38,144 @@
 *
 */
 
+#ifndef FLASHDISK_H
+#define FLASHDISK_H
+
 #include <stdint.h>
+
+//320KB，test/里可以改小，不能超过0x50000
+#ifndef RAM_DISK_SIZE
+#define RAM_DISK_SIZE 0x50000
+#endif
+#define SECTOR_SIZE 0x8000
+//#define BLOCK_SIZE 0x2000
+#define BLOCK_SIZE 0x1000
+#define TRANSFER_SIZE 64U
+
+#define Bzero_64KSector_u32length   0x4000
+#define Bzero_16KSector_u32length   0x1000
+
+/* Pointer to the flash word at address a, test/ maps flash into host RAM */
+#ifndef FLASH_ADDR
+#define FLASH_ADDR(a) ((uint16_t *)(a))
+#endif
+
+/*
+ * Logical block size reported to the host, 512 or BLOCK_SIZE. Smaller
+ * logical blocks are merged into their BLOCK_SIZE block, so a disk formatted
+ * with one size has to be reformatted after switching to the other.
+ */
+#ifndef FLASHDISK_LOGICAL_BLOCK_SIZE
+#define FLASHDISK_LOGICAL_BLOCK_SIZE BLOCK_SIZE
+#endif
+
+/*
+ * Set to 1 to run the disk through the log-structured FTL (ftl.c). The FTL
+ * keeps one sector of pages plus FTL_OP_PAGES back for garbage collection,
+ * so the disk shrinks from 80 to 56 blocks and has to be reformatted when
+ * switching modes.
+ */
+#ifndef FLASHDISK_USE_FTL
+#define FLASHDISK_USE_FTL 0
+#endif
+
+/* Set to 0 to verify every 128-bit chunk right after it is programmed */
+#ifndef FLASHDISK_SECTOR_VERIFY
+#define FLASHDISK_SECTOR_VERIFY 1
+#endif
+
+/* Set to 0 to never suspend a main loop erase for the USB interrupt */
+#ifndef FLASHDISK_ERASE_SUSPEND
+#define FLASHDISK_ERASE_SUSPEND 1
+#endif
+
+/* Blocks unpacked ahead of a sequential read stream, 0 disables read-ahead */
+#ifndef FLASHDISK_READAHEAD_BLOCKS
+#define FLASHDISK_READAHEAD_BLOCKS 2
+#endif
+
+/*
+ * Blocks kept in the RAM block cache, 0 disables it. Ten blocks fill what is
+ * left of RAMGS0to6 after the MSC staging buffer, the write ring and the
+ * read-ahead buffer.
+ */
+#ifndef FLASHDISK_CACHE_BLOCKS
+#define FLASHDISK_CACHE_BLOCKS 10
+#endif
+
+/*
+ * Words of RAMGS0to6 (0x7000) left to FLASH_READAHEAD and FLASH_BLOCK_CACHE
+ * by MSC_BLOCK_BUFFER, the MSC staging buffer and write ring of 0x800 words
+ * each. The linker command file places .esysmem there too, but nothing
+ * allocates from the heap so the section is never emitted.
+ */
+#define FLASHDISK_GS_WORDS 0x6000
+
+#if (FLASHDISK_READAHEAD_BLOCKS + FLASHDISK_CACHE_BLOCKS) * (BLOCK_SIZE / 2) \
+    > FLASHDISK_GS_WORDS
+#error "FLASHDISK_READAHEAD_BLOCKS + FLASHDISK_CACHE_BLOCKS do not fit in RAMGS0to6"
+#endif
+
+/* Longest transfer in blocks that is kept in the block cache */
+#ifndef FLASHDISK_CACHE_MAX_RUN
+#define FLASHDISK_CACHE_MAX_RUN 4
+#endif
+
+/* When blocks written into the cache reach flash */
+#define FLASHDISK_CACHE_WRITE_THROUGH   0   /* at once, the cache only serves reads */
+#define FLASHDISK_CACHE_WRITE_BACK_IDLE 1   /* on eviction, sync and once the host is idle */
+#define FLASHDISK_CACHE_WRITE_BACK_SYNC 2   /* on eviction, sync and close only */
+#ifndef FLASHDISK_CACHE_POLICY
+#define FLASHDISK_CACHE_POLICY FLASHDISK_CACHE_WRITE_BACK_IDLE
+#endif
+
+/* Returned by disk_write() when the data could not be stored */
+#define DISK_WRITE_FAILED ((unsigned int)-1)
+
+extern uint16_t *ram_disk;
+
+typedef struct {
+    uint32_t erases;            /* disk sector erases */
+    uint32_t erases_avoided;    /* sector writes that found the flash blank */
+    uint32_t chunks_programmed; /* 128-bit chunks sent to the FSM */
+    uint32_t chunks_skipped;    /* 128-bit chunks already holding the data */
+    uint32_t stream_verifies;   /* streamed sectors checked against their packets */
+    uint16_t last_programmed;   /* chunks programmed by the last sector write */
+    uint16_t last_skipped;      /* chunks skipped by the last sector write */
+    uint32_t erase_suspends;    /* erases suspended to serve USB */
+    uint32_t readahead_hits;    /* blocks read from the read-ahead buffer */
+    uint32_t readahead_misses;  /* blocks unpacked from flash on demand */
+    uint32_t cache_hits;        /* blocks read from the block cache */
+    uint32_t cache_misses;      /* blocks read that were not in the block cache */
+    uint32_t cache_absorbed;    /* writes of a block still dirty in the cache */
+    uint32_t cache_writebacks;  /* dirty cached blocks written to flash */
+    uint32_t blocks_trimmed;    /* blocks the host unmapped */
+    uint32_t pre_erases;        /* fully unmapped sectors erased while idle */
+} disk_stats_t;
+
+extern disk_stats_t disk_stats;
+
 /* Function prototypes */
-unsigned int disk_read(uint32_t lba, uint16_t *buf,uint32_t off, uint32_t len);
+unsigned int disk_read(uint32_t lba, uint16_t *buf, uint32_t count);
 unsigned int disk_write(uint32_t lba, uint16_t *buf,uint32_t off, uint32_t len);
 void disk_initialize(void);
+void disk_flush(void);
+void disk_close(void);
+void disk_flush_async(void);
+int disk_sync(void);
+int disk_poll(void);
+int disk_background(void);
+int disk_prefetch(void);
+void disk_set_erase_preempt(int (*pending)(void), void (*serve)(void));
+void disk_write_start(uint32_t lba, uint32_t count);
+void disk_trim(uint32_t lba, uint32_t count);
 void disk_ioctl (unsigned int drive, unsigned int  command,  unsigned int* buffer);
 int verify_password(char *password);
+void flash_erase_sector(uint16_t *sector, uint32_t u32length);
+void flash_program(uint16_t *dst, uint16_t *src, uint32_t words);
 
 #define GET_SECTOR_SIZE 1
 #define GET_SECTOR_COUNT 2
+#define GET_BLOCK_SIZE 3
+
+#endif
@@ -0,0 +1,521 @@
+/**
+ * \file  ftl.c
+ *
+ * \brief Log-structured flash translation layer for the flash disk
+ *
+ * Logical blocks are appended into erased 4KB pages of the disk sectors
+ * instead of rewriting their home sector. The LBA -> page map lives in RAM
+ * and every update is journaled into FLASHL/FLASHM, which are used as a
+ * ping-pong pair: when the active one fills up, the whole map is written as
+ * a checkpoint into the other one. Stale pages are reclaimed by copying the
+ * remaining valid pages of a sector elsewhere and erasing it, either when a
+ * write runs short of erased pages or from the main loop while idle.
+ */
+#define CPU1 1
+#include "F28x_Project.h"
+#include "device.h"
+#include <string.h>
+#include <flash_disk/flashdisk.h>
+#include <flash_disk/ftl.h>
+
+#if FLASHDISK_USE_FTL
+
+#define FTL_NONE                0xFFFF
+
+#define PAGE_FREE               0
+#define PAGE_VALID              1
+#define PAGE_STALE              2
+
+#define FTL_JOURNAL_WORDS       0x2000
+#define FTL_RECORD_WORDS        8
+#define FTL_JOURNAL_RECORDS     (FTL_JOURNAL_WORDS / FTL_RECORD_WORDS)
+
+#define FTL_TAG_HEADER          0x4A48
+#define FTL_TAG_MAP             0x4A4D
+#define FTL_TAG_TRIM            0x4A54
+#define FTL_TAG_BLANK           0xFFFF
+
+//
+// One journal record, programmed as a single 128-bit chunk
+//
+typedef struct {
+    uint16_t tag;
+    uint16_t lba;
+    uint16_t ppn;
+    uint16_t check;
+    uint32_t seq;
+    uint16_t reserved[2];
+} ftl_record_t;
+
+static uint16_t *const ftl_journal[2] = {
+    FLASH_ADDR(0x0BA000),   // FLASHL
+    FLASH_ADDR(0x0BC000)    // FLASHM
+};
+
+static uint16_t l2p[FTL_BLOCKS];
+static uint16_t p2l[FTL_PAGES];
+static uint16_t page_state[FTL_PAGES];
+static uint16_t sector_valid[FTL_SECTORS];
+static uint16_t sector_free[FTL_SECTORS];
+static uint16_t free_pages;
+static uint16_t alloc_cursor;
+
+//
+// Sectors [0, sectors_scanned) have the state of their unmapped pages read
+// from flash. The rest are only scanned once a write needs erased pages or
+// the host is idle, so mounting does not read every page.
+//
+static uint16_t sectors_scanned;
+
+static uint16_t journal_cur;
+static uint16_t journal_slot;
+static uint32_t journal_gen;
+
+static uint16_t open_lba = FTL_NONE;
+static uint16_t open_ppn = FTL_NONE;
+static uint16_t open_end;       /* bytes of the open page programmed */
+
+ftl_stats_t ftl_stats;
+
+static inline uint16_t *page_addr(uint16_t ppn)
+{
+    return ram_disk + (uint32_t)ppn * FTL_PAGE_WORDS;
+}
+
+static inline uint16_t record_check(uint16_t tag, uint16_t lba, uint16_t ppn,
+                                    uint32_t seq)
+{
+    return tag ^ lba ^ ppn ^ (uint16_t)seq ^ (uint16_t)(seq >> 16) ^ 0x5AA5;
+}
+
+static int page_blank(uint16_t ppn)
+{
+    uint16_t *p = page_addr(ppn);
+    uint32_t i;
+
+    for (i = 0; i < FTL_PAGE_WORDS; i++) {
+        if (p[i] != 0xFFFF)
+            return 0;
+    }
+    return 1;
+}
+
+static void set_state(uint16_t ppn, uint16_t state)
+{
+    uint16_t sector = ppn / FTL_PAGES_PER_SECTOR;
+
+    if (page_state[ppn] == PAGE_VALID)
+        sector_valid[sector]--;
+    else if (page_state[ppn] == PAGE_FREE) {
+        sector_free[sector]--;
+        free_pages--;
+    }
+
+    page_state[ppn] = state;
+
+    if (state == PAGE_VALID)
+        sector_valid[sector]++;
+    else if (state == PAGE_FREE) {
+        sector_free[sector]++;
+        free_pages++;
+    }
+}
+
+static void write_record(uint16_t j, uint16_t slot, uint16_t tag,
+                         uint16_t lba, uint16_t ppn, uint32_t seq)
+{
+    ftl_record_t rec;
+
+    rec.tag = tag;
+    rec.lba = lba;
+    rec.ppn = ppn;
+    rec.check = record_check(tag, lba, ppn, seq);
+    rec.seq = seq;
+    rec.reserved[0] = 0xFFFF;
+    rec.reserved[1] = 0xFFFF;
+    flash_program(ftl_journal[j] + (uint32_t)slot * FTL_RECORD_WORDS,
+                  (uint16_t *)&rec, FTL_RECORD_WORDS);
+    ftl_stats.journal_records++;
+}
+
+//
+// checkpoint - Write the whole map into the other journal sector. The header
+// goes in last so a torn checkpoint is never picked up at mount.
+//
+static void checkpoint(void)
+{
+    uint16_t j = journal_cur ^ 1;
+    uint16_t slot = 1;
+    uint16_t lba;
+
+    flash_erase_sector(ftl_journal[j], Bzero_16KSector_u32length);
+    for (lba = 0; lba < FTL_BLOCKS; lba++) {
+        if (l2p[lba] != FTL_NONE)
+            write_record(j, slot++, FTL_TAG_MAP, lba, l2p[lba], 0);
+    }
+    write_record(j, 0, FTL_TAG_HEADER, 0, 0, journal_gen + 1);
+
+    journal_cur = j;
+    journal_slot = slot;
+    journal_gen++;
+    ftl_stats.checkpoints++;
+}
+
+//
+// journal_map - Persist lba -> ppn, or lba unmapped for FTL_TAG_TRIM. The RAM
+// map must already be updated, since a full journal is replaced by a
+// checkpoint of the RAM map.
+//
+static void journal_map(uint16_t tag, uint16_t lba, uint16_t ppn)
+{
+    if (journal_slot >= FTL_JOURNAL_RECORDS) {
+        checkpoint();
+        return;
+    }
+    write_record(journal_cur, journal_slot++, tag, lba, ppn, 0);
+}
+
+static void map_page(uint16_t lba, uint16_t ppn)
+{
+    uint16_t old = l2p[lba];
+
+    if (old != FTL_NONE) {
+        p2l[old] = FTL_NONE;
+        set_state(old, PAGE_STALE);
+    }
+    l2p[lba] = ppn;
+    p2l[ppn] = lba;
+    set_state(ppn, PAGE_VALID);
+    journal_map(FTL_TAG_MAP, lba, ppn);
+}
+
+//
+// scan_step - Tell the erased pages of the next unscanned sector from stale
+// ones. Returns 0 once every sector has been scanned.
+//
+static int scan_step(void)
+{
+    uint16_t ppn;
+
+    if (sectors_scanned == FTL_SECTORS)
+        return 0;
+    for (ppn = sectors_scanned * FTL_PAGES_PER_SECTOR;
+         ppn < (sectors_scanned + 1) * FTL_PAGES_PER_SECTOR; ppn++) {
+        if (page_state[ppn] == PAGE_STALE && page_blank(ppn))
+            set_state(ppn, PAGE_FREE);
+    }
+    sectors_scanned++;
+    return 1;
+}
+
+//
+// alloc_page - Next erased page after the allocation cursor, outside of
+// sector exclude
+//
+static uint16_t alloc_page(uint16_t exclude)
+{
+    uint16_t n, ppn;
+
+    for (n = 0; n < FTL_PAGES; n++) {
+        ppn = (alloc_cursor + n) % FTL_PAGES;
+        if (page_state[ppn] == PAGE_FREE &&
+            ppn / FTL_PAGES_PER_SECTOR != exclude) {
+            alloc_cursor = (ppn + 1) % FTL_PAGES;
+            return ppn;
+        }
+    }
+    return FTL_NONE;
+}
+
+//
+// gc_step - Do one unit of garbage collection work: either erase a sector
+// that holds no valid pages, or move one valid page out of the sector with
+// the most stale pages. Returns 0 if there was nothing to reclaim. Stale
+// counts are only known once every sector has been scanned.
+//
+static int gc_step(void)
+{
+    uint16_t s, victim = FTL_NONE, best = 0, stale;
+    uint16_t open_sector = FTL_NONE;
+    uint16_t ppn, dst;
+
+    if (sectors_scanned < FTL_SECTORS)
+        return 0;
+    if (open_ppn != FTL_NONE)
+        open_sector = open_ppn / FTL_PAGES_PER_SECTOR;
+
+    for (s = 0; s < FTL_SECTORS; s++) {
+        if (s == open_sector)
+            continue;
+        stale = FTL_PAGES_PER_SECTOR - sector_valid[s] - sector_free[s];
+        if (stale > best) {
+            best = stale;
+            victim = s;
+        }
+    }
+    if (victim == FTL_NONE)
+        return 0;
+
+    if (sector_valid[victim] == 0) {
+        flash_erase_sector(ram_disk + (uint32_t)victim * SECTOR_SIZE,
+                           Bzero_64KSector_u32length);
+        for (ppn = victim * FTL_PAGES_PER_SECTOR;
+             ppn < (victim + 1) * FTL_PAGES_PER_SECTOR; ppn++) {
+            set_state(ppn, PAGE_FREE);
+        }
+        ftl_stats.erases++;
+        return 1;
+    }
+
+    for (ppn = victim * FTL_PAGES_PER_SECTOR; page_state[ppn] != PAGE_VALID;
+         ppn++) {
+    }
+    dst = alloc_page(victim);
+    if (dst == FTL_NONE)
+        return 0;
+
+    flash_program(page_addr(dst), page_addr(ppn), FTL_PAGE_WORDS);
+    map_page(p2l[ppn], dst);
+    ftl_stats.relocated_pages++;
+    return 1;
+}
+
+//
+// ensure_free - Make sure a host page can be taken while still leaving one
+// sector's worth of erased pages for GC to relocate into. Unscanned sectors
+// are looked at before anything is reclaimed.
+//
+static void ensure_free(void)
+{
+    while (free_pages <= FTL_PAGES_PER_SECTOR) {
+        if (!scan_step() && !gc_step())
+            break;
+    }
+}
+
+void ftl_mount(void)
+{
+    ftl_record_t *rec;
+    uint16_t j, slot, lba, ppn;
+    int found = -1;
+
+    for (lba = 0; lba < FTL_BLOCKS; lba++)
+        l2p[lba] = FTL_NONE;
+    for (ppn = 0; ppn < FTL_PAGES; ppn++)
+        p2l[ppn] = FTL_NONE;
+    open_lba = FTL_NONE;
+    open_ppn = FTL_NONE;
+    alloc_cursor = 0;
+
+    //
+    // Pick the journal with the newest valid header
+    //
+    for (j = 0; j < 2; j++) {
+        rec = (ftl_record_t *)ftl_journal[j];
+        if (rec->tag == FTL_TAG_HEADER &&
+            rec->check == record_check(rec->tag, rec->lba, rec->ppn,
+                                       rec->seq) &&
+            (found < 0 || rec->seq > journal_gen)) {
+            found = j;
+            journal_gen = rec->seq;
+        }
+    }
+
+    if (found < 0) {
+        //
+        // Fresh FTL. Whatever is in the data sectors is treated as stale
+        // and reclaimed by GC.
+        //
+        flash_erase_sector(ftl_journal[0], Bzero_16KSector_u32length);
+        journal_gen = 1;
+        write_record(0, 0, FTL_TAG_HEADER, 0, 0, journal_gen);
+        journal_cur = 0;
+        journal_slot = 1;
+    } else {
+        journal_cur = found;
+        for (slot = 1; slot < FTL_JOURNAL_RECORDS; slot++) {
+            rec = (ftl_record_t *)(ftl_journal[journal_cur] +
+                                   (uint32_t)slot * FTL_RECORD_WORDS);
+            if (rec->tag == FTL_TAG_BLANK)
+                break;
+            if (rec->check != record_check(rec->tag, rec->lba, rec->ppn,
+                                           rec->seq))
+                break;
+            if (rec->tag == FTL_TAG_MAP && rec->lba < FTL_BLOCKS &&
+                rec->ppn < FTL_PAGES)
+                l2p[rec->lba] = rec->ppn;
+            else if (rec->tag == FTL_TAG_TRIM && rec->lba < FTL_BLOCKS)
+                l2p[rec->lba] = FTL_NONE;
+        }
+        journal_slot = slot;
+    }
+
+    for (lba = 0; lba < FTL_BLOCKS; lba++) {
+        if (l2p[lba] != FTL_NONE)
+            p2l[l2p[lba]] = lba;
+    }
+
+    //
+    // Unmapped pages count as stale until scan_step() finds them erased
+    //
+    memset(sector_valid, 0, FTL_SECTORS);
+    memset(sector_free, 0, FTL_SECTORS);
+    free_pages = 0;
+    sectors_scanned = 0;
+    for (ppn = 0; ppn < FTL_PAGES; ppn++) {
+        page_state[ppn] = PAGE_STALE;
+        if (p2l[ppn] != FTL_NONE)
+            set_state(ppn, PAGE_VALID);
+    }
+}
+
+//
+// ftl_block_addr - Flash address of the page holding lba, 0 if unmapped
+//
+uint16_t *ftl_block_addr(uint32_t lba)
+{
+    if (lba >= FTL_BLOCKS || l2p[lba] == FTL_NONE)
+        return 0;
+    return page_addr(l2p[lba]);
+}
+
+//
+// ftl_write - Program len bytes at off of block lba. Returns 0 if the data
+// could not be stored: no erased page was left, or the write starts inside a
+// logical block that has no open page to carry on.
+//
+int ftl_write(uint32_t lba, uint16_t *buf, uint32_t off, uint32_t len)
+{
+    uint16_t old;
+
+    if (lba >= FTL_BLOCKS || off + len > BLOCK_SIZE)
+        return 0;
+
+    //
+    // Data that does not carry on where the open page stopped closes it
+    //
+    if (open_ppn != FTL_NONE && (open_lba != lba || open_end != off))
+        ftl_close();
+
+    //
+    // A new block always starts on a fresh page. When the write starts past
+    // the beginning of the block, the part in front of it is copied from the
+    // page being replaced.
+    //
+    if (open_ppn == FTL_NONE) {
+        if (off % FLASHDISK_LOGICAL_BLOCK_SIZE)
+            return 0;
+        ensure_free();
+        open_ppn = alloc_page(FTL_NONE);
+        if (open_ppn == FTL_NONE)
+            return 0;
+        open_lba = lba;
+        set_state(open_ppn, PAGE_STALE);
+        old = l2p[lba];
+        if (off && old != FTL_NONE)
+            flash_program(page_addr(open_ppn), page_addr(old), off / 2);
+    }
+
+    //
+    // Program the data as it arrives
+    //
+    flash_program(page_addr(open_ppn) + off / 2, buf, len / 2);
+    open_end = off + len;
+
+    if (open_end == BLOCK_SIZE) {
+        map_page(open_lba, open_ppn);
+        ftl_stats.host_pages++;
+        open_ppn = FTL_NONE;
+        open_lba = FTL_NONE;
+    }
+    return 1;
+}
+
+//
+// ftl_close - Commit the page left open by a write that ended inside its
+// block, with the rest of the block copied from the page it replaces. A page
+// that stopped inside a logical block, from an aborted transfer, is simply
+// stale.
+//
+void ftl_close(void)
+{
+    uint16_t old;
+
+    if (open_ppn == FTL_NONE)
+        return;
+    if (open_end % FLASHDISK_LOGICAL_BLOCK_SIZE == 0) {
+        old = l2p[open_lba];
+        if (old != FTL_NONE)
+            flash_program(page_addr(open_ppn) + open_end / 2,
+                          page_addr(old) + open_end / 2,
+                          (BLOCK_SIZE - open_end) / 2);
+        map_page(open_lba, open_ppn);
+        ftl_stats.host_pages++;
+    }
+    open_ppn = FTL_NONE;
+    open_lba = FTL_NONE;
+}
+
+//
+// ftl_trim - Unmap lba. Its page becomes stale, so GC never copies it again
+// and the sector can be pre-erased once nothing valid is left in it.
+//
+void ftl_trim(uint32_t lba)
+{
+    uint16_t old;
+
+    if (lba >= FTL_BLOCKS || l2p[lba] == FTL_NONE)
+        return;
+    old = l2p[lba];
+    p2l[old] = FTL_NONE;
+    set_state(old, PAGE_STALE);
+    l2p[lba] = FTL_NONE;
+    journal_map(FTL_TAG_TRIM, lba, FTL_NONE);
+    ftl_stats.trimmed_pages++;
+}
+
+//
+// pre_erase_step - Erase one sector that holds stale pages but no valid ones,
+// so the allocator finds it blank before the host needs it
+//
+static int pre_erase_step(void)
+{
+    uint16_t s, ppn;
+    uint16_t open_sector = FTL_NONE;
+
+    if (open_ppn != FTL_NONE)
+        open_sector = open_ppn / FTL_PAGES_PER_SECTOR;
+
+    for (s = 0; s < sectors_scanned; s++) {
+        if (s == open_sector || sector_valid[s] != 0 ||
+            sector_free[s] == FTL_PAGES_PER_SECTOR)
+            continue;
+        flash_erase_sector(ram_disk + (uint32_t)s * SECTOR_SIZE,
+                           Bzero_64KSector_u32length);
+        for (ppn = s * FTL_PAGES_PER_SECTOR;
+             ppn < (s + 1) * FTL_PAGES_PER_SECTOR; ppn++) {
+            set_state(ppn, PAGE_FREE);
+        }
+        ftl_stats.erases++;
+        ftl_stats.pre_erases++;
+        return 1;
+    }
+    return 0;
+}
+
+//
+// ftl_background - Called from the main loop while the host is idle. Scans
+// one sector, does at most one unit of GC work, or pre-erases one fully stale
+// sector, so the caller can poll USB in between. Returns non-zero if work was
+// done.
+//
+int ftl_background(void)
+{
+    if (scan_step())
+        return 1;
+    if (free_pages < FTL_GC_HIGH_WATER)
+        return gc_step();
+    return pre_erase_step();
+}
+
+#endif
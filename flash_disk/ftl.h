@@ -0,0 +1,50 @@
+/**
+ * \file  ftl.h
+ *
+ * \brief Log-structured flash translation layer for the flash disk
+ */
+
+#ifndef FTL_H
+#define FTL_H
+
+#include <stdint.h>
+#include <flash_disk/flashdisk.h>
+
+#define FTL_PAGE_WORDS          (BLOCK_SIZE / 2)
+#define FTL_PAGES_PER_SECTOR    (SECTOR_SIZE / FTL_PAGE_WORDS)
+#define FTL_SECTORS             (RAM_DISK_SIZE / 2 / SECTOR_SIZE)
+#define FTL_PAGES               (FTL_SECTORS * FTL_PAGES_PER_SECTOR)
+
+/* Pages kept back on top of one sector's worth of GC headroom */
+#ifndef FTL_OP_PAGES
+#define FTL_OP_PAGES            8
+#endif
+
+/* Logical blocks exported to the host */
+#define FTL_BLOCKS              (FTL_PAGES - FTL_PAGES_PER_SECTOR - FTL_OP_PAGES)
+
+/* Background GC keeps compacting until this many pages are erased */
+#ifndef FTL_GC_HIGH_WATER
+#define FTL_GC_HIGH_WATER       (FTL_PAGES_PER_SECTOR + FTL_OP_PAGES / 2)
+#endif
+
+typedef struct {
+    uint32_t host_pages;        /* blocks committed for the host */
+    uint32_t relocated_pages;   /* valid pages copied by GC */
+    uint32_t erases;            /* data sector erases */
+    uint32_t journal_records;   /* mapping records programmed */
+    uint32_t checkpoints;       /* journal sector switches */
+    uint32_t pre_erases;        /* stale sectors erased while idle */
+    uint32_t trimmed_pages;     /* mapped blocks the host unmapped */
+} ftl_stats_t;
+
+extern ftl_stats_t ftl_stats;
+
+void ftl_mount(void);
+uint16_t *ftl_block_addr(uint32_t lba);
+int ftl_write(uint32_t lba, uint16_t *buf, uint32_t off, uint32_t len);
+void ftl_close(void);
+void ftl_trim(uint32_t lba);
+int ftl_background(void);
+
+#endif
@@ -44,6 +44,7 @@
 #include "usb_ids.h"
 #include "device/usbdevice.h"
 #include "device/F2837xD_device.h"
+#include <flash_disk/flashdisk.h>
 
 volatile enum
 {
@@ -76,10 +77,215 @@ g_eMSCState;
 
 static unsigned int g_ulFlags;
 static unsigned int g_ulIdleTimeout;
+static unsigned int g_ulBackgroundDelay;
 
-#define USBMSC_ACTIVITY_TIMEOUT 30
+//
+// Idle timeout in milliseconds, counted down from the USB SOF tick.
+//
+#define USBMSC_ACTIVITY_TIMEOUT 300
+
+//
+// Minimum time in milliseconds between two background flash maintenance
+// steps while idle, which bounds the share of idle time spent erasing.
+//
+#ifndef USBMSC_BACKGROUND_INTERVAL
+#define USBMSC_BACKGROUND_INTERVAL 100
+#endif
 #define FLAG_UPDATE_STATUS      1
 
+//
+// READ(10)/WRITE(10) latency from the CBW to the last data packet, in power
+// of two buckets of microseconds: bucket 0 is below 64us and the last bucket
+// collects everything from 256ms up.  Timed with free-running CPU timer 1.
+//
+#define LATENCY_BUCKETS         14
+#define LATENCY_MIN_SHIFT       6
+#define CYCLES_PER_US           (DEVICE_SYSCLK_FREQ / 1000000)
+
+uint32_t g_pui32ReadLatency[LATENCY_BUCKETS];
+uint32_t g_pui32WriteLatency[LATENCY_BUCKETS];
+uint32_t g_ui32ReadLatencyMax;
+uint32_t g_ui32WriteLatencyMax;
+static uint32_t g_ui32CommandStart;
+
+//
+// Data packets and USB frames of all READ(10)/WRITE(10) commands, from the
+// CBW to the last data packet.  Packets divided by frames is the rate the
+// data phase achieves, at most 19 packets per frame on a full-speed bus.
+//
+uint32_t g_ui32ReadPackets;
+uint32_t g_ui32ReadFrames;
+uint32_t g_ui32WritePackets;
+uint32_t g_ui32WriteFrames;
+static uint32_t g_ui32CommandFrame;
+static uint32_t g_ui32CommandPackets;
+
+//
+// Time in microseconds from the start of CPU timer 1, right after the clocks
+// are set up, to the status of the first command sent to the host.  This
+// covers mounting the flash disk and enumeration.
+//
+uint32_t g_ui32TimeToReady;
+static uint32_t g_ui32BootStart;
+static uint32_t *g_pui32CommandLatency;
+
+#if USBDMSC_DMA
+__interrupt void INT_USBDMA_TX_ISR(void);
+__interrupt void INT_USBDMA_RX_ISR(void);
+#endif
+
+//******************************************************************************
+//
+// Adds the time since g_ui32CommandStart to the histogram of the command that
+// just completed, and its packets and frames to the totals.
+//
+//******************************************************************************
+static void
+RecordLatency(void)
+{
+    uint32_t ui32Elapsed, ui32Bucket, ui32Frames;
+
+    if(g_pui32CommandLatency == 0)
+    {
+        return;
+    }
+
+    //
+    // The frame number is 11 bits.
+    //
+    ui32Frames = (USBFrameNumberGet(USBA_BASE) - g_ui32CommandFrame) & 0x7FF;
+    if(g_pui32CommandLatency == g_pui32ReadLatency)
+    {
+        g_ui32ReadPackets += g_ui32CommandPackets;
+        g_ui32ReadFrames += ui32Frames;
+    }
+    else
+    {
+        g_ui32WritePackets += g_ui32CommandPackets;
+        g_ui32WriteFrames += ui32Frames;
+    }
+
+    //
+    // The timer counts down.
+    //
+    ui32Elapsed = (g_ui32CommandStart -
+                   CPUTimer_getTimerCount(CPUTIMER1_BASE)) / CYCLES_PER_US;
+
+    if(g_pui32CommandLatency == g_pui32ReadLatency)
+    {
+        if(ui32Elapsed > g_ui32ReadLatencyMax)
+        {
+            g_ui32ReadLatencyMax = ui32Elapsed;
+        }
+    }
+    else if(ui32Elapsed > g_ui32WriteLatencyMax)
+    {
+        g_ui32WriteLatencyMax = ui32Elapsed;
+    }
+
+    ui32Elapsed >>= LATENCY_MIN_SHIFT;
+    for(ui32Bucket = 0; ui32Elapsed && (ui32Bucket < LATENCY_BUCKETS - 1);
+        ui32Bucket++)
+    {
+        ui32Elapsed >>= 1;
+    }
+    g_pui32CommandLatency[ui32Bucket]++;
+    g_pui32CommandLatency = 0;
+}
+
+//******************************************************************************
+//
+// Masks and unmasks the interrupts that run the MSC class around each use of
+// the flash disk from the main loop.  With USBDMSC_DMA set the interrupts of
+// the DMA channels read the media for a READ(10) as well, so they are masked
+// along with the USB interrupt.
+//
+//******************************************************************************
+static void
+USBInterruptDisable(void)
+{
+    Interrupt_disable(INT_myUSB0);
+#if USBDMSC_DMA
+    Interrupt_disable(INT_DMA_CH5);
+    Interrupt_disable(INT_DMA_CH6);
+#endif
+}
+
+static void
+USBInterruptEnable(void)
+{
+    Interrupt_enable(INT_myUSB0);
+#if USBDMSC_DMA
+    Interrupt_enable(INT_DMA_CH5);
+    Interrupt_enable(INT_DMA_CH6);
+#endif
+}
+
+//******************************************************************************
+//
+// Called by the flash disk while it erases from the main loop with the USB
+// interrupts masked.  A pending one makes the disk suspend the erase and
+// let the interrupts run.  It is polled while the erase is running,
+// so it runs from RAM.
+//
+//******************************************************************************
+#pragma CODE_SECTION(USBInterruptPending, ".TI.ramfunc");
+static int
+USBInterruptPending(void)
+{
+#if USBDMSC_DMA
+    if((HWREGH(PIECTRL_BASE + PIE_O_IFR7) &
+        (PIE_IFR7_INTX5 | PIE_IFR7_INTX6)) != 0)
+    {
+        return(1);
+    }
+#endif
+    return((HWREGH(PIECTRL_BASE + PIE_O_IFR9) & PIE_IFR9_INTX15) != 0);
+}
+
+static void
+USBInterruptServe(void)
+{
+    USBInterruptEnable();
+
+    //
+    // The flags clear once the CPU has taken the interrupts.
+    //
+    while(USBInterruptPending())
+    {
+    }
+
+    USBInterruptDisable();
+}
+
+//******************************************************************************
+//
+// USB tick handler, called every USB_SOF_TICK_DIVIDE milliseconds from the
+// USB interrupt while the bus is active.
+//
+//******************************************************************************
+static void
+USBDMSCTickHandler(void *pvInstance, uint32_t ui32TicksmS)
+{
+    if(g_ulIdleTimeout > ui32TicksmS)
+    {
+        g_ulIdleTimeout -= ui32TicksmS;
+    }
+    else
+    {
+        g_ulIdleTimeout = 0;
+    }
+
+    if(g_ulBackgroundDelay > ui32TicksmS)
+    {
+        g_ulBackgroundDelay -= ui32TicksmS;
+    }
+    else
+    {
+        g_ulBackgroundDelay = 0;
+    }
+}
+
 unsigned int
 USBDMSCEventCallback(void *pvCBData, unsigned int ulEvent,
                      unsigned int ulMsgParam, void *pvMsgData)
@@ -99,6 +305,11 @@ USBDMSCEventCallback(void *pvCBData, unsigned int ulEvent,
             //
             // Only update if this is a change.
             //
+            g_ui32CommandStart = CPUTimer_getTimerCount(CPUTIMER1_BASE);
+            g_ui32CommandFrame = USBFrameNumberGet(USBA_BASE);
+            g_ui32CommandPackets = ulMsgParam / 64;
+            g_pui32CommandLatency = g_pui32WriteLatency;
+
             if(g_eMSCState != MSC_DEV_WRITE)
             {
                 //
@@ -123,6 +334,11 @@ USBDMSCEventCallback(void *pvCBData, unsigned int ulEvent,
             //
             // Only update if this is a change.
             //
+            g_ui32CommandStart = CPUTimer_getTimerCount(CPUTIMER1_BASE);
+            g_ui32CommandFrame = USBFrameNumberGet(USBA_BASE);
+            g_ui32CommandPackets = ulMsgParam / 64;
+            g_pui32CommandLatency = g_pui32ReadLatency;
+
             if(g_eMSCState != MSC_DEV_READ)
             {
                 //
@@ -139,6 +355,17 @@ USBDMSCEventCallback(void *pvCBData, unsigned int ulEvent,
             break;
         }
         case USBD_MSC_EVENT_IDLE:
+        {
+            RecordLatency();
+            break;
+        }
+        case USBD_MSC_EVENT_READY:
+        {
+            g_ui32TimeToReady = (g_ui32BootStart -
+                                 CPUTimer_getTimerCount(CPUTIMER1_BASE)) /
+                                CYCLES_PER_US;
+            break;
+        }
         default:
         {
             break;
@@ -196,11 +423,33 @@ main(void) {
     
     Board_init();
 
+    //
+    // CPU timer 1 free-runs at SYSCLK to time start up and SCSI commands.
+    //
+    CPUTimer_setPeriod(CPUTIMER1_BASE, 0xFFFFFFFFU);
+    CPUTimer_setPreScaler(CPUTIMER1_BASE, 0U);
+    CPUTimer_startTimer(CPUTIMER1_BASE);
+    g_ui32BootStart = CPUTimer_getTimerCount(CPUTIMER1_BASE);
+
     //
     // Initialize the USB stack mode and pass in a mode callback.
     //
     USBStackModeSet(0, eUSBModeForceDevice, ModeCallback);
     USBDMSCInit(0, &g_sMSCDevice);
+    InternalUSBRegisterTickHandler(USBDMSCTickHandler, 0);
+
+#if USBDMSC_DMA
+    //
+    // The MSC class moves the bulk data with DMA channels 5 and 6.
+    //
+    SysCtl_enablePeripheral(SYSCTL_PERIPH_CLK_DMA);
+    DMA_initController();
+    Interrupt_register(INT_DMA_CH5, &INT_USBDMA_TX_ISR);
+    Interrupt_register(INT_DMA_CH6, &INT_USBDMA_RX_ISR);
+    Interrupt_enable(INT_DMA_CH5);
+    Interrupt_enable(INT_DMA_CH6);
+#endif
+    disk_set_erase_preempt(USBInterruptPending, USBInterruptServe);
 
     //
     // Enable Global Interrupt (INTM) and realtime interrupt (DBGM)
@@ -218,6 +467,22 @@ main(void) {
 
     while(1)
     {
+        //
+        // Advance any flash write-back one FSM operation at a time, then
+        // pass the next OUT packet queued by the USB interrupt to the disk
+        // once it is done, and unpack the next block of a sequential read
+        // ahead of the host.  The USB interrupts are only masked for the
+        // duration of a single step, and long erases are suspended whenever
+        // one becomes pending.
+        //
+        USBInterruptDisable();
+        if(!disk_poll())
+        {
+            USBDMSCWriteProcess((void *)&g_sMSCDevice);
+            disk_prefetch();
+        }
+        USBInterruptEnable();
+
         switch(g_eMSCState)
         {
             case MSC_DEV_READ:
@@ -254,10 +519,15 @@ main(void) {
                 }
 
                 //
-                // If there is no activity then return to the idle state.
+                // If there is no activity then write back the cached flash
+                // sector and return to the idle state.
                 //
                 if(g_ulIdleTimeout == 0)
                 {
+                    USBInterruptDisable();
+                    disk_flush_async();
+                    USBInterruptEnable();
+
                     //UpdateStatus("Idle     ", 0);
                     g_eMSCState = MSC_DEV_IDLE;
                 }
@@ -266,6 +536,22 @@ main(void) {
             case MSC_DEV_IDLE:
             default:
             {
+                //
+                // Reclaim and pre-erase flash while the host is quiet.  The
+                // USB interrupts are masked so the disk is never re-entered
+                // from disk_write, and nothing is started once a new command
+                // has arrived.
+                //
+                if(g_ulBackgroundDelay == 0)
+                {
+                    USBInterruptDisable();
+                    if(USBDMSCIsIdle((void *)&g_sMSCDevice) &&
+                       disk_background())
+                    {
+                        g_ulBackgroundDelay = USBMSC_BACKGROUND_INTERVAL;
+                    }
+                    USBInterruptEnable();
+                }
                 break;
             }
         }
@@ -285,6 +571,28 @@ INT_myUSB0_ISR(void)
     Interrupt_clearACKGroup(INTERRUPT_ACK_GROUP9);
 }
 
+#if USBDMSC_DMA
+//******************************************************************************
+//
+// Interrupts of the DMA channels moving the MSC bulk IN and bulk OUT data,
+// USBDMSC_DMA_TX_BASE and USBDMSC_DMA_RX_BASE.
+//
+//******************************************************************************
+__interrupt void
+INT_USBDMA_TX_ISR(void)
+{
+    USBDMSCDMAHandler((void *)&g_sMSCDevice);
+    Interrupt_clearACKGroup(INTERRUPT_ACK_GROUP7);
+}
+
+__interrupt void
+INT_USBDMA_RX_ISR(void)
+{
+    USBDMSCDMAHandler((void *)&g_sMSCDevice);
+    Interrupt_clearACKGroup(INTERRUPT_ACK_GROUP7);
+}
+#endif
+
 //
 // End of file
 //
@@ -0,0 +1,274 @@
+//#############################################################################
+//
+// disk_test.c - Randomized read/write consistency test of the flash disk
+//
+// Interleaves packet by packet writes, reads with read-ahead in between,
+// trims, write-back steps, flushes and remounts in a random order and checks
+// every block read against a model of what the host wrote. While an erase
+// is running the simulated USB interrupt reads, trims and closes the drive
+// too, the way the MSC class may while a main loop erase is suspended. The
+// Makefile builds it once for every disk configuration.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#if FLASHDISK_USE_FTL
+#include <flash_disk/ftl.h>
+#endif
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#if FLASHDISK_USE_FTL
+#define DISK_BLOCKS     FTL_BLOCKS
+#else
+#define DISK_BLOCKS     (RAM_DISK_SIZE / BLOCK_SIZE)
+#endif
+#define SUB             (BLOCK_SIZE / LBLOCK_SIZE)
+#define NBLOCKS         (DISK_BLOCKS * SUB)
+#define SECTOR_BLOCKS   (SECTOR_SIZE * 2 / LBLOCK_SIZE)
+#define ITERATIONS      3000
+
+static uint8_t model[NBLOCKS][LBLOCK_SIZE];
+static uint8_t trimmed[NBLOCKS];
+static uint8_t data[LBLOCK_SIZE];
+static int in_write, in_serve;
+
+static struct {
+    uint32_t writes, reads, held, steps, prefetched;
+    uint32_t served, trims, flushes, remounts;
+} counts;
+
+//
+// check_block - Block lba reads back as the host last wrote it. The contents
+// of a trimmed block no longer matter.
+//
+static void check_block(uint32_t lba)
+{
+    static uint8_t block[LBLOCK_SIZE];
+
+    read_blocks(lba, 1, block);
+    counts.reads++;
+    if (trimmed[lba])
+        return;
+    if (memcmp(block, model[lba], LBLOCK_SIZE / 2)) {
+        printf("block %u differs\n", lba);
+        exit(1);
+    }
+}
+
+//
+// check_flash - Without the FTL, flash holds the model once it is flushed
+//
+static void check_flash(void)
+{
+#if !FLASHDISK_USE_FTL
+    static uint8_t block[LBLOCK_SIZE];
+    uint32_t lba;
+
+    for (lba = 0; lba < NBLOCKS; lba++) {
+        if (trimmed[lba])
+            continue;
+        unpack(block, ram_disk + lba * (LBLOCK_SIZE / 2), LBLOCK_SIZE);
+        if (memcmp(block, model[lba], LBLOCK_SIZE / 2)) {
+            printf("block %u differs in flash\n", lba);
+            exit(1);
+        }
+    }
+#endif
+}
+
+//
+// trim - Unmap count blocks at lba. Only BLOCK_SIZE blocks that are unmapped
+// as a whole are trimmed by the disk.
+//
+static void trim(uint32_t lba, uint32_t count)
+{
+    uint32_t first, end;
+
+    if (lba + count > NBLOCKS)
+        count = NBLOCKS - lba;
+    disk_trim(lba, count);
+    first = (lba + SUB - 1) / SUB * SUB;
+    end = (lba + count) / SUB * SUB;
+    for (; first < end; first++)
+        trimmed[first] = 1;
+    counts.trims++;
+}
+
+//
+// fill - New contents of block lba: random, bits only cleared, blank, a few
+// bytes changed or mostly blank, to take every program path
+//
+static void fill(uint32_t lba, uint8_t *p)
+{
+    uint32_t i, kind = rand() % 5;
+
+    for (i = 0; i < LBLOCK_SIZE; i++) {
+        switch (kind) {
+        case 0:
+            p[i] = rand();
+            break;
+        case 1:
+            p[i] = model[lba][i] & rand();
+            break;
+        case 2:
+            p[i] = 0xFF;
+            break;
+        case 3:
+            p[i] = i < 100 ? rand() : model[lba][i];
+            break;
+        default:
+            p[i] = i % 512 < 32 ? 0 : 0xFF;
+            break;
+        }
+    }
+    //
+    // Never look like an unlock packet
+    //
+    if (p[0] == 'U')
+        p[0] = 'V';
+}
+
+//
+// The USB interrupt, taken while a main loop erase is suspended. During a
+// WRITE(10) it only queues packets.
+//
+static int usb_pending(void)
+{
+    return !in_serve && rand() % 3 == 0;
+}
+
+static void usb_serve(void)
+{
+    in_serve = 1;
+    counts.served++;
+    if (!in_write) {
+        check_block(rand() % NBLOCKS);
+        if (rand() % 8 == 0)
+            disk_close();
+        if (rand() % 8 == 0)
+            trim(rand() % NBLOCKS, 1 + rand() % 20);
+    }
+    in_serve = 0;
+}
+
+//
+// write_run - A WRITE(10) of count blocks at lba, one packet at a time. A
+// packet the disk holds off is retried after a main loop step, with reads
+// of other blocks in between.
+//
+static void write_run(uint32_t lba, uint32_t count)
+{
+    uint16_t packet[TRANSFER_SIZE / 2];
+    uint32_t n, off, r;
+    unsigned int ret;
+
+    disk_write_start(lba, count);
+    for (n = lba; n < lba + count; n++) {
+        fill(n, data);
+        for (off = 0; off < LBLOCK_SIZE; off += TRANSFER_SIZE) {
+            pack(packet, data + off, TRANSFER_SIZE);
+            for (;;) {
+                in_write = 1;
+                ret = disk_write(n, packet, off, 1);
+                in_write = 0;
+                if (ret)
+                    break;
+                counts.held++;
+                r = rand() % NBLOCKS;
+                if (r < lba || r >= lba + count)
+                    check_block(r);
+                while (disk_poll())
+                    counts.steps++;
+                if (rand() & 1)
+                    disk_prefetch();
+            }
+            CHECK(ret != DISK_WRITE_FAILED);
+        }
+        memcpy(model[n], data, LBLOCK_SIZE / 2);
+        trimmed[n] = 0;
+        counts.writes++;
+    }
+}
+
+int main(void)
+{
+    uint32_t it, op, lba, count, n;
+
+    srand(20);
+    sim_reset();
+    memset(model, 0xFFFF, sizeof(model) / 2);
+    disk_initialize();
+    CHECK(usb_unlocked);
+    CHECK(disk_blocks() == NBLOCKS);
+    disk_set_erase_preempt(usb_pending, usb_serve);
+
+    for (it = 0; it < ITERATIONS; it++) {
+        op = rand() % 10;
+        if (op < 6) {
+            //
+            // Short writes anywhere, or runs starting on a sector that
+            // cover whole sectors
+            //
+            if (rand() % 4 == 0) {
+                lba = rand() % (NBLOCKS / SECTOR_BLOCKS) * SECTOR_BLOCKS;
+                if (rand() % 3 == 0)
+                    lba += rand() % (4 * SUB);
+                count = SECTOR_BLOCKS / 2 + rand() % SECTOR_BLOCKS;
+            } else {
+                lba = rand() % NBLOCKS;
+                count = 1 + rand() % (4 * SUB);
+            }
+            if (lba + count > NBLOCKS)
+                count = NBLOCKS - lba;
+            write_run(lba, count);
+        } else if (op < 8) {
+            //
+            // A sequential read with main loop read-ahead in between
+            //
+            lba = rand() % NBLOCKS;
+            for (n = 1 + rand() % 6; n && lba < NBLOCKS; n--, lba++) {
+                check_block(lba);
+                while (rand() % 3 && disk_prefetch())
+                    counts.prefetched++;
+            }
+        } else if (op == 8) {
+            trim(rand() % NBLOCKS, 1 + rand() % (SECTOR_BLOCKS * 2));
+            while (rand() % 4 && disk_background())
+                ;
+        } else if (rand() % 3) {
+            if (rand() & 1) {
+                disk_flush();
+            } else {
+                disk_flush_async();
+                while (rand() % 4 && disk_poll())
+                    counts.steps++;
+            }
+            counts.flushes++;
+        } else {
+            disk_flush();
+            check_flash();
+            disk_initialize();
+            counts.remounts++;
+        }
+    }
+
+    disk_flush();
+    check_flash();
+    for (lba = 0; lba < NBLOCKS; lba++)
+        check_block(lba);
+    disk_initialize();
+    for (lba = 0; lba < NBLOCKS; lba++)
+        check_block(lba);
+
+    printf("disk: %u blocks written, %u read, %u packets held, %u steps, "
+           "%u prefetched\n", counts.writes, counts.reads, counts.held,
+           counts.steps, counts.prefetched);
+    printf("disk: %u served during erases, %u trims, %u flushes, "
+           "%u remounts, %u erases\n", counts.served, counts.trims,
+           counts.flushes, counts.remounts, sim_stats.erases);
+    printf("disk_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,312 @@
+//#############################################################################
+//
+// dma_test.c - Host unit tests of the DMA data phases of the MSC class
+//
+// usblib/device/usbdmsc.c is built with USBDMSC_DMA set against msc_mock.h.
+// The DMA channels are mocked: the driverlib calls that set a channel up
+// record it, and the test completes a channel by moving the words it was
+// given between RAM and the host and calling USBDMSCDMAHandler(), the way
+// its interrupt would. READ(10) and WRITE(10) of more than the staging
+// buffer and the write ring hold go through it against a media in RAM.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_usb.h"
+#include "driverlib/dma.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usbmsc.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdmsc.h"
+
+#define CHECK(c) \
+    do { if (!(c)) fail(__FILE__, __LINE__, #c); } while (0)
+
+#define EP              USB_EP_1
+#define CBW_SIZE        31
+#define CSW_SIZE        13
+#define BLOCKS          64
+#define BLOCK_SIZE      512
+#define BUFFER_SIZE     0x1000
+#define RING_SIZE       0x400
+
+extern const tCustomHandlers g_sMSCHandlers;
+
+static uint16_t media[BLOCKS][BLOCK_SIZE / 2];
+static uint32_t media_reads;
+static uint16_t block_buffer[BUFFER_SIZE / 2];
+static uint16_t write_ring[RING_SIZE / 2];
+static uint16_t host[BLOCKS * BLOCK_SIZE / 2];  /* words the host moved */
+static uint32_t host_words;
+
+static void fail(const char *file, int line, const char *what)
+{
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+//
+// Intrinsics of the TI compiler and the parts of the device controller
+// driver the class calls
+//
+uint16_t __disable_interrupts(void) { return 0; }
+uint16_t __enable_interrupts(void) { return 0; }
+void __eallow(void) { }
+void __edis(void) { }
+void USBDCDInit(uint32_t ui32Index, tDeviceInfo *psDevice, void *pvData) { }
+void USBDCDDeviceInfoInit(uint32_t ui32Index, tDeviceInfo *psDevice) { }
+void USBDCDTerm(uint32_t ui32Index) { }
+void USBDCDStallEP0(uint32_t ui32Index) { }
+void USBDCDSendDataEP0(uint32_t ui32Index, uint8_t *pui8Data,
+                       uint32_t ui32Size) { }
+
+//
+// The DMA channels, as the driverlib calls of DMAStart() set them up. The
+// inline calls of driverlib/dma.h only reach the mocked registers.
+//
+typedef struct {
+    int armed;
+    const uint16_t *src;
+    uint16_t *dest;
+    uint32_t burst, bursts;
+} dma_t;
+
+static dma_t tx_dma, rx_dma;
+
+static dma_t *channel(uint32_t base)
+{
+    CHECK(base == USBDMSC_DMA_TX_BASE || base == USBDMSC_DMA_RX_BASE);
+    return base == USBDMSC_DMA_TX_BASE ? &tx_dma : &rx_dma;
+}
+
+void DMA_configAddresses(uint32_t base, const void *destAddr,
+                         const void *srcAddr)
+{
+    channel(base)->src = srcAddr;
+    channel(base)->dest = (uint16_t *)destAddr;
+}
+
+//
+// Packets move between the FIFO, which does not step, and RAM
+//
+void DMA_configBurst(uint32_t base, uint16_t size, int16_t srcStep,
+                     int16_t destStep)
+{
+    CHECK(base == USBDMSC_DMA_TX_BASE ? srcStep == 1 && destStep == 0 :
+                                        srcStep == 0 && destStep == 1);
+    channel(base)->burst = size;
+}
+
+void DMA_configTransfer(uint32_t base, uint32_t transferSize, int16_t srcStep,
+                        int16_t destStep)
+{
+    channel(base)->bursts = transferSize;
+}
+
+void DMA_configMode(uint32_t base, DMA_Trigger trigger, uint32_t config)
+{
+    CHECK(trigger == (base == USBDMSC_DMA_TX_BASE ? DMA_TRIGGER_USBA_TX1 :
+                                                    DMA_TRIGGER_USBA_RX1));
+    CHECK(!channel(base)->armed);
+    channel(base)->armed = 1;
+}
+
+//
+// The media, BLOCKS blocks in RAM
+//
+static void *media_open(uint32_t drive) { return (void *)1; }
+static void media_close(void *drive) { }
+static uint32_t media_read(void *drive, uint16_t *buf, uint32_t lba,
+                           uint32_t count)
+{
+    CHECK(lba + count <= BLOCKS);
+    memcpy(buf, media[lba], count * sizeof(media[0]));
+    media_reads++;
+    return count * BLOCK_SIZE;
+}
+static uint32_t media_write(void *drive, uint16_t *buf, uint32_t lba,
+                            uint32_t off, uint32_t count)
+{
+    CHECK(lba < BLOCKS && off + count * 64 <= BLOCK_SIZE);
+    memcpy(media[lba] + off / 2, buf, count * 64);
+    return count * 64;
+}
+static uint32_t media_blocks(void *drive) { return BLOCKS; }
+static uint32_t media_block_size(void *drive) { return BLOCK_SIZE; }
+
+static const uint16_t lang_string[] = { 4, USB_DTYPE_STRING, 0x09, 0x04 };
+static const unsigned char * const strings[] = {
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string
+};
+
+static tUSBDMSCDevice device = {
+    0x1cbe, 0x0003, "TI      ", "Mass Storage    ", "1.00", 500,
+    USB_CONF_ATTR_SELF_PWR, strings, 4,
+    {
+        media_open, media_close, media_read, media_write, media_blocks,
+        media_block_size, 0, 0, 0, 0
+    },
+    0, block_buffer, BUFFER_SIZE, write_ring, RING_SIZE
+};
+
+//
+// send_cbw - Hand the bulk OUT handler a READ(10) or WRITE(10) CBW
+//
+static void send_cbw(uint8_t op, uint32_t lba, uint32_t count)
+{
+    static uint16_t cbw[CBW_SIZE];
+    uint32_t i, length = count * BLOCK_SIZE;
+
+    memset(cbw, 0, sizeof(cbw));
+    cbw[0] = 'U';
+    cbw[1] = 'S';
+    cbw[2] = 'B';
+    cbw[3] = 'C';
+    cbw[4] = 0x5A;
+    for (i = 0; i < 4; i++)
+        cbw[8 + i] = (length >> (8 * i)) & 0xFF;
+    cbw[12] = op == SCSI_READ_10 ? CBWFLAGS_DIR_IN : CBWFLAGS_DIR_OUT;
+    cbw[14] = 10;
+    cbw[15] = op;
+    for (i = 0; i < 4; i++)
+        cbw[17 + i] = (lba >> (24 - 8 * i)) & 0xFF;
+    cbw[22] = count >> 8;
+    cbw[23] = count & 0xFF;
+
+    usb_mock_reset();
+    HWREGH(USBA_BASE + USB_O_RXCSRL1) = USB_RXCSRL1_RXRDY;
+    HWREGH(USBA_BASE + USB_O_COUNT0 + EP) = CBW_SIZE;
+    usb_mock_rx = cbw;
+    usb_mock_rx_end = cbw + CBW_SIZE;
+    g_sMSCHandlers.pfnEndpointHandler(&device, 0x10000 << USBEPToIndex(EP));
+    usb_mock_sync();
+    CHECK(usb_mock_rx == usb_mock_rx_end);
+}
+
+//
+// check_csw - The CSW went out, passed and with no residue. The bulk IN
+// interrupt once the host has taken it ends the command.
+//
+static void check_csw(void)
+{
+    usb_mock_sync();
+    CHECK(usb_mock_tx_bytes == CSW_SIZE);
+    CHECK(usb_mock_tx[0] == 'U' && usb_mock_tx[3] == 'S');
+    CHECK(usb_mock_tx[8] == 0 && usb_mock_tx[9] == 0);
+    CHECK(usb_mock_tx[12] == 0);
+    g_sMSCHandlers.pfnEndpointHandler(&device, 1 << USBEPToIndex(EP));
+    CHECK(USBDMSCIsIdle(&device));
+}
+
+//
+// read10 - A READ(10) of count blocks at lba, into host
+//
+static void read10(uint32_t lba, uint32_t count)
+{
+    uint32_t words;
+
+    host_words = 0;
+    send_cbw(SCSI_READ_10, lba, count);
+    while (tx_dma.armed) {
+        CHECK(usb_mock_tx_bytes == 0);
+        words = tx_dma.burst * tx_dma.bursts;
+        CHECK(host_words + words <= count * BLOCK_SIZE / 2);
+        memcpy(host + host_words, tx_dma.src, words * sizeof(uint16_t));
+        host_words += words;
+        tx_dma.armed = 0;
+        USBDMSCDMAHandler(&device);
+    }
+    CHECK(host_words == count * BLOCK_SIZE / 2);
+    check_csw();
+}
+
+//
+// write10 - A WRITE(10) of the count blocks in host to lba. The main loop
+// only takes one packet out of the ring per chunk the DMA moves, so the ring
+// fills and the channel stops for lack of room.
+//
+static uint32_t write10(uint32_t lba, uint32_t count)
+{
+    uint32_t words, moved = 0, stopped = 0, i;
+
+    send_cbw(SCSI_WRITE_10, lba, count);
+    for (i = 0; usb_mock_tx_bytes == 0; i++) {
+        CHECK(i < 10000);
+        if (rx_dma.armed) {
+            words = rx_dma.burst * rx_dma.bursts;
+            CHECK(moved + words <= count * BLOCK_SIZE / 2);
+            CHECK(rx_dma.dest >= write_ring &&
+                  rx_dma.dest + words <= write_ring + RING_SIZE / 2);
+            memcpy(rx_dma.dest, host + moved, words * sizeof(uint16_t));
+            moved += words;
+            rx_dma.armed = 0;
+            USBDMSCDMAHandler(&device);
+        } else if (moved < count * BLOCK_SIZE / 2) {
+            stopped++;
+        }
+        USBDMSCWriteProcess(&device);
+        usb_mock_sync();
+    }
+    CHECK(moved == count * BLOCK_SIZE / 2);
+    CHECK(!rx_dma.armed);
+    check_csw();
+    return stopped;
+}
+
+//
+// A READ(10) of more blocks than the staging buffer holds is refilled from
+// the TX channel interrupt
+//
+static void test_read(void)
+{
+    uint32_t lba, i;
+
+    for (lba = 0; lba < BLOCKS; lba++)
+        for (i = 0; i < BLOCK_SIZE / 2; i++)
+            media[lba][i] = lba << 8 | (i & 0xFF);
+
+    media_reads = 0;
+    read10(3, 20);
+    CHECK(media_reads == 3);
+    CHECK(memcmp(host, media[3], 20 * sizeof(media[0])) == 0);
+
+    media_reads = 0;
+    read10(BLOCKS - 1, 1);
+    CHECK(media_reads == 1);
+    CHECK(memcmp(host, media[BLOCKS - 1], sizeof(media[0])) == 0);
+}
+
+//
+// A WRITE(10) of more than the write ring holds restarts the RX channel once
+// the media has taken enough of the ring, and reads back as written
+//
+static void test_write(void)
+{
+    uint32_t i;
+
+    srand(13);
+    for (i = 0; i < 12 * BLOCK_SIZE / 2; i++)
+        host[i] = rand();
+    CHECK(write10(40, 12) > 0);
+    CHECK(memcmp(media[40], host, 12 * sizeof(media[0])) == 0);
+
+    read10(40, 12);
+    CHECK(memcmp(media[40], host, 12 * sizeof(media[0])) == 0);
+}
+
+int main(void)
+{
+    usb_mock_reset();
+    USBDMSCInit(0, &device);
+    test_read();
+    test_write();
+    printf("dma_test: ok\n");
+    return 0;
+}
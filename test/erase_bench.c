@@ -0,0 +1,122 @@
+//#############################################################################
+//
+// erase_bench.c - Latency of READs that arrive while the main loop writes
+// the cache back, with main loop erases run to the end
+// (FLASHDISK_ERASE_SUSPEND 0) or suspended for the USB interrupt
+// (FLASHDISK_ERASE_SUSPEND 1)
+//
+// One block in each of several sectors is rewritten so that every one of
+// them needs an erase, then the write-back runs one disk_sync() step at a
+// time like the main loop does for SYNCHRONIZE CACHE. The host sends a
+// READ every READ_INTERVAL_US of simulated FSM time. A READ is served when
+// the USB interrupt gets to run: between two steps, or with the erase
+// suspended when erase_pending() reports it. Its latency is the time from
+// its arrival to then.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define NBLOCKS             (RAM_DISK_SIZE / LBLOCK_SIZE)
+#define SECTOR_BLOCKS       (SECTOR_SIZE * 2 / LBLOCK_SIZE)
+#define SECTORS             4
+#define ERASE_POLLS         1000
+#define READ_INTERVAL_US    2000
+
+//
+// Latency buckets: below 125 us, then each twice the one before
+//
+#define BUCKET_MIN_US       125
+#define BUCKETS             13
+
+static uint8_t data[LBLOCK_SIZE];
+static uint16_t block[LBLOCK_SIZE / 2];
+static uint64_t next_read_us;
+static uint32_t histogram[BUCKETS];
+static uint32_t reads;
+static uint64_t worst_us, total_us;
+
+static int usb_pending(void)
+{
+    return sim_stats.clock_us >= next_read_us;
+}
+
+//
+// usb_serve - The USB interrupt: every READ that has arrived is served now
+//
+static void usb_serve(void)
+{
+    uint64_t latency;
+    uint32_t bucket;
+
+    while (usb_pending()) {
+        latency = sim_stats.clock_us - next_read_us;
+        disk_read(rand() % NBLOCKS, block, 1);
+        for (bucket = 0; bucket < BUCKETS - 1 &&
+             latency >= (uint64_t)BUCKET_MIN_US << bucket; bucket++)
+            ;
+        histogram[bucket]++;
+        reads++;
+        total_us += latency;
+        if (latency > worst_us)
+            worst_us = latency;
+        next_read_us += READ_INTERVAL_US;
+    }
+}
+
+int main(void)
+{
+    uint32_t s, i, b;
+
+    srand(17);
+    sim_reset();
+    disk_initialize();
+    for (s = 0; s < SECTORS; s++) {
+        for (i = 0; i < LBLOCK_SIZE; i++)
+            data[i] = rand();
+        data[0] = 0;
+        CHECK(write_blocks(s * SECTOR_BLOCKS + 1, 1, data) == 0);
+    }
+    disk_flush();
+
+    //
+    // New data in the same blocks, every bit may need to go 0 -> 1
+    //
+    for (s = 0; s < SECTORS; s++) {
+        for (i = 0; i < LBLOCK_SIZE; i++)
+            data[i] = rand();
+        data[0] = 0x01;
+        CHECK(write_blocks(s * SECTOR_BLOCKS + 1, 1, data) == 0);
+    }
+
+    sim_erase_polls = ERASE_POLLS;
+    disk_set_erase_preempt(usb_pending, usb_serve);
+    next_read_us = sim_stats.clock_us + READ_INTERVAL_US;
+    b = sim_stats.erases;
+    while (disk_sync())
+        usb_serve();
+    CHECK(sim_stats.erases - b == SECTORS);
+    CHECK(reads > 0);
+
+    printf("erase suspend %d: %u READs during %u erases, %u suspends, "
+           "mean %.2f ms, worst %.2f ms\n", FLASHDISK_ERASE_SUSPEND, reads,
+           sim_stats.erases - b, sim_stats.suspends,
+           (double)total_us / reads / 1000, (double)worst_us / 1000);
+    for (b = 0; b < BUCKETS; b++) {
+        if (!histogram[b])
+            continue;
+        if (b < BUCKETS - 1)
+            printf("  < %7.3f ms %5u\n",
+                   (double)((uint64_t)BUCKET_MIN_US << b) / 1000,
+                   histogram[b]);
+        else
+            printf("  >=%7.3f ms %5u\n",
+                   (double)((uint64_t)BUCKET_MIN_US << (b - 1)) / 1000,
+                   histogram[b]);
+    }
+    return 0;
+}
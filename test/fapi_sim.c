@@ -0,0 +1,268 @@
+//#############################################################################
+//
+// fapi_sim.c - Simulated F021 flash API for the host test build
+//
+// Like every source of the host build this sees host.h, so memset and
+// memcmp count 16-bit words here too.
+//
+// Flash bank 0 is the sim_flash array. Programming can only clear bits, an
+// erase is asynchronous and leaves the sector unreadable until the FSM is
+// polled ready again, and an erase can be suspended and resumed. ECC is
+// modelled per 64 bits: programming it with Fapi_AutoEccGeneration over
+// 64 bits that already hold different programmed data needs bits to go
+// 0 -> 1 and sets INVDAT in the FSM status, like data bits do.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "F28x_Project.h"
+#include "F021_F2837xD_C28x.h"
+#include "fapi_sim.h"
+
+#define FMSTAT_ESUSP        0x0004
+#define FMSTAT_INVDAT       0x0020
+#define ECC_BLANK           0xFF
+
+uint16_t sim_flash[SIM_FLASH_WORDS];
+static uint16_t sim_ecc[SIM_FLASH_WORDS / 4];
+
+volatile struct FLASH_ECC_REGS Flash0EccRegs;
+volatile struct DCSM_COMMON_REGS DcsmCommonRegs;
+
+sim_stats_t sim_stats;
+uint32_t sim_erase_polls = 20;
+jmp_buf *sim_estop_jmp;
+
+static uint32_t busy;               /* polls until the FSM is ready */
+static uint16_t fmstat;
+static uint16_t *erase_addr;        /* sector being erased */
+static uint32_t erase_words;
+static uint32_t erase_poll_us;      /* clock_us advanced per erase poll */
+static uint16_t suspended;
+
+void sim_estop(void)
+{
+    if (sim_estop_jmp)
+        longjmp(*sim_estop_jmp, 1);
+    printf("ESTOP0\n");
+    exit(1);
+}
+
+static void sim_fail(const char *what)
+{
+    printf("fapi_sim: %s\n", what);
+    exit(1);
+}
+
+void sim_fill(uint16_t *p, uint32_t words, uint16_t value)
+{
+    while (words--)
+        *p++ = value;
+}
+
+void sim_reset(void)
+{
+    sim_fill(sim_flash, SIM_FLASH_WORDS, 0xFFFF);
+    memset(sim_ecc, ECC_BLANK, SIM_FLASH_WORDS / 4);
+    memset(&sim_stats, 0, sizeof(sim_stats) / 2);
+    busy = 0;
+    fmstat = 0;
+    erase_addr = 0;
+    suspended = 0;
+}
+
+static uint32_t word_index(const void *a)
+{
+    const uint16_t *p = a;
+
+    if (p < sim_flash || p >= sim_flash + SIM_FLASH_WORDS)
+        sim_fail("address outside flash bank 0");
+    return p - sim_flash;
+}
+
+//
+// sector_words - Size of the sector at word index i, sectors A-D and K-N are
+// 8K words, E-J 32K words
+//
+static uint32_t sector_words(uint32_t i)
+{
+    if (i >= 0x8000 && i < 0x38000)
+        return 0x8000;
+    return 0x2000;
+}
+
+//
+// ecc_of - Stand-in for the SECDED code of 64 data bits. All ones leaves the
+// ECC erased, like on the device.
+//
+static uint16_t ecc_of(const uint16_t *d)
+{
+    uint32_t h;
+
+    if ((d[0] & d[1] & d[2] & d[3]) == 0xFFFF)
+        return ECC_BLANK;
+    h = d[0] * 0x9E37U ^ d[1] * 0x85EBU ^ d[2] * 0xC2B2U ^ d[3] * 0x27D4U;
+    return (h ^ h >> 8 ^ h >> 16) & 0xFF;
+}
+
+Fapi_StatusType Fapi_initializeAPI(Fapi_FmcRegistersType *poFlashControlRegister,
+                                   uint32 u32HclkFrequency)
+{
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_setActiveFlashBank(Fapi_FlashBankType oFlashBank)
+{
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_issueAsyncCommandWithAddress(
+                                        Fapi_FlashStateCommandsType oCommand,
+                                        uint32 *pu32StartAddress)
+{
+    uint32_t i = word_index(pu32StartAddress);
+
+    if (oCommand != Fapi_EraseSector)
+        sim_fail("unsupported async command");
+    if (busy || suspended)
+        sim_fail("erase issued while the FSM is busy");
+    erase_words = sector_words(i);
+    if (i % erase_words)
+        sim_fail("erase address is not the start of a sector");
+    erase_addr = sim_flash + i;
+    sim_fill(erase_addr, erase_words, 0x5A5A);
+    erase_poll_us = (erase_words == 0x8000 ? SIM_ERASE_64K_US :
+                                             SIM_ERASE_16K_US) / sim_erase_polls;
+    busy = sim_erase_polls;
+    fmstat = 0;
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_issueAsyncCommand(Fapi_FlashStateCommandsType oCommand)
+{
+    if (oCommand != Fapi_EraseResume || !suspended)
+        sim_fail("resume without a suspended erase");
+    busy = suspended;
+    suspended = 0;
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_issueFsmSuspendCommand(void)
+{
+    if (busy && erase_addr) {
+        suspended = busy;
+        busy = 0;
+        sim_stats.suspends++;
+    }
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_checkFsmForReady(void)
+{
+    if (!busy)
+        return Fapi_Status_FsmReady;
+    if (erase_addr)
+        sim_stats.clock_us += erase_poll_us;
+    if (--busy == 0 && erase_addr) {
+        uint32_t i = erase_addr - sim_flash;
+
+        sim_fill(erase_addr, erase_words, 0xFFFF);
+        memset(sim_ecc + i / 4, ECC_BLANK, erase_words / 4);
+        sim_stats.erases++;
+        sim_stats.busy_us += erase_words == 0x8000 ? SIM_ERASE_64K_US :
+                                                     SIM_ERASE_16K_US;
+        erase_addr = 0;
+    }
+    return Fapi_Status_FsmBusy;
+}
+
+Fapi_FlashStatusType Fapi_getFsmStatus(void)
+{
+    return fmstat | (suspended ? FMSTAT_ESUSP : 0);
+}
+
+Fapi_StatusType Fapi_issueProgrammingCommand(uint32 *pu32StartAddress,
+                                             uint16 *pu16DataBuffer,
+                                             uint16 u16DataBufferSizeInWords,
+                                             uint16 *pu16EccBuffer,
+                                             uint16 u16EccBufferSizeInBytes,
+                                             Fapi_FlashProgrammingCommandsType oMode)
+{
+    uint32_t i = word_index(pu32StartAddress);
+    uint16_t *f = sim_flash + i;
+    uint16_t n, e;
+    uint16_t ecc;
+
+    if (busy)
+        sim_fail("program issued while the FSM is busy");
+    if (i % 8 || u16DataBufferSizeInWords > 8)
+        sim_fail("program is not within one 128-bit chunk");
+    if (erase_addr && f >= erase_addr && f < erase_addr + erase_words)
+        sim_fail("program into the sector being erased");
+
+    fmstat = 0;
+    for (n = 0; n < u16DataBufferSizeInWords; n++) {
+        if (pu16DataBuffer[n] & ~f[n]) {
+            sim_stats.violations++;
+            fmstat |= FMSTAT_INVDAT;
+        }
+        f[n] &= pu16DataBuffer[n];
+    }
+    if (oMode == Fapi_AutoEccGeneration) {
+        for (e = 0; e < 2; e++) {
+            ecc = ecc_of(f + e * 4);
+            if (sim_ecc[i / 4 + e] != ECC_BLANK && ecc != sim_ecc[i / 4 + e]) {
+                sim_stats.ecc_violations++;
+                fmstat |= FMSTAT_INVDAT;
+            }
+            sim_ecc[i / 4 + e] &= ecc;
+        }
+    }
+    sim_stats.programs++;
+    sim_stats.busy_us += SIM_PROGRAM_US;
+    sim_stats.clock_us += SIM_PROGRAM_US;
+    busy = 1;
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_doBlankCheck(uint32 *pu32StartAddress, uint32 u32Length,
+                                  Fapi_FlashStatusWordType *poFlashStatusWord)
+{
+    uint16_t *p = sim_flash + word_index(pu32StartAddress);
+    uint32_t n;
+
+    sim_stats.blank_checks++;
+    for (n = 0; n < u32Length * 2; n++) {
+        if (p[n] != 0xFFFF)
+            return Fapi_Error_Fail;
+    }
+    return Fapi_Status_Success;
+}
+
+Fapi_StatusType Fapi_doVerify(uint32 *pu32StartAddress, uint32 u32Length,
+                              uint32 *pu32CheckValueBuffer,
+                              Fapi_FlashStatusWordType *poFlashStatusWord)
+{
+    uint16_t *p = sim_flash + word_index(pu32StartAddress);
+
+    sim_stats.verifies++;
+    sim_stats.verify_words += u32Length * 2;
+    if (memcmp(p, pu32CheckValueBuffer, u32Length * 2))
+        return Fapi_Error_Fail;
+    return Fapi_Status_Success;
+}
+
+uint32 Fapi_calculateFletcherChecksum(uint16 const *pu16Data, uint16 u16Length)
+{
+    uint32_t a = 0xFFFF, b = 0xFFFF;
+    uint32_t n = u16Length;
+
+    sim_stats.checksums++;
+    sim_stats.checksum_words += n;
+    while (n--) {
+        a = (a + *pu16Data++) % 65535;
+        b = (b + a) % 65535;
+    }
+    return b << 16 | a;
+}
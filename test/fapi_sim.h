@@ -0,0 +1,53 @@
+//#############################################################################
+//
+// fapi_sim.h - Simulated F021 flash API for the host test build
+//
+//#############################################################################
+
+#ifndef FAPI_SIM_H
+#define FAPI_SIM_H
+
+#include <setjmp.h>
+#include <stdint.h>
+
+typedef struct {
+    uint32_t erases;            /* sector erases completed */
+    uint32_t programs;          /* program commands, up to 128 bits each */
+    uint32_t violations;        /* data bits a program asked to take 0 -> 1 */
+    uint32_t ecc_violations;    /* ECC of a programmed 64 bits rewritten */
+    uint32_t verifies;          /* Fapi_doVerify calls */
+    uint32_t verify_words;      /* 16-bit words read back by Fapi_doVerify */
+    uint32_t blank_checks;      /* Fapi_doBlankCheck calls */
+    uint32_t checksums;         /* Fapi_calculateFletcherChecksum calls */
+    uint32_t checksum_words;    /* 16-bit words summed by those */
+    uint32_t suspends;          /* erases suspended */
+    uint64_t busy_us;           /* time the FSM spent programming and erasing */
+    uint64_t clock_us;          /* simulated time, advanced as the FSM works */
+} sim_stats_t;
+
+extern sim_stats_t sim_stats;
+
+//
+// Assumed FSM operation times, only used to turn operation counts into
+// sim_stats.busy_us for throughput figures and to advance sim_stats.clock_us:
+// by a program as it is issued and by an erase a poll at a time, so the
+// clock stops while an erase is suspended
+//
+#define SIM_PROGRAM_US          40UL        /* one 128-bit program */
+#define SIM_ERASE_16K_US        100000UL    /* 8K-word sector */
+#define SIM_ERASE_64K_US        250000UL    /* 32K-word sector */
+
+//
+// Fapi_checkFsmForReady() calls an erase stays busy for
+//
+extern uint32_t sim_erase_polls;
+
+//
+// Set to make ESTOP0 longjmp here instead of ending the test
+//
+extern jmp_buf *sim_estop_jmp;
+
+void sim_reset(void);
+void sim_fill(uint16_t *p, uint32_t words, uint16_t value);
+
+#endif // FAPI_SIM_H
@@ -0,0 +1,188 @@
+//#############################################################################
+//
+// fifo_test.c - Host unit tests of the byte order of the endpoint FIFO
+// accesses in USBEndpointDataGet/Put and their packed variants
+//
+// device/driverlib/usb.c is built against usb_mock.h, which records every
+// FIFO access as the bytes the controller would move. Each packet size from
+// 0 to 64 bytes has to come out of the FIFO in buffer order, with 32-bit
+// accesses going through HWREG_BP and only the tail in narrower ones.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_usb.h"
+#include "usb.h"
+
+#define CHECK(c) \
+    do { if (!(c)) fail(__FILE__, __LINE__, #c); } while (0)
+
+#define MAX_PACKET      64
+#define EP              USB_EP_1
+
+static uint16_t data[MAX_PACKET], buf[MAX_PACKET + 2];
+
+static void fail(const char *file, int line, const char *what)
+{
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+//
+// FIFO accesses a packet of size bytes should take
+//
+static uint32_t accesses(uint32_t size)
+{
+    return size / 4 + (size % 4) / 2 + size % 2;
+}
+
+static void random_data(void)
+{
+    uint32_t i;
+
+    for (i = 0; i < MAX_PACKET; i++)
+        data[i] = rand() & 0xFF;
+}
+
+static void rx_packet(uint32_t size)
+{
+    usb_mock_reset();
+    HWREGH(USBA_BASE + USB_O_RXCSRL1) = USB_RXCSRL1_RXRDY;
+    HWREGH(USBA_BASE + USB_O_COUNT0 + EP) = size;
+    usb_mock_rx = data;
+}
+
+static void test_put(void)
+{
+    uint32_t size, i;
+
+    for (size = 0; size <= MAX_PACKET; size++) {
+        random_data();
+        usb_mock_reset();
+        // Only the low byte of each word goes into the FIFO
+        for (i = 0; i < size; i++)
+            buf[i] = data[i] | 0xA500;
+        CHECK(USBEndpointDataPut(USBA_BASE, EP, buf, size) == 0);
+        usb_mock_sync();
+        CHECK(usb_mock_tx_bytes == size);
+        for (i = 0; i < size; i++)
+            CHECK(usb_mock_tx[i] == data[i]);
+        CHECK(usb_mock_accesses == accesses(size));
+        CHECK(usb_mock_swapped == 0);
+    }
+}
+
+static void test_put_packed(void)
+{
+    uint32_t size, i;
+
+    for (size = 0; size <= MAX_PACKET; size++) {
+        random_data();
+        usb_mock_reset();
+        for (i = 0; i < size; i += 2)
+            buf[i / 2] = data[i] | (data[i + 1] << 8);
+        CHECK(USBEndpointDataPutPacked(USBA_BASE, EP, buf, size) == 0);
+        usb_mock_sync();
+        CHECK(usb_mock_tx_bytes == size);
+        for (i = 0; i < size; i++)
+            CHECK(usb_mock_tx[i] == data[i]);
+        CHECK(usb_mock_accesses == accesses(size));
+        CHECK(usb_mock_swapped == 0);
+    }
+}
+
+static void test_put_busy(void)
+{
+    usb_mock_reset();
+    HWREGB(USBA_BASE + USB_O_CSRL0 + EP) = USB_TXCSRL1_TXRDY;
+    CHECK(USBEndpointDataPut(USBA_BASE, EP, data, 4) == -1);
+    CHECK(usb_mock_accesses == 0);
+}
+
+static void test_get(void)
+{
+    uint32_t size, got, i;
+
+    for (size = 0; size <= MAX_PACKET; size++) {
+        random_data();
+        rx_packet(size);
+        memset(buf, 0xFF, sizeof(buf));
+        got = MAX_PACKET;
+        CHECK(USBEndpointDataGet(USBA_BASE, EP, buf, &got) == 0);
+        CHECK(got == size);
+        for (i = 0; i < size; i++)
+            CHECK(buf[i] == data[i]);
+        CHECK(buf[size] == 0xFFFF);
+        CHECK(usb_mock_rx == data + size);
+        CHECK(usb_mock_accesses == accesses(size));
+        CHECK(usb_mock_swapped == 0);
+    }
+}
+
+static void test_get_packed(void)
+{
+    uint32_t size, got, i;
+
+    for (size = 0; size <= MAX_PACKET; size++) {
+        random_data();
+        rx_packet(size);
+        memset(buf, 0xFF, sizeof(buf));
+        got = MAX_PACKET;
+        CHECK(USBEndpointDataGetPacked(USBA_BASE, EP, buf, &got) == 0);
+        CHECK(got == size);
+        for (i = 0; i + 1 < size; i += 2)
+            CHECK(buf[i / 2] == (data[i] | (data[i + 1] << 8)));
+        if (size % 2)
+            CHECK(buf[size / 2] == data[size - 1]);
+        CHECK(buf[(size + 1) / 2] == 0xFFFF);
+        CHECK(usb_mock_rx == data + size);
+        CHECK(usb_mock_accesses == accesses(size));
+        CHECK(usb_mock_swapped == 0);
+    }
+}
+
+//
+// A buffer shorter than the packet takes only its own size out of the FIFO
+//
+static void test_get_short(void)
+{
+    uint32_t got = 7, i;
+
+    random_data();
+    rx_packet(MAX_PACKET);
+    memset(buf, 0xFF, sizeof(buf));
+    CHECK(USBEndpointDataGet(USBA_BASE, EP, buf, &got) == 0);
+    CHECK(got == 7);
+    for (i = 0; i < 7; i++)
+        CHECK(buf[i] == data[i]);
+    CHECK(buf[7] == 0xFFFF);
+    CHECK(usb_mock_rx == data + 7);
+}
+
+static void test_get_empty(void)
+{
+    uint32_t got = MAX_PACKET;
+
+    usb_mock_reset();
+    usb_mock_rx = data;
+    CHECK(USBEndpointDataGet(USBA_BASE, EP, buf, &got) == -1);
+    CHECK(got == 0);
+    CHECK(usb_mock_accesses == 0);
+}
+
+int main(void)
+{
+    srand(12);
+    test_put();
+    test_put_packed();
+    test_put_busy();
+    test_get();
+    test_get_packed();
+    test_get_short();
+    test_get_empty();
+    printf("fifo_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,323 @@
+//#############################################################################
+//
+// flash_test.c - Host unit tests of the flash programming paths of the disk
+//
+// Each case writes blocks through disk_write(), flushes and then checks the
+// flash itself against what the host wrote, along with the erases and
+// program commands the simulated FSM saw. A program that would need a bit,
+// data or ECC, to go from 0 to 1 sets INVDAT and stops the test.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define SECTOR_BLOCKS   (SECTOR_SIZE * 2 / LBLOCK_SIZE)
+
+static uint8_t old_data[LBLOCK_SIZE], new_data[LBLOCK_SIZE], buf[LBLOCK_SIZE];
+static sim_stats_t before;
+
+static void random_data(uint8_t *p)
+{
+    uint32_t i;
+
+    for (i = 0; i < LBLOCK_SIZE; i++)
+        p[i] = rand();
+    p[0] = 0;
+}
+
+//
+// check_block - The block reads back as data and the flash holds it too
+//
+static void check_block(uint32_t lba, const uint8_t *data)
+{
+    read_blocks(lba, 1, buf);
+    CHECK(memcmp(buf, data, LBLOCK_SIZE / 2) == 0);
+    unpack(buf, ram_disk + lba * (LBLOCK_SIZE / 2), LBLOCK_SIZE);
+    CHECK(memcmp(buf, data, LBLOCK_SIZE / 2) == 0);
+}
+
+//
+// changed_chunks - 128-bit chunks that differ between a and b
+//
+static uint32_t changed_chunks(const uint8_t *a, const uint8_t *b)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < LBLOCK_SIZE; i += 16)
+        n += memcmp(a + i, b + i, 8) != 0;
+    return n;
+}
+
+static void start(void)
+{
+    sim_reset();
+    disk_initialize();
+    CHECK(usb_unlocked);
+}
+
+static void write_flushed(uint32_t lba, const uint8_t *data)
+{
+    before = sim_stats;
+    CHECK(write_blocks(lba, 1, data) == 0);
+    disk_flush();
+}
+
+//
+// A block written into blank flash is programmed without an erase
+//
+static void test_blank(void)
+{
+    start();
+    memset(old_data, 0xFFFF, LBLOCK_SIZE / 2);
+    random_data(new_data);
+    write_flushed(3, new_data);
+    CHECK(sim_stats.erases == before.erases);
+    CHECK(sim_stats.programs - before.programs ==
+          changed_chunks(old_data, new_data));
+    check_block(3, new_data);
+}
+
+//
+// Data that only clears bits is programmed in place, chunk by chunk, and the
+// ECC of the programmed chunks is left alone
+//
+static void test_clear_bits(void)
+{
+    uint32_t i;
+
+    start();
+    random_data(old_data);
+    write_flushed(9, old_data);
+    memcpy(new_data, old_data, LBLOCK_SIZE / 2);
+    for (i = 0; i < LBLOCK_SIZE; i += 97)
+        new_data[i] &= rand();
+    write_flushed(9, new_data);
+    CHECK(sim_stats.erases == before.erases);
+    CHECK(sim_stats.ecc_violations == 0);
+    CHECK(sim_stats.programs - before.programs ==
+          changed_chunks(old_data, new_data));
+    check_block(9, new_data);
+}
+
+//
+// Data that needs a bit set erases the sector, the other blocks of the
+// sector keep their contents
+//
+static void test_set_bits(void)
+{
+    start();
+    random_data(old_data);
+    old_data[1] = 0x00;
+    write_flushed(SECTOR_BLOCKS + 1, old_data);
+    random_data(new_data);
+    new_data[1] = 0x01;
+    write_flushed(SECTOR_BLOCKS, old_data);
+    write_flushed(SECTOR_BLOCKS + 1, new_data);
+    CHECK(sim_stats.erases == before.erases + 1);
+    check_block(SECTOR_BLOCKS, old_data);
+    check_block(SECTOR_BLOCKS + 1, new_data);
+}
+
+//
+// Rewriting what flash already holds programs nothing
+//
+static void test_same_data(void)
+{
+    start();
+    random_data(old_data);
+    write_flushed(20, old_data);
+    write_flushed(20, old_data);
+    CHECK(sim_stats.erases == before.erases);
+    CHECK(sim_stats.programs == before.programs);
+    check_block(20, old_data);
+}
+
+//
+// A write covering whole sectors is streamed into freshly erased flash
+//
+static void test_stream(void)
+{
+    static uint8_t run[SECTOR_BLOCKS][LBLOCK_SIZE];
+    uint32_t n, verified;
+
+    start();
+    random_data(old_data);
+    write_flushed(2 * SECTOR_BLOCKS + 4, old_data);
+    for (n = 0; n < SECTOR_BLOCKS; n++)
+        random_data(run[n]);
+    before = sim_stats;
+    verified = disk_stats.stream_verifies;
+    CHECK(write_blocks(2 * SECTOR_BLOCKS, SECTOR_BLOCKS, run[0]) == 0);
+    CHECK(sim_stats.erases == before.erases + 1);
+    for (n = 0; n < SECTOR_BLOCKS; n++)
+        check_block(2 * SECTOR_BLOCKS + n, run[n]);
+
+    //
+    // The sector is checked once, against the checksum of its packets
+    //
+    CHECK(disk_stats.stream_verifies == verified + 1);
+    CHECK(sim_stats.verifies == before.verifies);
+    CHECK(sim_stats.checksums == before.checksums);
+}
+
+//
+// A streamed sector that does not read back as its packets stops once its
+// last packet is programmed
+//
+static void test_stream_verify(void)
+{
+    static uint8_t run[SECTOR_BLOCKS][LBLOCK_SIZE];
+    uint16_t packet[TRANSFER_SIZE / 2];
+    uint32_t lba = 3 * SECTOR_BLOCKS, n, off;
+    jmp_buf stop;
+    volatile int stopped = 0;
+
+    start();
+    for (n = 0; n < SECTOR_BLOCKS; n++)
+        random_data(run[n]);
+    disk_write_start(lba, SECTOR_BLOCKS);
+    sim_estop_jmp = &stop;
+    if (setjmp(stop)) {
+        stopped = 1;
+    } else {
+        for (n = 0; n < SECTOR_BLOCKS; n++) {
+            //
+            // Flip a programmed bit of the first block behind the disk's
+            // back once it is in flash
+            //
+            if (n == 1)
+                ram_disk[lba * (LBLOCK_SIZE / 2) + 5] ^= 0x10;
+            for (off = 0; off < LBLOCK_SIZE; off += TRANSFER_SIZE) {
+                pack(packet, run[n] + off, TRANSFER_SIZE);
+                CHECK(disk_write(lba + n, packet, off, 1) == TRANSFER_SIZE);
+                CHECK(n < SECTOR_BLOCKS - 1 ||
+                      off < LBLOCK_SIZE - TRANSFER_SIZE);
+            }
+        }
+    }
+    sim_estop_jmp = 0;
+    CHECK(stopped);
+}
+
+//
+// After a remount the erased state of a sector is still read from flash, the
+// first time it is needed: a blank sector is streamed into without an erase
+// and one holding data is erased first
+//
+static void test_remount(void)
+{
+    static uint8_t run[SECTOR_BLOCKS][LBLOCK_SIZE];
+    uint32_t n;
+
+    start();
+    random_data(old_data);
+    write_flushed(SECTOR_BLOCKS + 3, old_data);
+    disk_initialize();
+    check_block(SECTOR_BLOCKS + 3, old_data);
+    for (n = 0; n < SECTOR_BLOCKS; n++)
+        random_data(run[n]);
+    before = sim_stats;
+    CHECK(write_blocks(3 * SECTOR_BLOCKS, SECTOR_BLOCKS, run[0]) == 0);
+    CHECK(sim_stats.erases == before.erases);
+    CHECK(write_blocks(SECTOR_BLOCKS, SECTOR_BLOCKS, run[0]) == 0);
+    CHECK(sim_stats.erases == before.erases + 1);
+    for (n = 0; n < SECTOR_BLOCKS; n++) {
+        check_block(SECTOR_BLOCKS + n, run[n]);
+        check_block(3 * SECTOR_BLOCKS + n, run[n]);
+    }
+}
+
+//
+// disk_sync() writes the cached data back one bounded step per call, the way
+// the main loop runs it for SYNCHRONIZE CACHE, and returns 0 once it is done
+//
+static void test_sync(void)
+{
+    uint32_t steps = 0;
+
+    start();
+    random_data(old_data);
+    write_flushed(5, old_data);
+    random_data(new_data);
+    new_data[0] = 0x01;
+    CHECK(write_blocks(5, 1, new_data) == 0);
+    while (disk_sync())
+        steps++;
+    CHECK(steps > 1);
+    CHECK(disk_sync() == 0);
+    unpack(buf, ram_disk + 5 * (LBLOCK_SIZE / 2), LBLOCK_SIZE);
+    CHECK(memcmp(buf, new_data, LBLOCK_SIZE / 2) == 0);
+}
+
+//
+// Closing the drive in the USB interrupt writes back no more than the open
+// sector, the blocks held in the block cache are left to disk_poll()
+//
+static void test_close(void)
+{
+    static uint8_t data[3][LBLOCK_SIZE];
+    uint32_t i, lba;
+
+    start();
+    for (i = 0; i < 3; i++) {
+        random_data(old_data);
+        write_flushed(i * SECTOR_BLOCKS + 1, old_data);
+    }
+    for (i = 0; i < 3; i++) {
+        lba = i * SECTOR_BLOCKS + 1;
+        random_data(data[i]);
+        data[i][0] = 0x01;
+        CHECK(write_blocks(lba, 1, data[i]) == 0);
+    }
+    before = sim_stats;
+    disk_close();
+    CHECK(sim_stats.erases - before.erases <= 1);
+    while (disk_poll())
+        ;
+    CHECK(sim_stats.erases - before.erases == 3);
+    for (i = 0; i < 3; i++)
+        check_block(i * SECTOR_BLOCKS + 1, data[i]);
+}
+
+//
+// The FSM status is checked after every program
+//
+static void test_program_status(void)
+{
+    jmp_buf stop;
+    uint16_t *dst = ram_disk + (RAM_DISK_SIZE / 2 - 8);
+    uint16_t words[8] = { 0x1234, 0, 0, 0, 0, 0, 0, 0 };
+    volatile int stopped = 0;
+
+    start();
+    flash_program(dst, words, 8);
+    words[0] = 0x4321;
+    sim_estop_jmp = &stop;
+    if (setjmp(stop))
+        stopped = 1;
+    else
+        flash_program(dst, words, 8);
+    sim_estop_jmp = 0;
+    CHECK(stopped);
+}
+
+int main(void)
+{
+    srand(5);
+    test_blank();
+    test_clear_bits();
+    test_set_bits();
+    test_same_data();
+    test_stream();
+    test_stream_verify();
+    test_remount();
+    test_sync();
+    test_close();
+    test_program_status();
+    printf("flash_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,252 @@
+//#############################################################################
+//
+// frame_bench.c - Packets per full-speed frame of a READ(10) through the
+// bulk IN FIFO, single-buffered against double-buffered
+//
+// usblib/device/usbdmsc.c is built against msc_mock.h, as for scsi_test, with
+// the mocked IN FIFO holding one packet or the two the class asks for in its
+// FIFO configuration. The bench runs the bus and the CPU on one clock: the
+// host takes a packet whenever one is waiting and a packet's time on the
+// bus has passed, or is NAKed and polls again. Each packet taken raises the
+// bulk IN interrupt, which runs the class handler once the CPU is free. The
+// packets it loads are waiting once it returns. Its time is taken from the
+// FIFO accesses and media reads it made, with the assumed costs below.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_usb.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usbmsc.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdmsc.h"
+
+#define CHECK(c) \
+    do { if (!(c)) fail(__FILE__, __LINE__, #c); } while (0)
+
+#define EP              USB_EP_1
+#define CBW_SIZE        31
+#define CSW_SIZE        13
+#define MAX_PACKET      64
+#define BLOCKS          1024
+#define BLOCK_SIZE      512
+#define BUFFER_SIZE     0x1000
+#define RING_SIZE       0x400
+#define READ_BLOCKS     512
+
+//
+// The bus: a full-speed frame fits at most 19 bulk packets of 64 bytes, a
+// NAKed IN token and the poll after it take a fraction of that
+//
+#define FRAME_NS        1000000.0
+#define PACKET_NS       (FRAME_NS / 19)
+#define NAK_NS          5000.0
+
+//
+// Assumed costs at 200 MHz: taking the USB interrupt up to the endpoint
+// handler, one 16-bit FIFO access through the peripheral bridge, and one
+// word of a block the media reads into the staging buffer
+//
+#define ISR_NS          1500.0
+#define FIFO_ACCESS_NS  25.0
+#define MEDIA_WORD_NS   10.0
+
+#define NEVER           1e30
+
+extern const tCustomHandlers g_sMSCHandlers;
+
+static uint16_t block_buffer[BUFFER_SIZE / 2];
+static uint16_t write_ring[RING_SIZE / 2];
+static uint32_t media_words;
+
+static void fail(const char *file, int line, const char *what)
+{
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+//
+// Intrinsics of the TI compiler and the parts of the device controller
+// driver the class calls
+//
+uint16_t __disable_interrupts(void) { return 0; }
+uint16_t __enable_interrupts(void) { return 0; }
+void __eallow(void) { }
+void __edis(void) { }
+void USBDCDInit(uint32_t ui32Index, tDeviceInfo *psDevice, void *pvData) { }
+void USBDCDDeviceInfoInit(uint32_t ui32Index, tDeviceInfo *psDevice) { }
+void USBDCDTerm(uint32_t ui32Index) { }
+void USBDCDStallEP0(uint32_t ui32Index) { }
+void USBDCDSendDataEP0(uint32_t ui32Index, uint8_t *pui8Data,
+                       uint32_t ui32Size) { }
+
+//
+// The media, which only counts the words it would read
+//
+static void *media_open(uint32_t drive) { return (void *)1; }
+static void media_close(void *drive) { }
+static uint32_t media_read(void *drive, uint16_t *buf, uint32_t lba,
+                           uint32_t count)
+{
+    media_words += count * BLOCK_SIZE / 2;
+    return count * BLOCK_SIZE;
+}
+static uint32_t media_write(void *drive, uint16_t *buf, uint32_t lba,
+                            uint32_t off, uint32_t count)
+{
+    return count * MAX_PACKET;
+}
+static uint32_t media_blocks(void *drive) { return BLOCKS; }
+static uint32_t media_block_size(void *drive) { return BLOCK_SIZE; }
+
+static const uint16_t lang_string[] = { 4, USB_DTYPE_STRING, 0x09, 0x04 };
+static const unsigned char * const strings[] = {
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string
+};
+
+static tUSBDMSCDevice device = {
+    0x1cbe, 0x0003, "TI      ", "Mass Storage    ", "1.00", 500,
+    USB_CONF_ATTR_SELF_PWR, strings, 4,
+    {
+        media_open, media_close, media_read, media_write, media_blocks,
+        media_block_size, 0, 0, 0, 0
+    },
+    0, block_buffer, BUFFER_SIZE, write_ring, RING_SIZE
+};
+
+//
+// The packets waiting in the IN FIFO, with the time each was loaded
+//
+static double ready[2];
+static uint32_t waiting;
+
+//
+// handler - Run an endpoint handler of the class and return its time. The
+// packets it loaded are waiting from then on.
+//
+static double handler(uint32_t status, double start)
+{
+    uint32_t accesses = usb_mock_accesses, queued = usb_mock_tx_queued;
+    double end;
+
+    media_words = 0;
+    g_sMSCHandlers.pfnEndpointHandler(&device, status);
+    usb_mock_sync();
+    end = start + ISR_NS + (usb_mock_accesses - accesses) * FIFO_ACCESS_NS +
+          media_words * MEDIA_WORD_NS;
+    CHECK(usb_mock_tx_queued >= queued);
+    for (; queued < usb_mock_tx_queued; queued++)
+        ready[waiting++] = end;
+    return end;
+}
+
+//
+// read10 - A READ(10) of count blocks with an IN FIFO of slots packets.
+// Returns the time from the CBW to the last data packet on the bus.
+//
+static double read10(uint32_t slots, uint32_t count)
+{
+    static uint16_t cbw[CBW_SIZE];
+    uint32_t i, packets = 0, length = count * BLOCK_SIZE;
+    double host = 0, cpu, irq = NEVER, take, run, last = 0;
+    int size;
+
+    memset(cbw, 0, sizeof(cbw));
+    cbw[0] = 'U';
+    cbw[1] = 'S';
+    cbw[2] = 'B';
+    cbw[3] = 'C';
+    cbw[4] = 0x5A;
+    for (i = 0; i < 4; i++)
+        cbw[8 + i] = (length >> (8 * i)) & 0xFF;
+    cbw[12] = CBWFLAGS_DIR_IN;
+    cbw[14] = 10;
+    cbw[15] = SCSI_READ_10;
+    cbw[22] = count >> 8;
+    cbw[23] = count & 0xFF;
+
+    usb_mock_reset();
+    usb_mock_tx_slots = slots;
+    waiting = 0;
+    HWREGH(USBA_BASE + USB_O_RXCSRL1) = USB_RXCSRL1_RXRDY;
+    HWREGH(USBA_BASE + USB_O_COUNT0 + EP) = CBW_SIZE;
+    usb_mock_rx = cbw;
+    usb_mock_rx_end = cbw + CBW_SIZE;
+    cpu = handler(0x10000 << USBEPToIndex(EP), 0);
+    CHECK(usb_mock_rx == usb_mock_rx_end);
+
+    for (;;) {
+        //
+        // The host polls every NAK_NS until the oldest packet is waiting
+        //
+        take = NEVER;
+        if (waiting) {
+            take = host;
+            if (ready[0] > host)
+                take += NAK_NS * (uint32_t)((ready[0] - host) / NAK_NS + 1);
+        }
+        run = irq == NEVER ? NEVER : (irq > cpu ? irq : cpu);
+        CHECK(take != NEVER || run != NEVER);
+
+        if (run <= take) {
+            irq = NEVER;
+            cpu = handler(1 << USBEPToIndex(EP), run);
+            continue;
+        }
+
+        size = usb_mock_in_take();
+        CHECK(size >= 0);
+        ready[0] = ready[1];
+        waiting--;
+        host = take + PACKET_NS;
+        irq = host;
+        if (packets == length / MAX_PACKET)
+            break;
+        CHECK(size == MAX_PACKET);
+        packets++;
+        last = host;
+    }
+
+    //
+    // The CSW, passed and with no residue. Its IN interrupt ends the command.
+    //
+    CHECK(size == CSW_SIZE);
+    CHECK(usb_mock_tx[12] == 0);
+    handler(1 << USBEPToIndex(EP), host);
+    CHECK(USBDMSCIsIdle(&device));
+    return last;
+}
+
+static void report(const char *what, uint32_t slots)
+{
+    double ns = read10(slots, READ_BLOCKS);
+    double bytes = READ_BLOCKS * BLOCK_SIZE;
+
+    printf("READ(10) of %u KB, %s IN FIFO: %5.2f packets per frame, "
+           "%4.0f KB/s\n", READ_BLOCKS * BLOCK_SIZE / 1024, what,
+           bytes / MAX_PACKET / (ns / FRAME_NS), bytes / 1024 / (ns / 1e9));
+}
+
+int main(void)
+{
+    const tFIFOConfig *fifo;
+
+    usb_mock_reset();
+    USBDMSCInit(0, &device);
+    fifo = device.sPrivateData.sDevInfo.psFIFOConfig;
+    CHECK(fifo != 0);
+
+    report("single-buffered", 1);
+    report(fifo->sIn[USBEPToIndex(EP) - 1].bDoubleBuffer ?
+           "double-buffered" : "single-buffered",
+           fifo->sIn[USBEPToIndex(EP) - 1].bDoubleBuffer ? 2 : 1);
+    printf("full-speed limit: %.2f packets per frame\n", FRAME_NS / PACKET_NS);
+    return 0;
+}
@@ -0,0 +1,144 @@
+//#############################################################################
+//
+// ftl_test.c - Host test of the log-structured FTL (flash_disk/ftl.c)
+//
+// Runs the disk in FTL mode over the simulated flash: random block writes
+// with remounts and background GC in between, checked against a model of
+// the disk, plus the cases where the FTL has to refuse data. Reports write
+// amplification and the write throughput the assumed FSM times give.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#include <flash_disk/ftl.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define NBLOCKS     (FTL_BLOCKS * (BLOCK_SIZE / LBLOCK_SIZE))
+#define WRITES      4000
+
+static uint8_t model[NBLOCKS][LBLOCK_SIZE];
+static uint8_t data[LBLOCK_SIZE];
+
+static void fill(uint8_t *p, uint32_t seed)
+{
+    uint32_t i;
+
+    for (i = 0; i < LBLOCK_SIZE; i++)
+        p[i] = (uint8_t)(seed * 31 + i * 7 + (seed >> 8));
+    //
+    // Never look like an unlock packet
+    //
+    p[0] = 0;
+}
+
+static void check_disk(void)
+{
+    uint32_t lba;
+
+    for (lba = 0; lba < NBLOCKS; lba++) {
+        read_blocks(lba, 1, data);
+        if (memcmp(data, model[lba], LBLOCK_SIZE / 2)) {
+            printf("block %u differs\n", lba);
+            exit(1);
+        }
+    }
+}
+
+//
+// A fresh FTL treats whatever the data sectors hold as stale
+//
+static void test_fresh_mount(void)
+{
+    uint32_t i;
+
+    sim_reset();
+    for (i = 0; i < RAM_DISK_SIZE / 2; i++)
+        ram_disk[i] = rand();
+    disk_initialize();
+    CHECK(usb_unlocked);
+    CHECK(disk_blocks() == NBLOCKS);
+    memset(model, 0xFFFF, sizeof(model) / 2);
+    check_disk();
+}
+
+static void test_random_writes(void)
+{
+    uint32_t n, lba, programs, host_bytes = 0;
+    uint64_t busy_us;
+
+    programs = sim_stats.programs;
+    busy_us = sim_stats.busy_us;
+    memset(&ftl_stats, 0, sizeof(ftl_stats) / 2);
+    for (n = 0; n < WRITES; n++) {
+        lba = rand() % NBLOCKS;
+        fill(model[lba], n);
+        CHECK(write_blocks(lba, 1, model[lba]) == 0);
+        host_bytes += LBLOCK_SIZE;
+        if (n % 97 == 0)
+            disk_initialize();
+        if (n % 50 == 0)
+            while (disk_background())
+                ;
+        if (n % 500 == 0)
+            check_disk();
+    }
+    disk_initialize();
+    check_disk();
+
+    programs = sim_stats.programs - programs;
+    busy_us = sim_stats.busy_us - busy_us;
+    printf("ftl: %u blocks, %u host pages, %u relocated, %u erases, "
+           "%u journal records, %u checkpoints\n",
+           NBLOCKS, ftl_stats.host_pages, ftl_stats.relocated_pages,
+           ftl_stats.erases, ftl_stats.journal_records, ftl_stats.checkpoints);
+    printf("ftl: write amplification %.2f, %.1f KB/s at the assumed FSM times\n",
+           programs * 16.0 / host_bytes,
+           host_bytes / 1024.0 / (busy_us / 1e6));
+}
+
+//
+// Data the FTL cannot store fails the write instead of being dropped
+//
+static void test_write_refused(void)
+{
+    uint16_t packet[TRANSFER_SIZE / 2];
+
+    memset(packet, 0, TRANSFER_SIZE / 2);
+    disk_write_start(0, 1);
+    CHECK(disk_write(0, packet, TRANSFER_SIZE, 1) == DISK_WRITE_FAILED);
+    disk_write_start(NBLOCKS, 1);
+    CHECK(disk_write(NBLOCKS, packet, 0, 1) == DISK_WRITE_FAILED);
+    check_disk();
+}
+
+//
+// A header whose sequence number does not match its check word is not used.
+// With both headers damaged the FTL starts out empty.
+//
+static void test_header_check(void)
+{
+    uint16_t *journal[2] = { FLASH_ADDR(0x0BA000), FLASH_ADDR(0x0BC000) };
+    uint16_t j;
+
+    for (j = 0; j < 2; j++) {
+        if (journal[j][0] == 0x4A48)
+            journal[j][4] ^= 0x0100;
+    }
+    disk_initialize();
+    memset(model, 0xFFFF, sizeof(model) / 2);
+    check_disk();
+}
+
+int main(void)
+{
+    srand(1);
+    test_fresh_mount();
+    test_random_writes();
+    test_write_refused();
+    test_header_check();
+    printf("ftl_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,44 @@
+//#############################################################################
+//
+// F28x_Project.h - Host stand-in for the device support header
+//
+// Only what flash_disk/ uses from the device headers is provided. EALLOW and
+// EDIS do nothing and the registers are plain variables in fapi_sim.c, so
+// the tests can look at what the code wrote to them.
+//
+//#############################################################################
+
+#ifndef F28X_PROJECT_H
+#define F28X_PROJECT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#define EALLOW
+#define EDIS
+
+struct ECC_ENABLE_BITS {
+    uint16_t ENABLE;
+};
+
+union ECC_ENABLE_REG {
+    uint32_t all;
+    struct ECC_ENABLE_BITS bit;
+};
+
+struct FLASH_ECC_REGS {
+    union ECC_ENABLE_REG ECC_ENABLE;
+};
+
+union FLSEM_REG {
+    uint32_t all;
+};
+
+struct DCSM_COMMON_REGS {
+    union FLSEM_REG FLSEM;
+};
+
+extern volatile struct FLASH_ECC_REGS Flash0EccRegs;
+extern volatile struct DCSM_COMMON_REGS DcsmCommonRegs;
+
+#endif // F28X_PROJECT_H
@@ -0,0 +1,14 @@
+//#############################################################################
+//
+// device.h - Host stand-in for the driverlib device header
+//
+// flash_disk/ includes it but uses nothing from it.
+//
+//#############################################################################
+
+#ifndef DEVICE_H
+#define DEVICE_H
+
+#include "F28x_Project.h"
+
+#endif // DEVICE_H
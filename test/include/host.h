@@ -0,0 +1,49 @@
+//#############################################################################
+//
+// host.h - Force-included ahead of every source of the host test build
+//
+// On the C28x a char is 16 bits, so memcpy, memset and memcmp count 16-bit
+// words and memset stores a 16-bit value. The macros below give the firmware
+// sources the same meaning on the host; test code calling them counts words
+// too. Flash is the sim_flash array of fapi_sim.c, FLASH_ADDR() turns the
+// word addresses used by the firmware into pointers into it.
+//
+//#############################################################################
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+//
+// Flash bank 0 of the F2837xD, word addresses 0x80000 to 0xBFFFF
+//
+#define SIM_FLASH_BASE      0x80000UL
+#define SIM_FLASH_WORDS     0x40000UL
+extern uint16_t sim_flash[SIM_FLASH_WORDS];
+
+#define FLASH_ADDR(a)       (sim_flash + ((a) - SIM_FLASH_BASE))
+
+//
+// ESTOP0 stops the debugger on the target, fapi_sim.c reports it
+//
+void sim_estop(void);
+#define __asm(x)            sim_estop()
+
+static inline void *host_memset(void *d, int v, size_t n)
+{
+    uint16_t *p = d;
+
+    while (n--)
+        *p++ = (uint16_t)v;
+    return d;
+}
+
+#define memcpy(d, s, n)     memcpy((d), (s), (size_t)(n) * 2)
+#define memmove(d, s, n)    memmove((d), (s), (size_t)(n) * 2)
+#define memcmp(a, b, n)     memcmp((a), (b), (size_t)(n) * 2)
+#define memset(d, v, n)     host_memset((d), (v), (n))
+
+#endif // HOST_H
@@ -0,0 +1,22 @@
+//#############################################################################
+//
+// msc_mock.h - Forced in front of usblib/device/usbdmsc.c and
+// device/driverlib/usb.c for the host build of the MSC class
+//
+// The class is built with the C28x layout of the usblib structures, which
+// keep one byte per word, on top of the mocked controller of usb_mock.h.
+// The interrupt intrinsics of the TI compiler are given by scsi_test.c.
+//
+//#############################################################################
+
+#ifndef MSC_MOCK_H
+#define MSC_MOCK_H
+
+#include "usb_mock.h"
+
+#define __TMS320C28XX__
+
+extern uint16_t __disable_interrupts(void);
+extern uint16_t __enable_interrupts(void);
+
+#endif // MSC_MOCK_H
@@ -0,0 +1,83 @@
+//#############################################################################
+//
+// usb_mock.h - Forced in front of device/driverlib/usb.c in place of
+// inc/hw_types.h, so that its register accesses go to a mocked USB
+// controller whose endpoint FIFOs keep the stream of bytes moved through them
+//
+//#############################################################################
+
+#ifndef USB_MOCK_H
+#define USB_MOCK_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define __cregister
+
+//
+// Types and macros of inc/hw_types.h, char is 16 bits wide on the C28x
+//
+#define HW_TYPES_H
+#define uint8_t     uint16_t
+#define int8_t      int16_t
+#define STATUS_S_SUCCESS    (0)
+#define STATUS_E_FAILURE    (-1)
+
+//
+// Kinds of register access
+//
+#define USB_MOCK_32         0   /* HWREG, halves swapped by the bridge */
+#define USB_MOCK_8          1   /* HWREGB */
+#define USB_MOCK_16         2   /* HWREGH */
+#define USB_MOCK_BP         4   /* HWREG_BP */
+
+#define HWREG(x)    (*(volatile uint32_t *)usb_mock_reg((x), USB_MOCK_32))
+#define HWREGH(x)   (*(volatile uint16_t *)usb_mock_reg((x), USB_MOCK_16))
+#define HWREGB(x)   (*(volatile int16_t *)usb_mock_reg((x), USB_MOCK_8))
+#define HWREG_BP(x) (*(volatile uint32_t *)usb_mock_reg((x), USB_MOCK_BP))
+
+#define HWREGBITW(address, mask, value)                                       \
+        (HWREG(address) = (HWREG(address) & ~((uint32_t)1 << mask))           \
+                          | ((uint32_t)value << mask))
+#define HWREGBITHW(address, mask, value)                                      \
+        (HWREGH(address) = (HWREGH(address) & ~((uint16_t)1 << mask))         \
+                           | ((uint16_t)value << mask))
+#define HWREGBITR(address, mask)                                              \
+        ((HWREG(address) & ((uint32_t)1 << mask)) >> mask)
+#define HWREGBITHR(address, mask)                                             \
+        ((HWREGH(address) & ((uint16_t)1 << mask)) >> mask)
+
+//
+// Every FIFO access is a read while usb_mock_rx is set, the bytes come from
+// usb_mock_rx, and a write otherwise, the bytes go to usb_mock_tx. If
+// usb_mock_rx_end is set too the reads stop there and the accesses after
+// them are writes, for a driver that answers a packet in the same call.
+//
+#define USB_MOCK_FIFO_BYTES 256
+
+extern const uint16_t *usb_mock_rx;
+extern const uint16_t *usb_mock_rx_end;
+extern uint16_t usb_mock_tx[USB_MOCK_FIFO_BYTES];
+extern uint32_t usb_mock_tx_bytes;
+extern uint32_t usb_mock_accesses;      /* FIFO accesses */
+extern uint32_t usb_mock_swapped;       /* FIFO accesses without HWREG_BP */
+
+//
+// With usb_mock_tx_slots set, the bulk IN FIFO of endpoint 1 holds that many
+// packets, 1 single-buffered or 2 double-buffered. A packet is queued when
+// TXRDY is set and TXRDY clears at once while a slot is still free, FIFONE
+// shows a packet waiting. usb_mock_in_take() is the host taking the oldest
+// packet off usb_mock_tx, it returns its size or -1 if the FIFO is empty.
+// usb_mock_reset() sets usb_mock_tx_slots back to 0, the registers are then
+// left as the driver wrote them.
+//
+extern uint32_t usb_mock_tx_slots;
+extern uint32_t usb_mock_tx_queued;     /* packets in the IN FIFO */
+
+void *usb_mock_reg(uint32_t addr, int kind);
+void usb_mock_reset(void);
+void usb_mock_sync(void);
+int usb_mock_in_take(void);
+
+#endif // USB_MOCK_H
@@ -0,0 +1,126 @@
+//#############################################################################
+//
+// mount_bench.c - Time to ready of disk_initialize() against the disk size
+//
+// The Makefile builds it once for every disk size, RAM_DISK_SIZE set to 1 to
+// 5 32K-word sectors. Each mount is timed:
+//
+//   no password    nothing to unlock, the disk is scanned for a key packet
+//                  on every mount
+//   record         the unlock record points at the key packet, only that
+//                  packet is checked
+//   no record      a password stored by an older firmware and no key packet
+//                  on the disk: the first mount scans the disk and programs
+//                  the record
+//   after it       the mounts after that one, from the record
+//
+// Times are the fastest of REPEATS mounts in host CPU cycles, plus the time
+// the simulated FSM spent on the record. On the host the scan compares 8-bit
+// chars over half the disk rather than words over all of it, only how the
+// paths grow with the disk size carries over to the target.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define REPEATS         20
+
+extern uint16_t *usb_password;
+
+static uint8_t data[LBLOCK_SIZE];
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+//
+// mount - Cycles one disk_initialize() took
+//
+static uint64_t mount(void)
+{
+    uint64_t t;
+
+    t = cycles();
+    disk_initialize();
+    return cycles() - t;
+}
+
+//
+// forget_record - Store the password again without a record, as an older
+// firmware did
+//
+static void forget_record(void)
+{
+    uint16_t password[0x20];
+
+    memcpy(password, usb_password, 0x20);
+    flash_erase_sector(usb_password, Bzero_16KSector_u32length);
+    flash_program(usb_password, password, 0x20);
+}
+
+int main(void)
+{
+    uint64_t none = ~0ULL, record = ~0ULL, first = ~0ULL, after = ~0ULL;
+    uint64_t t, fsm_us = 0, clock_us;
+    uint32_t n, i;
+
+    sim_reset();
+    disk_initialize();
+    for (n = 0; n < REPEATS; n++) {
+        t = mount();
+        if (t < none)
+            none = t;
+    }
+
+    //
+    // The key packet at the end of the first packet of block 0
+    //
+    memset(data, 0, LBLOCK_SIZE / 2);
+    for (i = 0; i < 8; i++)
+        data[i] = "UNL0CKK:"[i];
+    data[8] = 'k';
+    CHECK(write_blocks(0, 1, data) == 0);
+    disk_flush();
+    for (n = 0; n < REPEATS; n++) {
+        t = mount();
+        if (t < record)
+            record = t;
+    }
+    CHECK(usb_unlocked);
+
+    memset(data, 0, LBLOCK_SIZE / 2);
+    CHECK(write_blocks(0, 1, data) == 0);
+    disk_flush();
+    for (n = 0; n < REPEATS; n++) {
+        forget_record();
+        clock_us = sim_stats.clock_us;
+        t = mount();
+        fsm_us = sim_stats.clock_us - clock_us;
+        if (t < first)
+            first = t;
+        t = mount();
+        if (t < after)
+            after = t;
+    }
+    CHECK(fsm_us > 0);
+
+    printf("mount %3u KB: no password %8llu, record %6llu, "
+           "no record %8llu + %llu us FSM, after it %6llu cycles\n",
+           (unsigned int)(RAM_DISK_SIZE / 1024), (unsigned long long)none,
+           (unsigned long long)record, (unsigned long long)first,
+           (unsigned long long)fsm_us, (unsigned long long)after);
+    return 0;
+}
@@ -0,0 +1,193 @@
+//#############################################################################
+//
+// password_test.c - Host unit tests of the disk password and its unlock
+// record
+//
+// A key packet, "UNL0CKK:" and the password at the start of a packet,
+// written to the disk sets the password and programs the unlock record
+// after it. Each mount then checks only the key packet the record points
+// at. A password set by an older firmware has no record: the first mount
+// scans the disk for a key packet and records what it found.
+//
+// The password and scan code use char, which is 8 bits on the host: the
+// password is stored packed and the scan covers the first half of the disk.
+// The keys are kept in that half and only whether a mount unlocks is
+// checked, not how the password is laid out.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define KEY_OFF         (3 * TRANSFER_SIZE)
+
+extern uint16_t *usb_password;
+
+static uint8_t data[LBLOCK_SIZE];
+static sim_stats_t before;
+
+//
+// write_key - Block lba with the key packet for password at byte KEY_OFF
+//
+static void write_key(uint32_t lba, const char *password)
+{
+    uint32_t i;
+
+    memset(data, 0, LBLOCK_SIZE / 2);
+    for (i = 0; i < 8; i++)
+        data[KEY_OFF + i] = "UNL0CKK:"[i];
+    for (i = 0; password[i]; i++)
+        data[KEY_OFF + 8 + i] = password[i];
+    CHECK(write_blocks(lba, 1, data) == 0);
+    disk_flush();
+}
+
+//
+// mount - Mount the disk locked, return whether it unlocked
+//
+static bool mount(void)
+{
+    usb_unlocked = false;
+    disk_initialize();
+    return usb_unlocked;
+}
+
+//
+// forget_record - Store the password again without a record, as an older
+// firmware did
+//
+static void forget_record(void)
+{
+    uint16_t password[0x20];
+
+    memcpy(password, usb_password, 0x20);
+    flash_erase_sector(usb_password, Bzero_16KSector_u32length);
+    flash_program(usb_password, password, 0x20);
+    CHECK(usb_password[0x20] == 0xFFFF);
+}
+
+static void start(void)
+{
+    sim_reset();
+    disk_initialize();
+    CHECK(usb_unlocked);
+}
+
+//
+// Without a password the disk mounts unlocked and no record is programmed
+//
+static void test_no_password(void)
+{
+    start();
+    before = sim_stats;
+    CHECK(mount());
+    CHECK(mount());
+    CHECK(sim_stats.programs == before.programs);
+    CHECK(usb_password[0x20] == 0xFFFF);
+}
+
+//
+// A key packet sets the password and its record, every later mount unlocks
+// from the record without programming anything
+//
+static void test_record(void)
+{
+    start();
+    write_key(5, "secret");
+    CHECK(usb_password[0] != 0xFFFF);
+    CHECK(usb_password[0x20] != 0xFFFF);
+    before = sim_stats;
+    CHECK(mount());
+    CHECK(mount());
+    CHECK(sim_stats.programs == before.programs);
+
+    //
+    // Once the key packet is overwritten the disk mounts locked
+    //
+    memset(data, 0, LBLOCK_SIZE / 2);
+    CHECK(write_blocks(5, 1, data) == 0);
+    disk_flush();
+    before = sim_stats;
+    CHECK(!mount());
+    CHECK(sim_stats.programs == before.programs);
+}
+
+//
+// Only the newest key packet counts. The record points at it, a scan of the
+// disk would have found the older one first.
+//
+static void test_newest_key(void)
+{
+    start();
+    write_key(3, "one");
+    write_key(30, "two");
+    CHECK(mount());
+    CHECK(mount());
+
+    forget_record();
+    CHECK(!mount());
+}
+
+//
+// A password without a record is found by a scan once, then the record is
+// programmed and later mounts use it
+//
+static void test_legacy(void)
+{
+    start();
+    write_key(7, "legacy");
+    forget_record();
+
+    before = sim_stats;
+    CHECK(mount());
+    CHECK(sim_stats.programs == before.programs + 1);
+    CHECK(usb_password[0x20] != 0xFFFF);
+
+    before = sim_stats;
+    CHECK(mount());
+    CHECK(mount());
+    CHECK(sim_stats.programs == before.programs);
+}
+
+//
+// With no key packet left on the disk the scan records that there is none
+// and the disk stays locked without scanning again
+//
+static void test_legacy_no_key(void)
+{
+    start();
+    write_key(7, "legacy");
+    memset(data, 0, LBLOCK_SIZE / 2);
+    CHECK(write_blocks(7, 1, data) == 0);
+    disk_flush();
+    forget_record();
+
+    before = sim_stats;
+    CHECK(!mount());
+    CHECK(sim_stats.programs == before.programs + 1);
+
+    before = sim_stats;
+    CHECK(!mount());
+    CHECK(sim_stats.programs == before.programs);
+
+    //
+    // A key packet written later still unlocks it
+    //
+    usb_unlocked = true;
+    write_key(9, "legacy");
+    CHECK(mount());
+}
+
+int main(void)
+{
+    test_no_password();
+    test_record();
+    test_newest_key();
+    test_legacy();
+    test_legacy_no_key();
+    printf("password_test: ok\n");
+    return 0;
+}
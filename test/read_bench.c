@@ -0,0 +1,192 @@
+//#############################################################################
+//
+// read_bench.c - Cost of the READ(10) data path, the old one media call per
+// 64-byte packet against whole blocks read into the staging buffer
+//
+// The old path is the disk_read() the MSC class used to call for every
+// packet: it worked out the flash address of the packet and unpacked its 32
+// words into one byte per word. The new path reads MSC_BLOCK_BUFFER_SIZE
+// bytes of whole blocks with one disk_read() call and the packets are taken
+// out of the staging buffer. Both go through a function pointer, as the
+// class calls the media, and are timed with and without taking every packet
+// a byte at a time into a stand-in for the endpoint FIFO. Times are host CPU
+// cycles, only the ratio between the two paths carries over to the target.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+#define STAGING_SIZE    0x1000      /* MSC_BLOCK_BUFFER_SIZE */
+#define NBLOCKS         (RAM_DISK_SIZE / LBLOCK_SIZE)
+#define SECTOR_BLOCKS   (SECTOR_SIZE * 2 / LBLOCK_SIZE)
+#define PASSES          20
+
+static uint16_t packet[TRANSFER_SIZE];
+static uint16_t staging[STAGING_SIZE / 2];
+static uint8_t run[SECTOR_BLOCKS][LBLOCK_SIZE];
+static volatile uint8_t fifo;
+static uint32_t media_calls;
+static int send_packets;
+
+static uint64_t cycles(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __builtin_ia32_rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+//
+// old_disk_read - disk_read() before whole-block reads, len in packets
+//
+static unsigned int old_disk_read(uint32_t lba, uint16_t *buf,
+                                  uint32_t off, uint32_t len)
+{
+    uint32_t start, i;
+    uint16_t *src;
+
+    len = len * TRANSFER_SIZE;
+    start = lba * LBLOCK_SIZE + off;
+    if (start + len <= RAM_DISK_SIZE) {
+        start = start / 2;
+        src = ram_disk + start;
+        for (i = 0; i < len; i += 2) {
+            uint16_t data = src[i / 2];
+            buf[i] = data & 0xFF;
+            buf[i + 1] = data >> 8;
+        }
+    }
+    media_calls++;
+    return len;
+}
+
+static unsigned int new_disk_read(uint32_t lba, uint16_t *buf, uint32_t count)
+{
+    media_calls++;
+    return disk_read(lba, buf, count);
+}
+
+static unsigned int (*volatile old_read)(uint32_t, uint16_t *, uint32_t,
+                                         uint32_t) = old_disk_read;
+static unsigned int (*volatile new_read)(uint32_t, uint16_t *,
+                                         uint32_t) = new_disk_read;
+
+//
+// Packet out of one byte per word, and out of bytes packed two per word
+//
+static void put_unpacked(const uint16_t *p)
+{
+    uint32_t i;
+
+    for (i = 0; i < TRANSFER_SIZE; i++)
+        fifo = p[i];
+}
+
+static void put_packed(const uint16_t *p)
+{
+    uint32_t i;
+
+    for (i = 0; i < TRANSFER_SIZE; i++)
+        fifo = p[i / 2] >> ((i & 1) * 8);
+}
+
+static void read_old(void)
+{
+    uint32_t lba, off;
+
+    for (lba = 0; lba < NBLOCKS; lba++) {
+        for (off = 0; off < LBLOCK_SIZE; off += TRANSFER_SIZE) {
+            old_read(lba, packet, off, 1);
+            if (send_packets)
+                put_unpacked(packet);
+        }
+    }
+}
+
+static void read_new(void)
+{
+    uint32_t lba, n, off;
+
+    for (lba = 0; lba < NBLOCKS; lba += n) {
+        n = STAGING_SIZE / LBLOCK_SIZE;
+        if (n > NBLOCKS - lba)
+            n = NBLOCKS - lba;
+        new_read(lba, staging, n);
+        for (off = 0; send_packets && off < n * LBLOCK_SIZE;
+             off += TRANSFER_SIZE)
+            put_packed(staging + off / 2);
+    }
+}
+
+static double best_cycles(void (*path)(void))
+{
+    uint64_t best = ~0ULL, t;
+    uint32_t pass;
+
+    path();
+    for (pass = 0; pass < PASSES; pass++) {
+        t = cycles();
+        path();
+        t = cycles() - t;
+        if (t < best)
+            best = t;
+    }
+    return (double)best / (RAM_DISK_SIZE / 4096);
+}
+
+static void report(const char *what, void (*path)(void))
+{
+    double media, total;
+
+    media_calls = 0;
+    send_packets = 0;
+    media = best_cycles(path);
+    send_packets = 1;
+    total = best_cycles(path);
+    printf("read %-20s %5.1f media calls, %7.0f cycles in the media, "
+           "%7.0f with the packets, per 4 KB\n", what,
+           (double)media_calls / (2 * (PASSES + 1)) / (RAM_DISK_SIZE / 4096),
+           media, total);
+}
+
+int main(void)
+{
+    uint32_t lba, i, n;
+
+    srand(11);
+    sim_reset();
+    disk_initialize();
+    for (lba = 0; lba < NBLOCKS; lba += SECTOR_BLOCKS) {
+        for (n = 0; n < SECTOR_BLOCKS; n++) {
+            for (i = 0; i < LBLOCK_SIZE; i++)
+                run[n][i] = rand();
+            run[n][0] = 0;
+        }
+        CHECK(write_blocks(lba, SECTOR_BLOCKS, run[0]) == 0);
+    }
+    disk_flush();
+
+    //
+    // Both paths read the same data
+    //
+    new_read(3, staging, 1);
+    for (i = 0; i < LBLOCK_SIZE; i += TRANSFER_SIZE) {
+        old_read(3, packet, i, 1);
+        for (n = 0; n < TRANSFER_SIZE; n++)
+            CHECK(packet[n] ==
+                  ((staging[(i + n) / 2] >> ((n & 1) * 8)) & 0xFF));
+    }
+
+    report("per packet (old)", read_old);
+    report("whole blocks (new)", read_new);
+    return 0;
+}
@@ -0,0 +1,444 @@
+//#############################################################################
+//
+// scsi_test.c - Host unit tests of the SCSI commands of the MSC class: the
+// vital product data pages of INQUIRY, Read Capacity 16, the Caching mode
+// page, SYNCHRONIZE CACHE and the end of a data phase that is shorter than
+// the host asked for
+//
+// usblib/device/usbdmsc.c is built against msc_mock.h. A CBW is fed to the
+// bulk OUT handler through the mocked FIFO and every bulk IN interrupt after
+// it takes the next packet out of the FIFO, the way the host would, until
+// the CSW has gone out. The media is a stub with a fixed geometry.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_usb.h"
+#include "driverlib/usb.h"
+#include "usblib/usblib.h"
+#include "usblib/usbmsc.h"
+#include "usblib/device/usbdevice.h"
+#include "usblib/device/usbdmsc.h"
+
+#define CHECK(c) \
+    do { if (!(c)) fail(__FILE__, __LINE__, #c); } while (0)
+
+#define EP              USB_EP_1
+#define CBW_SIZE        31
+#define CSW_SIZE        13
+#define MAX_PACKET      64
+#define BLOCKS          640
+#define BLOCK_SIZE      4096
+#define ERASE_BLOCKS    8
+#define BUFFER_SIZE     0x1000
+#define RING_SIZE       0x400
+
+extern const tCustomHandlers g_sMSCHandlers;
+
+static uint16_t data[USB_MOCK_FIFO_BYTES];
+static uint32_t data_bytes;
+static uint16_t csw[CSW_SIZE];
+static uint16_t block_buffer[BUFFER_SIZE / 2];
+static uint16_t write_ring[RING_SIZE / 2];
+
+static void fail(const char *file, int line, const char *what)
+{
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+//
+// Intrinsics of the TI compiler and the parts of the device controller
+// driver the class calls
+//
+uint16_t __disable_interrupts(void) { return 0; }
+uint16_t __enable_interrupts(void) { return 0; }
+void __eallow(void) { }
+void __edis(void) { }
+void USBDCDInit(uint32_t ui32Index, tDeviceInfo *psDevice, void *pvData) { }
+void USBDCDDeviceInfoInit(uint32_t ui32Index, tDeviceInfo *psDevice) { }
+void USBDCDTerm(uint32_t ui32Index) { }
+void USBDCDStallEP0(uint32_t ui32Index) { }
+void USBDCDSendDataEP0(uint32_t ui32Index, uint8_t *pui8Data,
+                       uint32_t ui32Size) { }
+
+//
+// The media
+//
+static void *media_open(uint32_t drive) { return (void *)1; }
+static void media_close(void *drive) { }
+static uint32_t media_read(void *drive, uint16_t *buf, uint32_t lba,
+                           uint32_t count) { return count * BLOCK_SIZE; }
+static uint32_t media_write(void *drive, uint16_t *buf, uint32_t lba,
+                            uint32_t off, uint32_t count)
+{
+    return count * MAX_PACKET;
+}
+static uint32_t media_blocks(void *drive) { return BLOCKS; }
+static uint32_t media_block_size(void *drive) { return BLOCK_SIZE; }
+static uint32_t media_flush(void *drive) { return 0; }
+static void media_trim(void *drive, uint32_t lba, uint32_t count) { }
+static uint32_t media_erase_blocks(void *drive) { return ERASE_BLOCKS; }
+
+//
+// String descriptors, one byte per word as on the C28x
+//
+static const uint16_t lang_string[] = { 4, USB_DTYPE_STRING, 0x09, 0x04 };
+static const uint16_t serial_string[] = {
+    10, USB_DTYPE_STRING, 'S', 0, 'N', 0, '4', 0, '2', 0
+};
+static const unsigned char * const strings[] = {
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)lang_string,
+    (const unsigned char *)serial_string
+};
+
+//
+// A media with a write cache and UNMAP, and one with neither
+//
+static tUSBDMSCDevice cached_device = {
+    0x1cbe, 0x0003, "TI      ", "Mass Storage    ", "1.00", 500,
+    USB_CONF_ATTR_SELF_PWR, strings, 4,
+    {
+        media_open, media_close, media_read, media_write, media_blocks,
+        media_block_size, media_flush, 0, media_trim, media_erase_blocks
+    },
+    0, block_buffer, BUFFER_SIZE, write_ring, RING_SIZE
+};
+
+static tUSBDMSCDevice plain_device = {
+    0x1cbe, 0x0003, "TI      ", "Mass Storage    ", "1.00", 500,
+    USB_CONF_ATTR_SELF_PWR, strings, 4,
+    {
+        media_open, media_close, media_read, media_write, media_blocks,
+        media_block_size, 0, 0, 0, 0
+    },
+    0, block_buffer, BUFFER_SIZE, write_ring, RING_SIZE
+};
+
+static tUSBDMSCDevice *device;
+
+//
+// in_packet - Bulk IN interrupt after the host has taken the packet in the
+// FIFO. Returns the size of the packet loaded next, -1 if there is none.
+//
+static int in_packet(void)
+{
+    usb_mock_reset();
+    g_sMSCHandlers.pfnEndpointHandler(device, 1 << USBEPToIndex(EP));
+    usb_mock_sync();
+    if (!(HWREGB(USBA_BASE + USB_O_TXCSRL1) & USB_TXCSRL1_TXRDY))
+        return -1;
+    return usb_mock_tx_bytes;
+}
+
+//
+// send_cbw - Hand the bulk OUT handler a CBW with the command block cb of
+// cb_size bytes, for a Data-In phase of length bytes
+//
+static void send_cbw(const uint8_t *cb, uint32_t cb_size, uint32_t length)
+{
+    static uint16_t cbw[CBW_SIZE];
+    uint32_t i;
+
+    memset(cbw, 0, sizeof(cbw));
+    cbw[0] = 'U';
+    cbw[1] = 'S';
+    cbw[2] = 'B';
+    cbw[3] = 'C';
+    cbw[4] = 0x5A;
+    for (i = 0; i < 4; i++)
+        cbw[8 + i] = (length >> (8 * i)) & 0xFF;
+    cbw[12] = CBWFLAGS_DIR_IN;
+    cbw[14] = cb_size;
+    for (i = 0; i < cb_size; i++)
+        cbw[15 + i] = cb[i];
+
+    usb_mock_reset();
+    HWREGH(USBA_BASE + USB_O_RXCSRL1) = USB_RXCSRL1_RXRDY;
+    HWREGH(USBA_BASE + USB_O_COUNT0 + EP) = CBW_SIZE;
+    usb_mock_rx = cbw;
+    usb_mock_rx_end = cbw + CBW_SIZE;
+    g_sMSCHandlers.pfnEndpointHandler(device, 0x10000 << USBEPToIndex(EP));
+    usb_mock_sync();
+    CHECK(usb_mock_rx == usb_mock_rx_end);
+}
+
+//
+// command - Send a CBW with send_cbw() and run the data phase. The data sent
+// is left in data and the CSW in csw, the number of zero-length packets that
+// ended the data phase is returned.
+//
+static uint32_t command(const uint8_t *cb, uint32_t cb_size, uint32_t length)
+{
+    uint32_t zlps = 0;
+    int size;
+
+    send_cbw(cb, cb_size, length);
+
+    //
+    // Data packets up to a short one, then the CSW
+    //
+    data_bytes = 0;
+    size = usb_mock_tx_bytes;
+    for (;;) {
+        if (size == CSW_SIZE && usb_mock_tx[0] == 'U' &&
+            usb_mock_tx[3] == 'S')
+            break;
+        CHECK(size >= 0);
+        CHECK(data_bytes + size <= USB_MOCK_FIFO_BYTES);
+        if (size == 0)
+            zlps++;
+        memcpy(data + data_bytes, usb_mock_tx, size * sizeof(uint16_t));
+        data_bytes += size;
+        size = in_packet();
+    }
+    memcpy(csw, usb_mock_tx, sizeof(csw));
+    CHECK(csw[4] == 0x5A);
+    CHECK(in_packet() == -1);
+    return zlps;
+}
+
+static uint32_t csw_residue(void)
+{
+    return csw[8] | csw[9] << 8 | (uint32_t)csw[10] << 16 |
+           (uint32_t)csw[11] << 24;
+}
+
+static uint32_t vpd(uint8_t page, uint32_t alloc, uint32_t length)
+{
+    uint8_t cb[6] = { SCSI_INQUIRY_CMD, SCSI_INQ_EVPD, page, alloc >> 8,
+                      alloc & 0xFF, 0 };
+
+    return command(cb, sizeof(cb) / sizeof(cb[0]), length);
+}
+
+static void check_sense(uint8_t key, uint8_t asc)
+{
+    uint8_t cb[6] = { SCSI_REQUEST_SENSE, 0, 0, 0, SCSI_REQUEST_SENSE_SZ, 0 };
+
+    command(cb, 6, SCSI_REQUEST_SENSE_SZ);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == SCSI_REQUEST_SENSE_SZ);
+    CHECK(data[2] == key);
+    CHECK(data[12] == asc);
+}
+
+static void use(tUSBDMSCDevice *psDevice)
+{
+    device = psDevice;
+    usb_mock_reset();
+    USBDMSCInit(0, psDevice);
+}
+
+static void test_supported_pages(void)
+{
+    use(&cached_device);
+    CHECK(vpd(SCSI_VPD_SUPPORTED, 255, 255) == 0);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == 9);
+    CHECK(csw_residue() == 255 - 9);
+    CHECK(data[1] == SCSI_VPD_SUPPORTED);
+    CHECK(data[3] == 5);
+    CHECK(data[4] == SCSI_VPD_SUPPORTED);
+    CHECK(data[5] == SCSI_VPD_SERIAL);
+    CHECK(data[6] == SCSI_VPD_BLOCK_LIMITS);
+    CHECK(data[7] == SCSI_VPD_BDC);
+    CHECK(data[8] == SCSI_VPD_LBP);
+
+    //
+    // Logical Block Provisioning only with UNMAP
+    //
+    use(&plain_device);
+    vpd(SCSI_VPD_SUPPORTED, 255, 255);
+    CHECK(data_bytes == 8);
+    CHECK(data[3] == 4);
+}
+
+static void test_serial(void)
+{
+    use(&cached_device);
+    vpd(SCSI_VPD_SERIAL, 255, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == 8);
+    CHECK(data[1] == SCSI_VPD_SERIAL);
+    CHECK(data[3] == 4);
+    CHECK(data[4] == 'S' && data[5] == 'N' && data[6] == '4' &&
+          data[7] == '2');
+}
+
+static void test_block_limits(void)
+{
+    uint32_t descriptors = (BUFFER_SIZE - SCSI_UNMAP_HEADER_SZ) /
+                           SCSI_UNMAP_DESC_SZ;
+
+    use(&cached_device);
+    vpd(SCSI_VPD_BLOCK_LIMITS, 255, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == SCSI_VPD_BLOCK_LIMITS_SZ);
+    CHECK(csw_residue() == 255 - SCSI_VPD_BLOCK_LIMITS_SZ);
+    CHECK(data[1] == SCSI_VPD_BLOCK_LIMITS);
+    CHECK(data[3] == SCSI_VPD_BLOCK_LIMITS_SZ - 4);
+    CHECK((data[6] << 8 | data[7]) == ERASE_BLOCKS);
+    CHECK(data[20] == 0xFF && data[21] == 0xFF && data[22] == 0xFF &&
+          data[23] == 0xFF);
+    CHECK((data[26] << 8 | data[27]) == descriptors);
+    CHECK((data[30] << 8 | data[31]) == ERASE_BLOCKS);
+    CHECK(data[32] == SCSI_VPD_UGAVALID);
+
+    use(&plain_device);
+    vpd(SCSI_VPD_BLOCK_LIMITS, 255, 255);
+    CHECK(data_bytes == SCSI_VPD_BLOCK_LIMITS_SZ);
+    CHECK((data[6] << 8 | data[7]) == 0);
+    CHECK(data[20] == 0 && data[27] == 0 && data[32] == 0);
+}
+
+static void test_characteristics(void)
+{
+    use(&cached_device);
+    vpd(SCSI_VPD_BDC, 255, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == SCSI_VPD_BDC_SZ);
+    CHECK(data[1] == SCSI_VPD_BDC);
+    CHECK((data[4] << 8 | data[5]) == SCSI_VPD_NON_ROTATING);
+}
+
+static void test_provisioning(void)
+{
+    use(&cached_device);
+    vpd(SCSI_VPD_LBP, 255, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == 8);
+    CHECK(data[1] == SCSI_VPD_LBP);
+    CHECK(data[5] == SCSI_VPD_LBP_LBPU);
+
+    //
+    // Not there without UNMAP: the data phase is stalled
+    //
+    use(&plain_device);
+    vpd(SCSI_VPD_LBP, 255, 255);
+    CHECK(csw[12] == 1);
+    CHECK(data_bytes == 0);
+    CHECK(csw_residue() == 255);
+    check_sense(SCSI_RS_KEY_ILGL_RQST, SCSI_RS_INVALID_CDB);
+}
+
+static void test_unknown_page(void)
+{
+    use(&cached_device);
+    vpd(0x83, 255, 255);
+    CHECK(csw[12] == 1);
+    CHECK(data_bytes == 0);
+    check_sense(SCSI_RS_KEY_ILGL_RQST, SCSI_RS_INVALID_CDB);
+}
+
+//
+// A response that ends on a packet boundary before the transfer length of
+// the CBW is ended by a zero-length packet, one that is short or that fills
+// the transfer is not
+//
+static void test_short_data_phase(void)
+{
+    use(&cached_device);
+    CHECK(vpd(SCSI_VPD_BLOCK_LIMITS, 255, 255) == 1);
+    CHECK(vpd(SCSI_VPD_BLOCK_LIMITS, 255, MAX_PACKET) == 0);
+    CHECK(csw_residue() == 0);
+    CHECK(vpd(SCSI_VPD_BLOCK_LIMITS, MAX_PACKET, 255) == 1);
+    CHECK(vpd(SCSI_VPD_BLOCK_LIMITS, 16, 255) == 0);
+    CHECK(data_bytes == 16);
+    CHECK(csw_residue() == 255 - 16);
+    CHECK(vpd(SCSI_VPD_SUPPORTED, 255, 255) == 0);
+}
+
+static void test_read_capacity_16(void)
+{
+    uint8_t cb[16] = { SCSI_SERVICE_ACTION_IN, SCSI_SA_READ_CAPACITY_16,
+                       0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 255, 0, 0 };
+
+    use(&cached_device);
+    command(cb, 16, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == SCSI_READ_CAPACITY_16_SZ);
+    CHECK(csw_residue() == 255 - SCSI_READ_CAPACITY_16_SZ);
+    CHECK((data[6] << 8 | data[7]) == BLOCKS - 1);
+    CHECK((data[9] << 16 | data[10] << 8 | data[11]) == BLOCK_SIZE);
+    CHECK(data[14] == SCSI_RC16_LBPME);
+
+    use(&plain_device);
+    command(cb, 16, 255);
+    CHECK(data_bytes == SCSI_READ_CAPACITY_16_SZ);
+    CHECK(data[14] == 0);
+}
+
+//
+// WCE is reported only when the media has a write cache to flush
+//
+static void test_caching_page(void)
+{
+    uint8_t cb[6] = { SCSI_MODE_SENSE_6, 0, SCSI_MS_PC_CACHING >> 16, 0,
+                      255, 0 };
+
+    use(&cached_device);
+    command(cb, 6, 255);
+    CHECK(csw[12] == 0);
+    CHECK(data_bytes == 4 + SCSI_MS_CACHING_SZ);
+    CHECK(data[0] == 3 + SCSI_MS_CACHING_SZ);
+    CHECK(data[4] == SCSI_MS_PC_CACHING >> 16);
+    CHECK(data[6] == SCSI_MS_CACHING_WCE);
+
+    use(&plain_device);
+    command(cb, 6, 255);
+    CHECK(data_bytes == 4 + SCSI_MS_CACHING_SZ);
+    CHECK(data[6] == 0);
+}
+
+//
+// SYNCHRONIZE CACHE waits for the main loop to write the cache back. Sent
+// with a data phase, that phase is stalled and is all residue.
+//
+static void test_synchronize_cache(void)
+{
+    uint8_t cb[10] = { SCSI_SYNCHRONIZE_CACHE };
+
+    use(&cached_device);
+    send_cbw(cb, 10, 0);
+    CHECK(usb_mock_tx_bytes == 0);
+    USBDMSCWriteProcess(device);
+    usb_mock_sync();
+    CHECK(usb_mock_tx_bytes == CSW_SIZE);
+    CHECK(usb_mock_tx[12] == 0);
+    CHECK(in_packet() == -1);
+
+    send_cbw(cb, 10, 8);
+    CHECK(usb_mock_tx_bytes == 0);
+    CHECK(!(HWREGB(USBA_BASE + USB_O_TXCSRL1) & USB_TXCSRL1_STALL));
+    USBDMSCWriteProcess(device);
+    usb_mock_sync();
+    CHECK(usb_mock_tx_bytes == 0);
+    CHECK(HWREGB(USBA_BASE + USB_O_TXCSRL1) & USB_TXCSRL1_STALL);
+    CHECK(in_packet() == CSW_SIZE);
+    memcpy(csw, usb_mock_tx, sizeof(csw));
+    CHECK(csw[12] == 0);
+    CHECK(csw_residue() == 8);
+    CHECK(in_packet() == -1);
+}
+
+int main(void)
+{
+    test_supported_pages();
+    test_serial();
+    test_block_limits();
+    test_characteristics();
+    test_provisioning();
+    test_unknown_page();
+    test_short_data_phase();
+    test_read_capacity_16();
+    test_synchronize_cache();
+    test_caching_page();
+    printf("scsi_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,72 @@
+//#############################################################################
+//
+// testlib.c - Helpers shared by the host tests of the flash disk
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "testlib.h"
+
+bool usb_unlocked;
+
+void test_fail(const char *file, int line, const char *what)
+{
+    printf("%s:%d: check failed: %s\n", file, line, what);
+    exit(1);
+}
+
+void pack(uint16_t *dst, const uint8_t *src, uint32_t bytes)
+{
+    uint32_t i;
+
+    for (i = 0; i < bytes; i += 2)
+        dst[i / 2] = src[i] | src[i + 1] << 8;
+}
+
+void unpack(uint8_t *dst, const uint16_t *src, uint32_t bytes)
+{
+    uint32_t i;
+
+    for (i = 0; i < bytes; i += 2) {
+        dst[i] = src[i / 2] & 0xFF;
+        dst[i + 1] = src[i / 2] >> 8;
+    }
+}
+
+unsigned int write_blocks(uint32_t lba, uint32_t count, const uint8_t *data)
+{
+    uint16_t packet[TRANSFER_SIZE / 2];
+    uint32_t n, off;
+    unsigned int ret, status = 0;
+
+    disk_write_start(lba, count);
+    for (n = 0; n < count; n++, data += LBLOCK_SIZE) {
+        for (off = 0; off < LBLOCK_SIZE; off += TRANSFER_SIZE) {
+            pack(packet, data + off, TRANSFER_SIZE);
+            while ((ret = disk_write(lba + n, packet, off, 1)) == 0)
+                disk_poll();
+            if (ret == DISK_WRITE_FAILED)
+                status = DISK_WRITE_FAILED;
+        }
+    }
+    return status;
+}
+
+void read_blocks(uint32_t lba, uint32_t count, uint8_t *data)
+{
+    static uint16_t buf[LBLOCK_SIZE / 2];
+
+    for (; count; count--, lba++, data += LBLOCK_SIZE) {
+        disk_read(lba, buf, 1);
+        unpack(data, buf, LBLOCK_SIZE);
+    }
+}
+
+uint32_t disk_blocks(void)
+{
+    unsigned int n;
+
+    disk_ioctl(0, GET_SECTOR_COUNT, &n);
+    return n;
+}
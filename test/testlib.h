@@ -0,0 +1,42 @@
+//#############################################################################
+//
+// testlib.h - Helpers shared by the host tests of the flash disk
+//
+//#############################################################################
+
+#ifndef TESTLIB_H
+#define TESTLIB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <flash_disk/flashdisk.h>
+
+#define LBLOCK_SIZE     FLASHDISK_LOGICAL_BLOCK_SIZE
+
+//
+// Unlock state of the disk, owned by geekcon_main.c on the target
+//
+extern bool usb_unlocked;
+
+#define CHECK(c) \
+    do { if (!(c)) test_fail(__FILE__, __LINE__, #c); } while (0)
+
+void test_fail(const char *file, int line, const char *what);
+
+//
+// Host bytes <-> data packed two bytes per word, low byte first
+//
+void pack(uint16_t *dst, const uint8_t *src, uint32_t bytes);
+void unpack(uint8_t *dst, const uint16_t *src, uint32_t bytes);
+
+//
+// Write count logical blocks at lba the way the MSC class does, one packet
+// at a time with disk_poll() run while the disk holds data off. Returns 0 or
+// DISK_WRITE_FAILED if a packet was refused.
+//
+unsigned int write_blocks(uint32_t lba, uint32_t count, const uint8_t *data);
+void read_blocks(uint32_t lba, uint32_t count, uint8_t *data);
+
+uint32_t disk_blocks(void);
+
+#endif // TESTLIB_H
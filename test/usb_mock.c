@@ -0,0 +1,164 @@
+//#############################################################################
+//
+// usb_mock.c - Mocked USB controller registers for the host build of
+// device/driverlib/usb.c
+//
+// Registers are plain memory. Endpoint FIFO accesses are turned into a byte
+// stream the way the controller sees them: a HWREG_BP access moves four
+// bytes lowest first, HWREGH two and HWREGB one. A plain HWREG access has
+// its 16-bit halves swapped by the byte peripheral bridge.
+//
+//#############################################################################
+
+#include <assert.h>
+#include <string.h>
+#include "inc/hw_memmap.h"
+#include "inc/hw_usb.h"
+
+const uint16_t *usb_mock_rx;
+const uint16_t *usb_mock_rx_end;
+uint16_t usb_mock_tx[USB_MOCK_FIFO_BYTES];
+uint32_t usb_mock_tx_bytes;
+uint32_t usb_mock_accesses;
+uint32_t usb_mock_swapped;
+uint32_t usb_mock_tx_slots;
+uint32_t usb_mock_tx_queued;
+
+static uint32_t usb_regs[0x1000];
+static uint32_t other_reg;
+static uint32_t fifo_slot;
+static int fifo_pending = -1;       /* kind of the FIFO write in fifo_slot */
+static uint32_t tx_sizes[2];        /* bytes of the packets queued */
+static uint32_t tx_queued_bytes;
+static int tx_holding;              /* TXRDY is held for a queued packet */
+
+static uint32_t kind_bytes(int kind)
+{
+    return (kind == USB_MOCK_32) ? 4 : (uint32_t)kind;
+}
+
+static uint32_t bridge_swap(uint32_t v)
+{
+    return (v >> 16) | (v << 16);
+}
+
+//
+// tx_update - TXRDY is held while every slot of the IN FIFO is taken,
+// FIFONE set while any is
+//
+static void tx_update(void)
+{
+    uint32_t *csrl = &usb_regs[USB_O_TXCSRL1];
+
+    if (usb_mock_tx_queued < usb_mock_tx_slots) {
+        *csrl &= ~USB_TXCSRL1_TXRDY;
+        tx_holding = 0;
+    }
+    if (usb_mock_tx_queued)
+        *csrl |= USB_TXCSRL1_FIFONE;
+    else
+        *csrl &= ~USB_TXCSRL1_FIFONE;
+}
+
+//
+// tx_settle - Queue the packet the driver has just set TXRDY for
+//
+static void tx_settle(void)
+{
+    if (!usb_mock_tx_slots)
+        return;
+    if ((usb_regs[USB_O_TXCSRL1] & USB_TXCSRL1_TXRDY) && !tx_holding) {
+        assert(usb_mock_tx_queued < usb_mock_tx_slots);
+        tx_sizes[usb_mock_tx_queued++] = usb_mock_tx_bytes - tx_queued_bytes;
+        tx_queued_bytes = usb_mock_tx_bytes;
+        tx_holding = 1;
+    }
+    tx_update();
+}
+
+//
+// usb_mock_sync - Take the last FIFO write into usb_mock_tx. A write only
+// lands in fifo_slot once usb_mock_reg() has returned, so it is picked up
+// by the next access or by this. So is a TXRDY just set.
+//
+void usb_mock_sync(void)
+{
+    uint32_t i, v = fifo_slot;
+
+    if (fifo_pending >= 0) {
+        if (fifo_pending == USB_MOCK_32)
+            v = bridge_swap(v);
+        for (i = 0; i < kind_bytes(fifo_pending); i++) {
+            assert(usb_mock_tx_bytes < USB_MOCK_FIFO_BYTES);
+            usb_mock_tx[usb_mock_tx_bytes++] = (v >> (8 * i)) & 0xFF;
+        }
+        fifo_pending = -1;
+    }
+    tx_settle();
+}
+
+int usb_mock_in_take(void)
+{
+    uint32_t size;
+
+    usb_mock_sync();
+    if (!usb_mock_tx_queued)
+        return -1;
+    size = tx_sizes[0];
+    tx_sizes[0] = tx_sizes[1];
+    usb_mock_tx_queued--;
+    memmove(usb_mock_tx, usb_mock_tx + size,
+            (usb_mock_tx_bytes - size) * sizeof(usb_mock_tx[0]));
+    usb_mock_tx_bytes -= size;
+    tx_queued_bytes -= size;
+    tx_update();
+    return size;
+}
+
+void *usb_mock_reg(uint32_t addr, int kind)
+{
+    uint32_t off = addr - USBA_BASE, i;
+
+    usb_mock_sync();
+
+    //
+    // Other peripherals, the clock gating of SysCtl, take writes and read
+    // back 0
+    //
+    if (addr < USBA_BASE || off >= sizeof(usb_regs) / sizeof(usb_regs[0])) {
+        other_reg = 0;
+        return &other_reg;
+    }
+    if (off < USB_O_FIFO0 || off > USB_O_FIFO15)
+        return &usb_regs[off];
+
+    usb_mock_accesses++;
+    if (kind == USB_MOCK_32)
+        usb_mock_swapped++;
+    fifo_slot = 0;
+    if (usb_mock_rx && (!usb_mock_rx_end || usb_mock_rx < usb_mock_rx_end)) {
+        for (i = 0; i < kind_bytes(kind); i++)
+            fifo_slot |= (uint32_t)(*usb_mock_rx++ & 0xFF) << (8 * i);
+        if (kind == USB_MOCK_32)
+            fifo_slot = bridge_swap(fifo_slot);
+    } else {
+        fifo_pending = kind;
+    }
+    return &fifo_slot;
+}
+
+void usb_mock_reset(void)
+{
+    memset(usb_regs, 0, sizeof(usb_regs));
+    memset(usb_mock_tx, 0, sizeof(usb_mock_tx));
+    usb_mock_rx = 0;
+    usb_mock_rx_end = 0;
+    usb_mock_tx_bytes = 0;
+    usb_mock_accesses = 0;
+    usb_mock_swapped = 0;
+    usb_mock_tx_slots = 0;
+    usb_mock_tx_queued = 0;
+    tx_queued_bytes = 0;
+    tx_holding = 0;
+    fifo_pending = -1;
+}
@@ -0,0 +1,97 @@
+//#############################################################################
+//
+// verify_bench.c - Cost of verifying programmed flash, per 128-bit chunk
+// (FLASHDISK_SECTOR_VERIFY 0) or once per range (FLASHDISK_SECTOR_VERIFY 1)
+//
+// Writes the whole disk in sector-sized runs, which stream into erased
+// flash, then single blocks with a flush after each, which go through the
+// sector write-back. The verify work the simulated API saw, and the
+// checksums the disk keeps of streamed sectors itself, are turned into time
+// with the assumed costs below.
+//
+//#############################################################################
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <flash_disk/flashdisk.h>
+#include "fapi_sim.h"
+#include "testlib.h"
+
+//
+// Assumed costs at 200 MHz: the call into the flash API, reading one word
+// from flash with its wait states for the verify or the checksum, and
+// adding one word of a packet in RAM to the checksum of a streamed sector
+//
+#define VERIFY_CALL_NS      1000.0
+#define VERIFY_WORD_NS      20.0
+#define CHECKSUM_WORD_NS    40.0
+#define RUNNING_WORD_NS     10.0
+
+#define NBLOCKS             (RAM_DISK_SIZE / LBLOCK_SIZE)
+#define SECTOR_BLOCKS       (SECTOR_SIZE * 2 / LBLOCK_SIZE)
+#define SINGLES             200
+
+static uint8_t run[SECTOR_BLOCKS][LBLOCK_SIZE];
+
+static sim_stats_t a;
+static uint32_t a_streamed;
+
+static void begin(void)
+{
+    a = sim_stats;
+    a_streamed = disk_stats.stream_verifies;
+}
+
+static double verify_ms(uint32_t streamed)
+{
+    const sim_stats_t *b = &sim_stats;
+
+    return ((b->verifies - a.verifies) * VERIFY_CALL_NS +
+            (b->verify_words - a.verify_words) * VERIFY_WORD_NS +
+            (b->checksum_words - a.checksum_words) * CHECKSUM_WORD_NS +
+            streamed * SECTOR_SIZE *
+            (CHECKSUM_WORD_NS + RUNNING_WORD_NS)) / 1e6;
+}
+
+static void report(const char *what, uint32_t sectors)
+{
+    uint32_t streamed = disk_stats.stream_verifies - a_streamed;
+
+    printf("verify %s: %-18s %6.1f doVerify + %6.1f checksum calls, "
+           "%6.2f ms per sector\n",
+           FLASHDISK_SECTOR_VERIFY ? "per sector" : "per chunk ", what,
+           (double)(sim_stats.verifies - a.verifies) / sectors,
+           (double)(sim_stats.checksums - a.checksums + streamed) / sectors,
+           verify_ms(streamed) / sectors);
+}
+
+int main(void)
+{
+    uint32_t lba, i, n;
+
+    srand(7);
+    sim_reset();
+    disk_initialize();
+
+    begin();
+    for (lba = 0; lba < NBLOCKS; lba += SECTOR_BLOCKS) {
+        for (n = 0; n < SECTOR_BLOCKS; n++) {
+            for (i = 0; i < LBLOCK_SIZE; i++)
+                run[n][i] = rand();
+            run[n][0] = 0;
+        }
+        CHECK(write_blocks(lba, SECTOR_BLOCKS, run[0]) == 0);
+    }
+    report("streamed sectors", NBLOCKS / SECTOR_BLOCKS);
+
+    begin();
+    for (n = 0; n < SINGLES; n++) {
+        for (i = 0; i < LBLOCK_SIZE; i++)
+            run[0][i] = rand();
+        run[0][0] = 0;
+        CHECK(write_blocks(rand() % NBLOCKS, 1, run[0]) == 0);
+        disk_flush();
+    }
+    report("sector write-back", SINGLES);
+    return 0;
+}
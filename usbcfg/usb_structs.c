@@ -38,6 +38,7 @@
 // Included Files
 //
 #include <usbcfg/usb_structs.h>
+#include <flash_disk/flashdisk.h>
 
 //*****************************************************************************
 //
@@ -137,6 +138,18 @@ const unsigned char * const g_pStringDescriptors[] =
                                 sizeof(unsigned char *))
 
 
+//*****************************************************************************
+//
+// The MSC staging buffer and write ring, kept out of the small .ebss RAM
+// block.
+//
+//*****************************************************************************
+#pragma DATA_SECTION(g_pui16MSCBlockBuffer, "MSC_BLOCK_BUFFER");
+uint16_t g_pui16MSCBlockBuffer[MSC_BLOCK_BUFFER_SIZE / 2];
+#pragma DATA_SECTION(g_pui16MSCWriteRing, "MSC_BLOCK_BUFFER");
+#pragma DATA_ALIGN(g_pui16MSCWriteRing, 2);
+uint16_t g_pui16MSCWriteRing[MSC_WRITE_RING_SIZE / 2];
+
 tUSBDMSCDevice g_sMSCDevice =
 {
     //
@@ -173,9 +186,25 @@ tUSBDMSCDevice g_sMSCDevice =
         USBDMSCStorageRead,
         USBDMSCStorageWrite,
         USBDMSCStorageNumBlocks,
-        USBDMSCStorageBlockSize
+        USBDMSCStorageBlockSize,
+        //
+        // The FTL has every block in flash by the end of its WRITE(10), so
+        // there is no write cache to report in the Caching page or to flush.
+        //
+#if FLASHDISK_USE_FTL
+        0,
+#else
+        USBDMSCStorageFlush,
+#endif
+        USBDMSCStorageWriteStart,
+        USBDMSCStorageTrim,
+        USBDMSCStorageEraseBlocks
     },
     USBDMSCEventCallback,
+    g_pui16MSCBlockBuffer,
+    MSC_BLOCK_BUFFER_SIZE,
+    g_pui16MSCWriteRing,
+    MSC_WRITE_RING_SIZE
 };
 
 
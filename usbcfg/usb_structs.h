@@ -58,6 +58,19 @@
 //
 #define myUSB0_LIB_BULK_BUFFER_SIZE 256
 
+//
+// The size in bytes of the MSC staging buffer for READ(10) data.  It must
+// hold at least one logical block of the flash disk.  Both MSC buffers are
+// packed two bytes per word, so they take half as many words.
+//
+#define MSC_BLOCK_BUFFER_SIZE 0x1000
+
+//
+// The size of the ring that WRITE(10) packets are queued in between the USB
+// interrupt and the main loop.  It must be a multiple of the packet size.
+//
+#define MSC_WRITE_RING_SIZE 0x1000
+
 
 //
 // Globals
@@ -67,6 +80,8 @@ extern tUSBBuffer g_sRxBuffer;
 extern tUSBDMSCDevice g_sMSCDevice;
 extern uint8_t g_pui8USBTxBuffer[];
 extern uint8_t g_pui8USBRxBuffer[];
+extern uint16_t g_pui16MSCBlockBuffer[];
+extern uint16_t g_pui16MSCWriteRing[];
 
 //
 // Function Prototypes
@@ -64,6 +64,7 @@
 typedef struct
 {
     uint32_t pui32Size[2];
+    bool pbDoubleBuffer[2];
 }
 tUSBEndpointInfo;
 
@@ -79,11 +80,13 @@ tUSBEndpointInfo;
 //
 // Given a maximum packet size and the user's FIFO scaling requirements,
 // determine the flags to use to configure the endpoint FIFO and the number
-// of bytes of FIFO space occupied.
+// of bytes of FIFO space occupied.  A double-buffered FIFO holds two packets
+// so it occupies twice the space of the single-buffered size.
 //
 //*****************************************************************************
 static uint32_t
-GetEndpointFIFOSize(uint32_t ui32MaxPktSize, uint32_t *pupBytesUsed)
+GetEndpointFIFOSize(uint32_t ui32MaxPktSize, bool bDoubleBuffer,
+                    uint32_t *pupBytesUsed)
 {
     uint32_t ui32Loop, ui32FIFOSize;
 
@@ -107,6 +110,13 @@ GetEndpointFIFOSize(uint32_t ui32MaxPktSize, uint32_t *pupBytesUsed)
             //
             // Return the FIFO size setting and the USB_FIFO_SZ_ value.
             //
+            if(bDoubleBuffer)
+            {
+                *pupBytesUsed = ui32FIFOSize * 2;
+
+                return(ui32Loop | USB_FIFO_SZ_8_DB);
+            }
+
             *pupBytesUsed = ui32FIFOSize;
 
             return(ui32Loop);
@@ -219,12 +229,18 @@ USBDeviceConfig(tDCDInstance *psDevInst, const tConfigHeader *psConfig)
     tInterfaceDescriptor *psInterface;
     tEndpointDescriptor *psEndpoint;
     tUSBEndpointInfo psEPInfo[NUM_USB_EP - 1];
+    const tFIFOConfig *psFIFOConfig;
 
     //
     // A valid device instance is required.
     //
     ASSERT(psDevInst != 0);
 
+    //
+    // The FIFO configuration requested by the device class, if any.
+    //
+    psFIFOConfig = g_ppsDevInfo[0] ? g_ppsDevInfo[0]->psFIFOConfig : 0;
+
     //
     // Catch bad pointers in a debug build.
     //
@@ -237,6 +253,8 @@ USBDeviceConfig(tDCDInstance *psDevInst, const tConfigHeader *psConfig)
     {
         psEPInfo[ui32Loop].pui32Size[EP_INFO_IN] = 0;
         psEPInfo[ui32Loop].pui32Size[EP_INFO_OUT] = 0;
+        psEPInfo[ui32Loop].pbDoubleBuffer[EP_INFO_IN] = false;
+        psEPInfo[ui32Loop].pbDoubleBuffer[EP_INFO_OUT] = false;
     }
 
     //
@@ -304,6 +322,19 @@ USBDeviceConfig(tDCDInstance *psDevInst, const tConfigHeader *psConfig)
                 psEndpoint->wMaxPacketSize;
 #endif
         }
+
+        //
+        // The device class asks for a double-buffered FIFO on the endpoints
+        // where the controller should move one packet on the bus while the
+        // next is loaded or unloaded, instead of NAKing the host in between.
+        //
+        if(psFIFOConfig != 0)
+        {
+            psEPInfo[ui32EpIndex - 1].pbDoubleBuffer[ui32EpType] =
+                (ui32EpType == EP_INFO_IN) ?
+                psFIFOConfig->sIn[ui32EpIndex - 1].bDoubleBuffer :
+                psFIFOConfig->sOut[ui32EpIndex - 1].bDoubleBuffer;
+        }
     }
 
     //
@@ -396,8 +427,9 @@ USBDeviceConfig(tDCDInstance *psDevInst, const tConfigHeader *psConfig)
             // What FIFO size flag do we use for this endpoint?
             //
             ui32MaxPkt = GetEndpointFIFOSize(
-                                psEPInfo[ui32Loop - 1].pui32Size[EP_INFO_IN],
-                                &ui32BytesUsed);
+                            psEPInfo[ui32Loop - 1].pui32Size[EP_INFO_IN],
+                            psEPInfo[ui32Loop - 1].pbDoubleBuffer[EP_INFO_IN],
+                            &ui32BytesUsed);
 
             //
             // The FIFO space could not be allocated.
@@ -424,8 +456,9 @@ USBDeviceConfig(tDCDInstance *psDevInst, const tConfigHeader *psConfig)
             // What FIFO size flag do we use for this endpoint?
             //
             ui32MaxPkt = GetEndpointFIFOSize(
-                                psEPInfo[ui32Loop - 1].pui32Size[EP_INFO_OUT],
-                                &ui32BytesUsed);
+                            psEPInfo[ui32Loop - 1].pui32Size[EP_INFO_OUT],
+                            psEPInfo[ui32Loop - 1].pbDoubleBuffer[EP_INFO_OUT],
+                            &ui32BytesUsed);
 
             //
             // The FIFO space could not be allocated.
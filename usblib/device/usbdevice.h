@@ -127,6 +127,13 @@ struct tDeviceInfo
     //! array.
     //
     uint32_t ui32NumStringDescriptors;
+
+    //
+    //! A pointer to the FIFO configuration of the device's endpoints, or 0 to
+    //! give every endpoint a single-buffered FIFO.  Only the bDoubleBuffer
+    //! field of each entry is used.
+    //
+    const tFIFOConfig *psFIFOConfig;
 };
 
 //*****************************************************************************
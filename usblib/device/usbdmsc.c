@@ -26,7 +26,9 @@
 #include <stdint.h>
 #include "inc/hw_memmap.h"
 #include "inc/hw_types.h"
+#include "inc/hw_usb.h"
 #include "driverlib/debug.h"
+#include "driverlib/dma.h"
 #include "driverlib/sysctl.h"
 #include "driverlib/usb.h"
 #include "usblib/usblib.h"
@@ -49,6 +51,7 @@ bool usb_unlocked = false;
 //
 //*****************************************************************************
 #define USBD_FLAG_ALLOW_REMOVAL 0x00000004
+#define USBD_FLAG_READY_SENT    0x00000008
 
 //*****************************************************************************
 //
@@ -92,6 +95,13 @@ bool usb_unlocked = false;
 //*****************************************************************************
 #define COMMAND_BUFFER_SIZE     64
 #define MAX_TRANSFER_SIZE       DATA_IN_EP_MAX_SIZE
+
+//*****************************************************************************
+//
+// The number of 16-bit words a packet takes in the packed data buffers.
+//
+//*****************************************************************************
+#define MAX_TRANSFER_WORDS      (MAX_TRANSFER_SIZE / 2)
 //*****************************************************************************
 //
 // The block size of a device. It defaults to DEVICE_BLOCK_SIZE
@@ -106,7 +116,6 @@ static uint32_t g_pui32BlockSize = DEVICE_BLOCK_SIZE;
 //*****************************************************************************
 static uint8_t g_pui8Command[COMMAND_BUFFER_SIZE];
 
-unsigned int g_bytesRead = 0;
 unsigned int g_bytesWritten = 0;
 //*****************************************************************************
 //
@@ -147,6 +156,23 @@ static tMSCCSW g_sSCSICSW;
 //
 #define STATE_SCSI_SENT_STATUS      0x04
 
+//
+// Receiving the parameter list of an UNMAP command into the staging buffer.
+//
+#define STATE_SCSI_RECEIVE_PARAMS   0x05
+
+//
+// The media is writing back its cache for a SYNCHRONIZE CACHE or START STOP
+// UNIT command, the status is held until USBDMSCWriteProcess() sees it done.
+//
+#define STATE_SCSI_FLUSH            0x06
+
+//
+// A response that ended on a packet boundary short of the transfer length
+// of the CBW has gone out, a zero-length packet ends the data phase next.
+//
+#define STATE_SCSI_SEND_ZLP         0x07
+
 //*****************************************************************************
 //
 // Device Descriptor.  This is stored in RAM to allow several fields to be
@@ -309,6 +335,15 @@ const tConfigHeader * const g_ppsMSCConfigDescriptors[] =
     &g_sMSCConfigHeader
 };
 
+//*****************************************************************************
+//
+// FIFO configuration.  The bulk IN and bulk OUT endpoints are double buffered
+// so the controller moves one packet on the bus while the next one is loaded
+// or unloaded, the entries are set up in USBDMSCCompositeInit().
+//
+//*****************************************************************************
+static tFIFOConfig g_sMSCFIFOConfig;
+
 //*****************************************************************************
 //
 // Various internal handlers needed by this class.
@@ -319,6 +354,8 @@ static void ConfigChangeHandler(void *pvMSCDevice, uint32_t ui32Value);
 static void HandleEndpoints(void *pvMSCDevice, uint32_t ui32Status);
 static void HandleRequests(void *pvMSCDevice, tUSBRequest *psUSBRequest);
 static void USBDSCSISendStatus(tUSBDMSCDevice *psMSCDevice);
+static void USBDSCSIUnmapList(tUSBDMSCDevice *psMSCDevice);
+static void USBDSCSIFlushDone(tUSBDMSCDevice *psMSCDevice);
 uint32_t USBDSCSICommand(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW);
 static void HandleDevice(void *pvMSCDevice, uint32_t ui32Request,
                          void *pvRequestData);
@@ -444,936 +481,2144 @@ USBDMSCMediaChange(void *pvMSCDevice, tUSBDMSCMediaStatus iMediaStatus)
 
 //*****************************************************************************
 //
-// This function is called to handle the interrupts on the Bulk endpoints for
-// the mass storage class.
+// This function reads as many of the remaining logical blocks of a READ(10)
+// as fit into the staging buffer with a single media call.  It returns the
+// number of bytes read, which is 0 if the media failed or no block is left.
 //
 //*****************************************************************************
-static void
-HandleEndpoints(void *pvMSCDevice, uint32_t ui32Status)
+static uint32_t
+FillBlockBuffer(tUSBDMSCDevice *psMSCDevice)
 {
-    tUSBDMSCDevice *psMSCDevice;
     tMSCInstance *psInst;
-    tMSCCBW *psSCSICBW;
-    uint32_t ui32EPStatus, ui32Size;
-
-    ASSERT(pvMSCDevice != 0);
-
-    //
-    // Determine if the serial device is in single or composite mode because
-    // the meaning of ui32Index is different in both cases.
-    //
-    psMSCDevice = pvMSCDevice;
+    uint32_t ui32NumBlocks, ui32Size;
 
-    //
-    // Initialize the workspace in the passed instance structure.
-    //
     psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // Get the endpoints status.
-    //
-    ui32EPStatus = USBEndpointStatus(USBA_BASE, psInst->ui8OUTEndpoint);
-
-    //
-    // Handler for the bulk IN data endpoint.
-    //
-    if((ui32Status & (1 << USBEPToIndex(psInst->ui8INEndpoint))))
+    ui32NumBlocks = psMSCDevice->ui32BlockBufferSize / g_pui32BlockSize;
+    if(ui32NumBlocks > psInst->ui32BytesToTransfer / g_pui32BlockSize)
     {
-        switch(psInst->ui8SCSIState)
-        {
-            //
-            // Handle the case where we are sending out data due to a read
-            // command.
-            //
-            case STATE_SCSI_SEND_BLOCKS:
-            {
-                //
-                // Decrement the number of bytes left to send.
-                //
-                psInst->ui32BytesToTransfer -= MAX_TRANSFER_SIZE;
-                //
-                //Add the bytes transfered
-                //
-                g_bytesRead = g_bytesRead + MAX_TRANSFER_SIZE;
-
-                //
-                // If we are done then move on to the status phase.
-                //
-                if(psInst->ui32BytesToTransfer == 0)
-                {
-                    //
-                    // Set the status so that it can be sent when this
-                    // response has has be successfully sent.
-                    //
-                    g_sSCSICSW.bCSWStatus = 0;
-                    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
-                    g_bytesRead = 0;
-
-                    //
-                    // Send back the status once this transfer is complete.
-                    //
-                    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
-                    USBDSCSISendStatus(psMSCDevice);
-
-                    if(psMSCDevice->pfnEventCallback)
-                    {
-                        psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_IDLE,
-                                                      0, 0);
-                    }
-                    //
-                    // The transfer is complete so don't read anymore data.
-                    //
-                    break;
-                }
-
-                if(g_bytesRead == g_pui32BlockSize)
-                {
-                    //
-                    // Move on to the next Logical Block.
-                    //
-                    psInst->ui32CurrentLBA++;
-                    g_bytesRead = 0;
-                }
-
-                //
-                // Read the new data and send it out.
-                //
-                if(psMSCDevice->sMediaFunctions.pfnBlockRead(psInst->pvMedia,
-                                              (uint8_t *)psInst->pui32Buffer,
-                                              psInst->ui32CurrentLBA,g_bytesRead, 1) == 0)
-                {
-                }
-
-                
-                USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, psInst->pui32Buffer,
-                                    MAX_TRANSFER_SIZE);
-                USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
-                                        USB_TRANS_IN);
-
-                break;
-            }
+        ui32NumBlocks = psInst->ui32BytesToTransfer / g_pui32BlockSize;
+    }
+    if(ui32NumBlocks == 0)
+    {
+        return(0);
+    }
 
-            //
-            // Handle sending status.
-            //
-            case STATE_SCSI_SEND_STATUS:
-            {
-                //
-                // Indicate success and no extra data coming.
-                //
-                USBDSCSISendStatus(psMSCDevice);
+    ui32Size = psMSCDevice->sMediaFunctions.pfnBlockRead(psInst->pvMedia,
+                                            psMSCDevice->pui16BlockBuffer,
+                                            psInst->ui32CurrentLBA,
+                                            ui32NumBlocks);
 
-                break;
-            }
+    psInst->ui32CurrentLBA += ui32NumBlocks;
+    psInst->ui32BufferOffset = 0;
+    psInst->ui32BufferBytes = ui32NumBlocks * g_pui32BlockSize;
 
-            //
-            // Handle completing sending status.
-            //
-            case STATE_SCSI_SENT_STATUS:
-            {
-                psInst->ui8SCSIState = STATE_SCSI_IDLE;
+    return(ui32Size);
+}
 
-                break;
-            }
+#if !USBDMSC_DMA
+//*****************************************************************************
+//
+// This function loads packets of the staging buffer into the IN FIFO until
+// either the FIFO is full or every byte of the READ(10) has been loaded.  The
+// bulk IN FIFO is double buffered, so this queues the next packet while the
+// previous one is still on the wire.  ui32BytesToTransfer counts the bytes
+// not yet loaded into the FIFO.
+//
+//*****************************************************************************
+static void
+SendBlockPackets(tUSBDMSCDevice *psMSCDevice)
+{
+    tMSCInstance *psInst;
 
-            //
-            // These cases should not occur as the being in the IDLE state due
-            // to an IN interrupt is invalid.
-            //
-            case STATE_SCSI_IDLE:
-            default:
-            {
-                break;
-            }
-        }
-    }
+    psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // Handler for the bulk OUT data endpoint.
-    //
-    if(ui32Status & (0x10000 << USBEPToIndex(psInst->ui8OUTEndpoint)))
+    while(psInst->ui32BytesToTransfer != 0)
     {
         //
-        // Get the endpoint status to see why we were called.
+        // Read the next run of logical blocks once the staging buffer has
+        // been loaded.
         //
-        ui32EPStatus = USBEndpointStatus(USBA_BASE,
-                                             psInst->ui8OUTEndpoint);
-
-        switch(psInst->ui8SCSIState)
+        if(psInst->ui32BufferOffset == psInst->ui32BufferBytes)
         {
-            //
-            // Receiving and writing bytes to the storage device.
-            //
-            case STATE_SCSI_RECEIVE_BLOCKS:
-            {
-                ui32Size = MAX_TRANSFER_SIZE;
-                USBEndpointDataGet(psInst->ui32USBBase,
-                                    psInst->ui8OUTEndpoint,
-                                    psInst->pui32Buffer, &ui32Size);
-                //
-                // Acknowledge the OUT data packet.
-                //
-                USBDevEndpointDataAck(psInst->ui32USBBase,
-                                      psInst->ui8OUTEndpoint,false);
-                //
-                // Write the new data.
-                //
-                psMSCDevice->sMediaFunctions.pfnBlockWrite(psInst->pvMedia,
-                                                (uint8_t *)psInst->pui32Buffer,
-                                                psInst->ui32CurrentLBA,g_bytesWritten,1);
-
-                //
-                // Update the current status for the buffer.
-                //
-                psInst->ui32BytesToTransfer -= MAX_TRANSFER_SIZE;
-                g_bytesWritten = g_bytesWritten + MAX_TRANSFER_SIZE;
-
-                if(g_bytesWritten == g_pui32BlockSize)                    
-                {
-                    g_bytesWritten = 0;
-                    psInst->ui32CurrentLBA++;
-
-                }
-
-                //
-                // Check if all bytes have been received.
-                //
-                if(psInst->ui32BytesToTransfer == 0)
-                {
-                    //
-                    // Set the status so that it can be sent when this response
-                    // has be successfully sent.
-                    //
-                    g_sSCSICSW.bCSWStatus = 0;
-                    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
-                    g_bytesWritten = 0;
-                    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
-                    //
-                    // Indicate success and no extra data coming.
-                    //
-                    USBDSCSISendStatus(psMSCDevice);
-
-
-                    //
-                    // If there is an event callback then call it to notify
-                    // that last operation has completed.
-                    //
-                    if(psMSCDevice->pfnEventCallback)
-                    {
-                        psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_IDLE,
-                                                      0, 0);
-                    }
-                }
-                break;
-            }
-
-            //
-            // If there is an OUT transfer in idle state then it was a new
-            // command.
-            //
-            case STATE_SCSI_IDLE:
-            {
-                //
-                // Attempt to handle the new command.
-                //
-
-                //
-                // Receive the command.
-                //
-                ui32Size = COMMAND_BUFFER_SIZE;
-                USBEndpointDataGet(psInst->ui32USBBase,
-                                       psInst->ui8OUTEndpoint,
-                                       g_pui8Command, &ui32Size);
-                psSCSICBW = (tMSCCBW *)g_pui8Command;
-
-                //
-                // Acknowledge the OUT data packet.
-                //
-                USBDevEndpointDataAck(psInst->ui32USBBase,
-                                          psInst->ui8OUTEndpoint, false);
-
-                //
-                // If this is a valid CBW then handle it.
-                //
-                if(readusb32_t(&(psSCSICBW->dCBWSignature)) == CBW_SIGNATURE)
-                {
-                    writeusb32_t(&(g_sSCSICSW.dCSWSignature),CSW_SIGNATURE);
-                    g_sSCSICSW.dCSWTag = psSCSICBW->dCBWTag;
-                    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
-                    g_sSCSICSW.bCSWStatus = 0;
-
-                    USBDSCSICommand(psMSCDevice, psSCSICBW);
-                }
-                else
-                {
-                    //
-                    // Just return to the idle state since we are now out of
-                    // sync with the host.  This should not happen, but this
-                    // should allow the device to synchronize with the host
-                    // controller.
-                    //
-                    psInst->ui8SCSIState = STATE_SCSI_IDLE;
-                }
-
-                break;
-            }
-            default:
-            {
-                break;
-            }
+            FillBlockBuffer(psMSCDevice);
         }
 
         //
-        // Clear the status bits.
+        // Stop when both halves of the FIFO are still pending.
         //
-        USBDevEndpointStatusClear(USBA_BASE, psInst->ui8OUTEndpoint,
-                                      ui32EPStatus);
+        if(USBEndpointDataPutPacked(USBA_BASE, psInst->ui8INEndpoint,
+                                    psMSCDevice->pui16BlockBuffer +
+                                    psInst->ui32BufferOffset / 2,
+                                    MAX_TRANSFER_SIZE) != 0)
+        {
+            break;
+        }
+        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
+
+        psInst->ui32BufferOffset += MAX_TRANSFER_SIZE;
+        psInst->ui32BytesToTransfer -= MAX_TRANSFER_SIZE;
     }
 }
+#endif
 
 //*****************************************************************************
 //
-// Device instance specific handler.
+// This function moves a READ(10) on to its status phase once every packet has
+// been loaded and has left the IN FIFO.
 //
 //*****************************************************************************
 static void
-HandleDevice(void *pvMSCDevice, uint32_t ui32Request, void *pvRequestData)
+SendBlocksDone(tUSBDMSCDevice *psMSCDevice)
 {
     tMSCInstance *psInst;
-    uint8_t *pui8Data;
-    tUSBDMSCDevice *psMSCDevice;
 
-    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
+    psInst = &psMSCDevice->sPrivateData;
+
+    if((psInst->ui32BytesToTransfer != 0) || (psInst->ui32DMABytes != 0) ||
+       (USBEndpointStatus(USBA_BASE, psInst->ui8INEndpoint) &
+        USB_DEV_TX_FIFO_NE))
+    {
+        return;
+    }
 
     //
-    // Get the instance data pointers.
+    // Set the status so that it can be sent when this response has has be
+    // successfully sent.
     //
-    psInst = &((tUSBDMSCDevice *)pvMSCDevice)->sPrivateData;
+    g_sSCSICSW.bCSWStatus = 0;
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
 
     //
-    // Create the 8-bit array used by the events supported by the USB MSC
-    // class.
+    // Send back the status once this transfer is complete.
     //
-    pui8Data = (uint8_t *)pvRequestData;
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    USBDSCSISendStatus(psMSCDevice);
 
-    switch(ui32Request)
+    if(psMSCDevice->pfnEventCallback)
     {
-        //
-        // This was an interface change event.
-        //
-        case USB_EVENT_COMP_IFACE_CHANGE:
-        {
-            psInst->ui8Interface = pui8Data[1];
-            break;
-        }
-
-        //
-        // This was an endpoint change event.
-        //
-        case USB_EVENT_COMP_EP_CHANGE:
-        {
-            //
-            // Determine if this is an IN or OUT endpoint that has changed.
-            //
-            if(pui8Data[0] & USB_EP_DESC_IN)
-            {
-                psInst->ui8INEndpoint = IndexToUSBEP((pui8Data[1] & 0x7f));
-            }
-            else
-            {
-                psInst->ui8OUTEndpoint = IndexToUSBEP(pui8Data[1] & 0x7f);
-            }
-            break;
-        }
-        case USB_EVENT_LPM_RESUME:
-        {
-            if(psMSCDevice->pfnEventCallback)
-            {
-                //
-                // Pass the LPM resume event to the client.
-                //
-                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
-                                              (void *)0);
-            }
-            break;
-        }
-        case USB_EVENT_LPM_SLEEP:
-        {
-            if(psMSCDevice->pfnEventCallback)
-            {
-                //
-                // Pass the LPM sleep event to the client.
-                //
-                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
-                                              (void *)0);
-            }
-            break;
-        }
-        case USB_EVENT_LPM_ERROR:
-        {
-            if(psMSCDevice->pfnEventCallback)
-            {
-                //
-                // Pass the LPM error event to the client.
-                //
-                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
-                                              (void *)0);
-            }
-            break;
-        }
-        default:
-        {
-            break;
-        }
+        psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_IDLE, 0, 0);
     }
 }
 
+#if USBDMSC_DMA
 //*****************************************************************************
 //
-// This function is called by the USB device stack whenever the device is
-// disconnected from the host.
+// This function starts a DMA channel on ui32Bytes of packets between a bulk
+// endpoint FIFO and RAM.  Each USB DMA request moves one packet as a burst of
+// 16-bit accesses, low byte first as in USBEndpointDataPutPacked(), and the
+// channel interrupts once the last packet has been moved.  The FIFO side
+// does not step.
 //
 //*****************************************************************************
 static void
-HandleDisconnect(void *pvMSCDevice)
+DMAStart(uint32_t ui32Base, DMA_Trigger eTrigger, const void *pvDest,
+         const void *pvSrc, int16_t i16DestStep, int16_t i16SrcStep,
+         uint32_t ui32Bytes)
 {
-    tUSBDMSCDevice *psMSCDevice;
+    DMA_configAddresses(ui32Base, pvDest, pvSrc);
+    DMA_configBurst(ui32Base, MAX_TRANSFER_WORDS, i16SrcStep, i16DestStep);
+    DMA_configTransfer(ui32Base, ui32Bytes / MAX_TRANSFER_SIZE, i16SrcStep,
+                       i16DestStep);
+    DMA_configMode(ui32Base, eTrigger, DMA_CFG_ONESHOT_DISABLE |
+                   DMA_CFG_CONTINUOUS_DISABLE | DMA_CFG_SIZE_16BIT);
+    DMA_setInterruptMode(ui32Base, DMA_INT_AT_END);
+    DMA_enableInterrupt(ui32Base);
+    DMA_enableTrigger(ui32Base);
+    DMA_startChannel(ui32Base);
+}
 
-    ASSERT(pvMSCDevice != 0);
+//*****************************************************************************
+//
+// This function returns the FIFO address of an endpoint as seen by the DMA.
+//
+//*****************************************************************************
+static const void *
+DMAFIFOAddress(uint8_t ui8Endpoint)
+{
+    return((const void *)(USBA_BASE + USB_O_FIFO0 + (ui8Endpoint >> 2)));
+}
 
-    //
-    // Create the instance pointer.
-    //
-    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
+//*****************************************************************************
+//
+// This function hands the staging buffer of a READ(10) to the TX DMA channel.
+// The endpoint is in DMA mode 1 with AUTOSET, so each packet is sent as soon
+// as the channel has loaded it and the controller requests the next one once
+// the FIFO has room.
+//
+//*****************************************************************************
+static void
+SendBlocksDMA(tUSBDMSCDevice *psMSCDevice)
+{
+    tMSCInstance *psInst;
 
-    //
-    // Close the drive requested.
-    //
-    if(psMSCDevice->sPrivateData.pvMedia != 0)
+    psInst = &psMSCDevice->sPrivateData;
+
+    psInst->ui32DMABytes = psInst->ui32BufferBytes;
+    psInst->ui32BytesToTransfer -= psInst->ui32BufferBytes;
+    psInst->ui32BufferOffset = psInst->ui32BufferBytes;
+
+    USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8INEndpoint,
+                            USB_EP_DEV_IN | USB_EP_DMA_MODE_1 |
+                            USB_EP_AUTO_SET);
+    USBEndpointDMAEnable(USBA_BASE, psInst->ui8INEndpoint, USB_EP_DEV_IN);
+    DMAStart(USBDMSC_DMA_TX_BASE, DMA_TRIGGER_USBA_TX1,
+             DMAFIFOAddress(psInst->ui8INEndpoint),
+             psMSCDevice->pui16BlockBuffer, 0, 1, psInst->ui32DMABytes);
+}
+
+//*****************************************************************************
+//
+// This function arms the RX DMA channel to move the next chunk of a WRITE(10)
+// into the write ring, if the channel is idle and the ring has room for it.
+// A chunk is a logical block, halved until it is at most a quarter of the
+// ring, so a chunk never wraps and several can be queued.  The endpoint is in
+// DMA mode 1 with AUTOCLEAR, so the controller NAKs the host while the
+// channel is idle.
+//
+//*****************************************************************************
+static void
+ReceiveBlocksDMA(tUSBDMSCDevice *psMSCDevice)
+{
+    tMSCInstance *psInst;
+    uint32_t ui32Size;
+
+    psInst = &psMSCDevice->sPrivateData;
+
+    ui32Size = g_pui32BlockSize;
+    while(ui32Size > psMSCDevice->ui32WriteRingSize / 4)
     {
-        psMSCDevice->sPrivateData.pvMedia = 0;
-        psMSCDevice->sMediaFunctions.pfnClose(0);
+        ui32Size /= 2;
+    }
+    if(ui32Size > psInst->ui32BytesToTransfer)
+    {
+        ui32Size = psInst->ui32BytesToTransfer;
     }
 
-    //
-    // If we have a control callback, let the client know we are open for
-    // business.
-    //
-    if(psMSCDevice->pfnEventCallback)
+    if((psInst->ui32DMABytes != 0) || (ui32Size == 0) ||
+       (USBRingBufFree(&psInst->sWriteRing) < ui32Size / 2))
     {
-        //
-        // Pass the connected event to the client.
-        //
-        psMSCDevice->pfnEventCallback(pvMSCDevice, USB_EVENT_DISCONNECTED, 0,
-                                      0);
+        return;
     }
+
+    psInst->ui32DMABytes = ui32Size;
+    DMAStart(USBDMSC_DMA_RX_BASE, DMA_TRIGGER_USBA_RX1,
+             (uint16_t *)psInst->sWriteRing.pui8Buf +
+             psInst->sWriteRing.ui32WriteIndex,
+             DMAFIFOAddress(psInst->ui8OUTEndpoint), 1, 0, ui32Size);
 }
 
 //*****************************************************************************
 //
-// This function is called by the USB device stack whenever the device
-// configuration changes.
+// This function stops both DMA channels and gives the bulk endpoints back to
+// the CPU.
 //
 //*****************************************************************************
 static void
-ConfigChangeHandler(void *pvMSCDevice, uint32_t ui32Value)
+DMAStop(tUSBDMSCDevice *psMSCDevice)
 {
-    tUSBDMSCDevice *psMSCDevice;
+    tMSCInstance *psInst;
 
-    ASSERT(pvMSCDevice != 0);
+    psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // Create the instance pointer.
-    //
-    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
-    tMSCInstance *psInst = &psMSCDevice->sPrivateData;
+    DMA_stopChannel(USBDMSC_DMA_TX_BASE);
+    DMA_stopChannel(USBDMSC_DMA_RX_BASE);
     USBEndpointDMADisable(USBA_BASE, psInst->ui8INEndpoint, USB_EP_DEV_IN);
     USBEndpointDMADisable(USBA_BASE, psInst->ui8OUTEndpoint, USB_EP_DEV_OUT);
+    USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8INEndpoint, USB_EP_DEV_IN);
+    USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8OUTEndpoint,
+                            USB_EP_DEV_OUT);
+    psInst->ui32DMABytes = 0;
+}
+
+//*****************************************************************************
+//
+//! Handles the end of a DMA transfer of the mass storage device.
+//!
+//! \param pvMSCDevice is a pointer to the mass storage device instance.
+//!
+//! When USBDMSC_DMA is set the application must call this function from the
+//! interrupts of the USBDMSC_DMA_TX_BASE and USBDMSC_DMA_RX_BASE channels.
+//! For a READ(10) it reads the next logical blocks into the staging buffer
+//! and restarts the channel, or hands the endpoint back to the CPU after the
+//! last one, so the application must mask these interrupts wherever it masks
+//! the USB interrupt.  For a WRITE(10) it queues the chunk that has been received in
+//! the write ring and arms the channel for the next one if there is room,
+//! otherwise USBDMSCWriteProcess() arms it once the media has taken enough
+//! of the ring.
+//!
+//! \return None.
+//
+//*****************************************************************************
+void
+USBDMSCDMAHandler(void *pvMSCDevice)
+{
+    tUSBDMSCDevice *psMSCDevice;
+    tMSCInstance *psInst;
 
+    ASSERT(pvMSCDevice != 0);
 
-    //
-    // If we have a control callback, let the client know we are open for
-    // business.
-    //
-    if(psMSCDevice->pfnEventCallback)
+    psMSCDevice = pvMSCDevice;
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(psInst->ui32DMABytes == 0)
+    {
+        return;
+    }
+
+    if(psInst->ui8SCSIState == STATE_SCSI_SEND_BLOCKS)
     {
+        psInst->ui32DMABytes = 0;
+        if(psInst->ui32BytesToTransfer != 0)
+        {
+            FillBlockBuffer(psMSCDevice);
+            SendBlocksDMA(psMSCDevice);
+            return;
+        }
+
         //
-        // Pass the connected event to the client.
+        // The last packets are in the FIFO.  Once they have been sent the
+        // TX interrupt moves on to the status, unless they already have.
         //
-        psMSCDevice->pfnEventCallback(pvMSCDevice, USB_EVENT_CONNECTED, 0, 0);
+        USBEndpointDMADisable(USBA_BASE, psInst->ui8INEndpoint,
+                              USB_EP_DEV_IN);
+        USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
+        SendBlocksDone(psMSCDevice);
+    }
+    else if(psInst->ui8SCSIState == STATE_SCSI_RECEIVE_BLOCKS)
+    {
+        //
+        // Queue the chunk before counting it, so USBDMSCWriteProcess() never
+        // sees every byte received with the ring still short of them.
+        //
+        USBRingBufAdvanceWrite(&psInst->sWriteRing, psInst->ui32DMABytes / 2);
+        psInst->ui32BytesToTransfer -= psInst->ui32DMABytes;
+        psInst->ui32DMABytes = 0;
+
+        if(psInst->ui32BytesToTransfer == 0)
+        {
+            USBEndpointDMADisable(USBA_BASE, psInst->ui8OUTEndpoint,
+                                  USB_EP_DEV_OUT);
+            USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8OUTEndpoint,
+                                    USB_EP_DEV_OUT);
+        }
+        else
+        {
+            ReceiveBlocksDMA(psMSCDevice);
+        }
     }
 }
+#endif
 
+#if !USBDMSC_DMA
 //*****************************************************************************
 //
-//! This function should be called once for the mass storage class device to
-//! initialized basic operation and prepare for enumeration.
-//!
-//! \param ui32Index is the index of the USB controller to initialize for
-//! mass storage class device operation.
-//! \param psMSCDevice points to a structure containing parameters customizing
-//! the operation of the mass storage device.
-//!
-//! In order for an application to initialize the USB device mass storage
-//! class, it must first call this function with the a valid mass storage
-//! device class structure in the \e psMSCDevice parameter.  This allows this
-//! function to initialize the USB controller and device code to be prepared to
-//! enumerate and function as a USB mass storage device.
-//!
-//! This function returns a void pointer that must be passed in to all other
-//! APIs used by the mass storage class.
-//!
-//! See the documentation on the tUSBDMSCDevice structure for more information
-//! on how to properly fill the structure members.
-//!
-//! \return Returns 0 on failure or a non-zero void pointer on success.
+// This function queues the OUT packet in the instance buffer in the write
+// ring.  If the ring is full the packet is not acknowledged, so the
+// controller NAKs the host until USBDMSCWriteProcess() has passed enough
+// queued packets to the media and queues this one.
 //
 //*****************************************************************************
-void *
-USBDMSCInit(uint32_t ui32Index, tUSBDMSCDevice *psMSCDevice)
+static void
+QueueReceivedPacket(tUSBDMSCDevice *psMSCDevice)
 {
-    tDeviceDescriptor *psDevDesc;
-    tConfigDescriptor *pConfDesc;
-
-    //
-    // Check parameter validity.
-    //
-    ASSERT(ui32Index == 0);
-    ASSERT(psMSCDevice);
-    ASSERT(psMSCDevice->ppui8StringDescriptors);
+    tMSCInstance *psInst;
 
-    USBDMSCCompositeInit(ui32Index, psMSCDevice, 0);
+    psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // Fix up the device descriptor with the client-supplied values.
-    //
-    psDevDesc = (tDeviceDescriptor *)g_pui8MSCDeviceDescriptor;
-    writeusb16_t(&(psDevDesc->idVendor),psMSCDevice->ui16VID);
-    writeusb16_t(&(psDevDesc->idProduct),psMSCDevice->ui16PID);
+    if(USBRingBufFree(&psInst->sWriteRing) < MAX_TRANSFER_WORDS)
+    {
+        //
+        // Hold on to the packet until the ring has room.
+        //
+        psInst->bWriteHeld = true;
+        return;
+    }
+    psInst->bWriteHeld = false;
 
-    //
-    // Fix up the configuration descriptor with client-supplied values.
-    //
-    pConfDesc = (tConfigDescriptor *)g_pui8MSCDescriptor;
-    pConfDesc->bmAttributes = psMSCDevice->ui8PwrAttributes;
-    pConfDesc->bMaxPower = (uint8_t)(psMSCDevice->ui16MaxPowermA / 2);
+    USBRingBufWrite(&psInst->sWriteRing, (uint8_t *)psInst->pui16Buffer,
+                    MAX_TRANSFER_WORDS);
 
     //
-    // All is well so now pass the descriptors to the lower layer and put
-    // the bulk device on the bus.
+    // Acknowledge the OUT data packet.
     //
-    USBDCDInit(ui32Index, &psMSCDevice->sPrivateData.sDevInfo,
-               (void *)psMSCDevice);
+    USBDevEndpointDataAck(psInst->ui32USBBase,
+                          psInst->ui8OUTEndpoint,false);
 
     //
-    // Return the pointer to the instance indicating that everything went well.
+    // Count the bytes still to be received.
     //
-    return((void *)psMSCDevice);
+    psInst->ui32BytesToTransfer -= MAX_TRANSFER_SIZE;
 }
+#endif
 
 //*****************************************************************************
 //
-//! This function should be called once for the mass storage class device to
-//! initialized basic operation and prepare for enumeration.
-//!
-//! \param ui32Index is the index of the USB controller to initialize for
-//! mass storage class device operation.
-//! \param psMSCDevice points to a structure containing parameters customizing
-//! the operation of the mass storage device.
-//! \param psCompEntry is the composite device entry to initialize when
-//! creating a composite device.
-//!
-//! In order for an application to initialize the USB device mass storage
-//! class, it must first call this function with the a valid mass storage
-//! device class structure in the \e psMSCDevice parameter.  This allows this
-//! function to initialize the USB controller and device code to be prepared to
-//! enumerate and function as a USB mass storage device.  If this mass storage
-//! device is part of a composite device, then the \e psCompEntry should
-//! point to the composite device entry to initialize.  This is part of the
-//! array that is passed to the USBDCompositeInit() function.
-//!
-//! This function returns a void pointer that must be passed in to all other
-//! APIs used by the mass storage class.
+// This function passes the oldest packet in the write ring to the media.  A
+// packet the media is too busy to take stays queued for the next call.  The
+// status is sent once every packet of the WRITE(10) has reached the media.
+//
+//*****************************************************************************
+static void
+WriteQueuedPacket(tUSBDMSCDevice *psMSCDevice)
+{
+    tMSCInstance *psInst;
+    uint32_t ui32Written;
+
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(USBRingBufUsed(&psInst->sWriteRing) >= MAX_TRANSFER_WORDS)
+    {
+        //
+        // Write the new data.  The ring size is a multiple of the packet
+        // size, so the packet is contiguous.  Once the media has failed, the
+        // rest of the data is only read so the host gets to the status.
+        //
+        if(!psInst->bWriteError)
+        {
+            ui32Written = psMSCDevice->sMediaFunctions.pfnBlockWrite(
+                                    psInst->pvMedia,
+                                    (uint16_t *)psInst->sWriteRing.pui8Buf +
+                                    psInst->sWriteRing.ui32ReadIndex,
+                                    psInst->ui32CurrentLBA,g_bytesWritten,1);
+            if(ui32Written == 0)
+            {
+                return;
+            }
+            if(ui32Written == USBDMSC_WRITE_ERROR)
+            {
+                psInst->bWriteError = true;
+            }
+        }
+        USBRingBufAdvanceRead(&psInst->sWriteRing, MAX_TRANSFER_WORDS);
+
+        //
+        // Update the current position in the media.
+        //
+        g_bytesWritten = g_bytesWritten + MAX_TRANSFER_SIZE;
+
+        if(g_bytesWritten == g_pui32BlockSize)
+        {
+            g_bytesWritten = 0;
+            psInst->ui32CurrentLBA++;
+        }
+
+#if USBDMSC_DMA
+        //
+        // Restart the DMA if it stopped for lack of room.
+        //
+        ReceiveBlocksDMA(psMSCDevice);
+#else
+        //
+        // Take in the packet held for lack of room.
+        //
+        if(psInst->bWriteHeld)
+        {
+            QueueReceivedPacket(psMSCDevice);
+        }
+#endif
+    }
+
+    //
+    // Check if all bytes have been received and written.
+    //
+    if((psInst->ui32BytesToTransfer == 0) &&
+       USBRingBufEmpty(&psInst->sWriteRing))
+    {
+        //
+        // Set the status so that it can be sent when this response
+        // has be successfully sent.
+        //
+        if(psInst->bWriteError)
+        {
+            psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+            psInst->ui8SenseKey = SCSI_RS_KEY_MEDIUM_ERR;
+            psInst->ui16AddSenseCode = SCSI_RS_WRITE_ERROR;
+            g_sSCSICSW.bCSWStatus = 1;
+        }
+        else
+        {
+            g_sSCSICSW.bCSWStatus = 0;
+        }
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        g_bytesWritten = 0;
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+        //
+        // Indicate success and no extra data coming.
+        //
+        USBDSCSISendStatus(psMSCDevice);
+
+
+        //
+        // If there is an event callback then call it to notify
+        // that last operation has completed.
+        //
+        if(psMSCDevice->pfnEventCallback)
+        {
+            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_IDLE,
+                                          0, 0);
+        }
+    }
+}
+
+//*****************************************************************************
+//
+//! Passes queued WRITE(10) data to the media.
 //!
-//! See the documentation on the tUSBDMSCDevice structure for more information
-//! on how to properly fill the structure members.
+//! \param pvMSCDevice is a pointer to the mass storage device instance.
 //!
-//! \return Returns zero on failure or a non-zero instance value that should be
-//! used with the remaining USB mass storage APIs.
+//! The USB interrupt only queues OUT packets in the write ring, and NAKs the
+//! host while the ring is full.  The application must call this function
+//! from its main loop, with the USB interrupt masked, to write the queued
+//! packets to the media one packet per call.  The status for the WRITE(10)
+//! is sent once its last packet has been written.  It also runs the media's
+//! cache write-back for SYNCHRONIZE CACHE and START STOP UNIT, one step per
+//! call, and sends their status once it is complete.  It does nothing if
+//! neither is in progress.
+//!
+//! \return None.
 //
 //*****************************************************************************
-void *
-USBDMSCCompositeInit(uint32_t ui32Index, tUSBDMSCDevice *psMSCDevice,
-                     tCompositeEntry *psCompEntry)
+void
+USBDMSCWriteProcess(void *pvMSCDevice)
+{
+    tUSBDMSCDevice *psMSCDevice;
+
+    ASSERT(pvMSCDevice != 0);
+
+    psMSCDevice = pvMSCDevice;
+
+    if(psMSCDevice->sPrivateData.ui8SCSIState == STATE_SCSI_RECEIVE_BLOCKS)
+    {
+        WriteQueuedPacket(psMSCDevice);
+    }
+    else if(psMSCDevice->sPrivateData.ui8SCSIState == STATE_SCSI_FLUSH)
+    {
+        if(psMSCDevice->sMediaFunctions.pfnFlush(
+                                    psMSCDevice->sPrivateData.pvMedia) == 0)
+        {
+            USBDSCSIFlushDone(psMSCDevice);
+        }
+    }
+}
+
+//*****************************************************************************
+//
+//! Reports whether the mass storage class is between SCSI commands.
+//!
+//! \param pvMSCDevice is a pointer to the mass storage device instance.
+//!
+//! Applications can use this to run background work only while no command
+//! is being transferred, so the next CBW is serviced as soon as it arrives.
+//!
+//! \return Returns \b true if no command is in progress.
+//
+//*****************************************************************************
+bool
+USBDMSCIsIdle(void *pvMSCDevice)
+{
+    tUSBDMSCDevice *psMSCDevice;
+
+    ASSERT(pvMSCDevice != 0);
+
+    psMSCDevice = pvMSCDevice;
+
+    return(psMSCDevice->sPrivateData.ui8SCSIState == STATE_SCSI_IDLE);
+}
+
+//*****************************************************************************
+//
+// This function is called to handle the interrupts on the Bulk endpoints for
+// the mass storage class.
+//
+//*****************************************************************************
+static void
+HandleEndpoints(void *pvMSCDevice, uint32_t ui32Status)
 {
+    tUSBDMSCDevice *psMSCDevice;
     tMSCInstance *psInst;
+    tMSCCBW *psSCSICBW;
+    uint32_t ui32EPStatus, ui32Size;
+
+    ASSERT(pvMSCDevice != 0);
+
+    //
+    // Determine if the serial device is in single or composite mode because
+    // the meaning of ui32Index is different in both cases.
+    //
+    psMSCDevice = pvMSCDevice;
+
+    //
+    // Initialize the workspace in the passed instance structure.
+    //
+    psInst = &psMSCDevice->sPrivateData;
+
+    //
+    // Get the endpoints status.
+    //
+    ui32EPStatus = USBEndpointStatus(USBA_BASE, psInst->ui8OUTEndpoint);
+
+    //
+    // Handler for the bulk IN data endpoint.
+    //
+    if((ui32Status & (1 << USBEPToIndex(psInst->ui8INEndpoint))))
+    {
+        switch(psInst->ui8SCSIState)
+        {
+            //
+            // Handle the case where we are sending out data due to a read
+            // command.
+            //
+            case STATE_SCSI_SEND_BLOCKS:
+            {
+#if !USBDMSC_DMA
+                //
+                // Refill whichever half of the FIFO has been sent.
+                //
+                SendBlockPackets(psMSCDevice);
+#endif
+
+                //
+                // If every packet has been loaded and has left the FIFO then
+                // move on to the status phase.
+                //
+                SendBlocksDone(psMSCDevice);
+
+                break;
+            }
+
+            //
+            // End a short response the host could not tell had ended.
+            //
+            case STATE_SCSI_SEND_ZLP:
+            {
+                USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
+                                    USB_TRANS_IN);
+                psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+
+                break;
+            }
+
+            //
+            // Handle sending status.
+            //
+            case STATE_SCSI_SEND_STATUS:
+            {
+                //
+                // Indicate success and no extra data coming.
+                //
+                USBDSCSISendStatus(psMSCDevice);
+
+                break;
+            }
+
+            //
+            // Handle completing sending status.
+            //
+            case STATE_SCSI_SENT_STATUS:
+            {
+                psInst->ui8SCSIState = STATE_SCSI_IDLE;
+
+                break;
+            }
+
+            //
+            // These cases should not occur as the being in the IDLE state due
+            // to an IN interrupt is invalid.
+            //
+            case STATE_SCSI_IDLE:
+            default:
+            {
+                break;
+            }
+        }
+    }
+
+    //
+    // Handler for the bulk OUT data endpoint.
+    //
+    if(ui32Status & (0x10000 << USBEPToIndex(psInst->ui8OUTEndpoint)))
+    {
+        //
+        // Get the endpoint status to see why we were called.
+        //
+        ui32EPStatus = USBEndpointStatus(USBA_BASE,
+                                             psInst->ui8OUTEndpoint);
+
+        switch(psInst->ui8SCSIState)
+        {
+            //
+            // Receiving and writing bytes to the storage device.
+            //
+            case STATE_SCSI_RECEIVE_BLOCKS:
+            {
+#if USBDMSC_DMA
+                //
+                // The RX DMA channel takes the packets.
+                //
+                break;
+#else
+                ui32Size = MAX_TRANSFER_SIZE;
+                USBEndpointDataGetPacked(psInst->ui32USBBase,
+                                         psInst->ui8OUTEndpoint,
+                                         psInst->pui16Buffer, &ui32Size);
+
+                //
+                // Queue the packet for USBDMSCWriteProcess().
+                //
+                QueueReceivedPacket(psMSCDevice);
+                break;
+#endif
+            }
+
+            //
+            // Collecting an UNMAP parameter list.
+            //
+            case STATE_SCSI_RECEIVE_PARAMS:
+            {
+                ui32Size = MAX_TRANSFER_SIZE;
+                if(ui32Size > psInst->ui32BytesToTransfer)
+                {
+                    ui32Size = psInst->ui32BytesToTransfer;
+                }
+                USBEndpointDataGetPacked(psInst->ui32USBBase,
+                                         psInst->ui8OUTEndpoint,
+                                         psMSCDevice->pui16BlockBuffer +
+                                         psInst->ui32BufferBytes / 2,
+                                         &ui32Size);
+                USBDevEndpointDataAck(psInst->ui32USBBase,
+                                      psInst->ui8OUTEndpoint, false);
+
+                psInst->ui32BufferBytes += ui32Size;
+                psInst->ui32BytesToTransfer -= ui32Size;
+
+                //
+                // A short packet also ends the transfer.
+                //
+                if((psInst->ui32BytesToTransfer == 0) ||
+                   (ui32Size < MAX_TRANSFER_SIZE))
+                {
+                    USBDSCSIUnmapList(psMSCDevice);
+                }
+                break;
+            }
+
+            //
+            // If there is an OUT transfer in idle state then it was a new
+            // command.
+            //
+            case STATE_SCSI_IDLE:
+            {
+                //
+                // Attempt to handle the new command.
+                //
+
+                //
+                // Receive the command.
+                //
+                ui32Size = COMMAND_BUFFER_SIZE;
+                USBEndpointDataGet(psInst->ui32USBBase,
+                                       psInst->ui8OUTEndpoint,
+                                       g_pui8Command, &ui32Size);
+                psSCSICBW = (tMSCCBW *)g_pui8Command;
+
+                //
+                // Acknowledge the OUT data packet.
+                //
+                USBDevEndpointDataAck(psInst->ui32USBBase,
+                                          psInst->ui8OUTEndpoint, false);
+
+                //
+                // If this is a valid CBW then handle it.
+                //
+                if(readusb32_t(&(psSCSICBW->dCBWSignature)) == CBW_SIGNATURE)
+                {
+                    writeusb32_t(&(g_sSCSICSW.dCSWSignature),CSW_SIGNATURE);
+                    g_sSCSICSW.dCSWTag = psSCSICBW->dCBWTag;
+                    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+                    g_sSCSICSW.bCSWStatus = 0;
+
+                    USBDSCSICommand(psMSCDevice, psSCSICBW);
+                }
+                else
+                {
+                    //
+                    // Just return to the idle state since we are now out of
+                    // sync with the host.  This should not happen, but this
+                    // should allow the device to synchronize with the host
+                    // controller.
+                    //
+                    psInst->ui8SCSIState = STATE_SCSI_IDLE;
+                }
+
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+
+        //
+        // Clear the status bits.
+        //
+        USBDevEndpointStatusClear(USBA_BASE, psInst->ui8OUTEndpoint,
+                                      ui32EPStatus);
+    }
+}
+
+//*****************************************************************************
+//
+// Device instance specific handler.
+//
+//*****************************************************************************
+static void
+HandleDevice(void *pvMSCDevice, uint32_t ui32Request, void *pvRequestData)
+{
+    tMSCInstance *psInst;
+    uint8_t *pui8Data;
+    tUSBDMSCDevice *psMSCDevice;
+
+    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
+
+    //
+    // Get the instance data pointers.
+    //
+    psInst = &((tUSBDMSCDevice *)pvMSCDevice)->sPrivateData;
+
+    //
+    // Create the 8-bit array used by the events supported by the USB MSC
+    // class.
+    //
+    pui8Data = (uint8_t *)pvRequestData;
+
+    switch(ui32Request)
+    {
+        //
+        // This was an interface change event.
+        //
+        case USB_EVENT_COMP_IFACE_CHANGE:
+        {
+            psInst->ui8Interface = pui8Data[1];
+            break;
+        }
+
+        //
+        // This was an endpoint change event.
+        //
+        case USB_EVENT_COMP_EP_CHANGE:
+        {
+            //
+            // Determine if this is an IN or OUT endpoint that has changed.
+            //
+            if(pui8Data[0] & USB_EP_DESC_IN)
+            {
+                psInst->ui8INEndpoint = IndexToUSBEP((pui8Data[1] & 0x7f));
+            }
+            else
+            {
+                psInst->ui8OUTEndpoint = IndexToUSBEP(pui8Data[1] & 0x7f);
+            }
+            break;
+        }
+        case USB_EVENT_LPM_RESUME:
+        {
+            if(psMSCDevice->pfnEventCallback)
+            {
+                //
+                // Pass the LPM resume event to the client.
+                //
+                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
+                                              (void *)0);
+            }
+            break;
+        }
+        case USB_EVENT_LPM_SLEEP:
+        {
+            if(psMSCDevice->pfnEventCallback)
+            {
+                //
+                // Pass the LPM sleep event to the client.
+                //
+                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
+                                              (void *)0);
+            }
+            break;
+        }
+        case USB_EVENT_LPM_ERROR:
+        {
+            if(psMSCDevice->pfnEventCallback)
+            {
+                //
+                // Pass the LPM error event to the client.
+                //
+                psMSCDevice->pfnEventCallback(0, USB_EVENT_LPM_RESUME, 0,
+                                              (void *)0);
+            }
+            break;
+        }
+        default:
+        {
+            break;
+        }
+    }
+}
+
+//*****************************************************************************
+//
+// This function is called by the USB device stack whenever the device is
+// disconnected from the host.
+//
+//*****************************************************************************
+static void
+HandleDisconnect(void *pvMSCDevice)
+{
+    tUSBDMSCDevice *psMSCDevice;
+
+    ASSERT(pvMSCDevice != 0);
+
+    //
+    // Create the instance pointer.
+    //
+    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
+
+#if USBDMSC_DMA
+    //
+    // Abandon a data phase the DMA was moving.
+    //
+    DMAStop(psMSCDevice);
+#endif
+
+    //
+    // Close the drive requested.
+    //
+    if(psMSCDevice->sPrivateData.pvMedia != 0)
+    {
+        psMSCDevice->sPrivateData.pvMedia = 0;
+        psMSCDevice->sMediaFunctions.pfnClose(0);
+    }
+
+    //
+    // If we have a control callback, let the client know we are open for
+    // business.
+    //
+    if(psMSCDevice->pfnEventCallback)
+    {
+        //
+        // Pass the connected event to the client.
+        //
+        psMSCDevice->pfnEventCallback(pvMSCDevice, USB_EVENT_DISCONNECTED, 0,
+                                      0);
+    }
+}
+
+//*****************************************************************************
+//
+// This function is called by the USB device stack whenever the device
+// configuration changes.
+//
+//*****************************************************************************
+static void
+ConfigChangeHandler(void *pvMSCDevice, uint32_t ui32Value)
+{
+    tUSBDMSCDevice *psMSCDevice;
+
+    ASSERT(pvMSCDevice != 0);
+
+    //
+    // Create the instance pointer.
+    //
+    psMSCDevice = (tUSBDMSCDevice *)pvMSCDevice;
+    tMSCInstance *psInst = &psMSCDevice->sPrivateData;
+
+    //
+    // The bulk endpoints start in CPU mode.  With USBDMSC_DMA set they are
+    // routed to USB DMA channels A TX and A RX, the DMA_TRIGGER_USBA_TX1 and
+    // DMA_TRIGGER_USBA_RX1 triggers of the C28x DMA, and only switched to DMA
+    // mode for the data phase of READ(10) and WRITE(10).
+    //
+#if USBDMSC_DMA
+    DMAStop(psMSCDevice);
+    USBEndpointDMAChannel(USBA_BASE, psInst->ui8OUTEndpoint, 0);
+    USBEndpointDMAChannel(USBA_BASE, psInst->ui8INEndpoint, 1);
+#else
+    USBEndpointDMADisable(USBA_BASE, psInst->ui8INEndpoint, USB_EP_DEV_IN);
+    USBEndpointDMADisable(USBA_BASE, psInst->ui8OUTEndpoint, USB_EP_DEV_OUT);
+#endif
+
+    //
+    // If we have a control callback, let the client know we are open for
+    // business.
+    //
+    if(psMSCDevice->pfnEventCallback)
+    {
+        //
+        // Pass the connected event to the client.
+        //
+        psMSCDevice->pfnEventCallback(pvMSCDevice, USB_EVENT_CONNECTED, 0, 0);
+    }
+}
+
+//*****************************************************************************
+//
+//! This function should be called once for the mass storage class device to
+//! initialized basic operation and prepare for enumeration.
+//!
+//! \param ui32Index is the index of the USB controller to initialize for
+//! mass storage class device operation.
+//! \param psMSCDevice points to a structure containing parameters customizing
+//! the operation of the mass storage device.
+//!
+//! In order for an application to initialize the USB device mass storage
+//! class, it must first call this function with the a valid mass storage
+//! device class structure in the \e psMSCDevice parameter.  This allows this
+//! function to initialize the USB controller and device code to be prepared to
+//! enumerate and function as a USB mass storage device.
+//!
+//! This function returns a void pointer that must be passed in to all other
+//! APIs used by the mass storage class.
+//!
+//! See the documentation on the tUSBDMSCDevice structure for more information
+//! on how to properly fill the structure members.
+//!
+//! \return Returns 0 on failure or a non-zero void pointer on success.
+//
+//*****************************************************************************
+void *
+USBDMSCInit(uint32_t ui32Index, tUSBDMSCDevice *psMSCDevice)
+{
+    tDeviceDescriptor *psDevDesc;
+    tConfigDescriptor *pConfDesc;
+
+    //
+    // Check parameter validity.
+    //
+    ASSERT(ui32Index == 0);
+    ASSERT(psMSCDevice);
+    ASSERT(psMSCDevice->ppui8StringDescriptors);
+
+    USBDMSCCompositeInit(ui32Index, psMSCDevice, 0);
+
+    //
+    // Fix up the device descriptor with the client-supplied values.
+    //
+    psDevDesc = (tDeviceDescriptor *)g_pui8MSCDeviceDescriptor;
+    writeusb16_t(&(psDevDesc->idVendor),psMSCDevice->ui16VID);
+    writeusb16_t(&(psDevDesc->idProduct),psMSCDevice->ui16PID);
+
+    //
+    // Fix up the configuration descriptor with client-supplied values.
+    //
+    pConfDesc = (tConfigDescriptor *)g_pui8MSCDescriptor;
+    pConfDesc->bmAttributes = psMSCDevice->ui8PwrAttributes;
+    pConfDesc->bMaxPower = (uint8_t)(psMSCDevice->ui16MaxPowermA / 2);
+
+    //
+    // All is well so now pass the descriptors to the lower layer and put
+    // the bulk device on the bus.
+    //
+    USBDCDInit(ui32Index, &psMSCDevice->sPrivateData.sDevInfo,
+               (void *)psMSCDevice);
+
+    //
+    // Return the pointer to the instance indicating that everything went well.
+    //
+    return((void *)psMSCDevice);
+}
+
+//*****************************************************************************
+//
+//! This function should be called once for the mass storage class device to
+//! initialized basic operation and prepare for enumeration.
+//!
+//! \param ui32Index is the index of the USB controller to initialize for
+//! mass storage class device operation.
+//! \param psMSCDevice points to a structure containing parameters customizing
+//! the operation of the mass storage device.
+//! \param psCompEntry is the composite device entry to initialize when
+//! creating a composite device.
+//!
+//! In order for an application to initialize the USB device mass storage
+//! class, it must first call this function with the a valid mass storage
+//! device class structure in the \e psMSCDevice parameter.  This allows this
+//! function to initialize the USB controller and device code to be prepared to
+//! enumerate and function as a USB mass storage device.  If this mass storage
+//! device is part of a composite device, then the \e psCompEntry should
+//! point to the composite device entry to initialize.  This is part of the
+//! array that is passed to the USBDCompositeInit() function.
+//!
+//! This function returns a void pointer that must be passed in to all other
+//! APIs used by the mass storage class.
+//!
+//! See the documentation on the tUSBDMSCDevice structure for more information
+//! on how to properly fill the structure members.
+//!
+//! \return Returns zero on failure or a non-zero instance value that should be
+//! used with the remaining USB mass storage APIs.
+//
+//*****************************************************************************
+void *
+USBDMSCCompositeInit(uint32_t ui32Index, tUSBDMSCDevice *psMSCDevice,
+                     tCompositeEntry *psCompEntry)
+{
+    tMSCInstance *psInst;
+
+    //
+    // Check parameter validity.
+    //
+    ASSERT(ui32Index == 0);
+    ASSERT(psMSCDevice);
+    ASSERT(psMSCDevice->ppui8StringDescriptors);
+    ASSERT(psCompEntry != 0);
+
+    //
+    // Initialize the workspace in the passed instance structure.
+    //
+    psInst = &psMSCDevice->sPrivateData;
+    psInst->ui32USBBase = USBA_BASE;
+    psInst->bConnected = false;
+    psInst->iMediaStatus = eUSBDMSCMediaUnknown;
+
+    //
+    // Initialize the composite entry that is used by the composite device
+    // class.
+    //
+    if(psCompEntry != 0)
+    {
+        psCompEntry->psDevInfo = &psInst->sDevInfo;
+        psCompEntry->pvInstance = (void *)psMSCDevice;
+    }
+
+    //
+    // Initialize the device information structure.
+    //
+    psInst->sDevInfo.psCallbacks = &g_sMSCHandlers;
+    psInst->sDevInfo.pui8DeviceDescriptor = g_pui8MSCDeviceDescriptor;
+    psInst->sDevInfo.ppsConfigDescriptors = g_ppsMSCConfigDescriptors;
+    psInst->sDevInfo.ppui8StringDescriptors = 0;
+    psInst->sDevInfo.ui32NumStringDescriptors = 0;
+    g_sMSCFIFOConfig.sIn[USBEPToIndex(DATA_IN_ENDPOINT) - 1].bDoubleBuffer =
+                                                                        true;
+    g_sMSCFIFOConfig.sOut[USBEPToIndex(DATA_OUT_ENDPOINT) - 1].bDoubleBuffer =
+                                                                        true;
+    psInst->sDevInfo.psFIFOConfig = &g_sMSCFIFOConfig;
+
+    //
+    // Initialize the device info structure for the mass storage device.
+    //
+    USBDCDDeviceInfoInit(0, &psInst->sDevInfo);
+
+    //
+    // Set the initial interface and endpoints.
+    //
+    psInst->ui8Interface = 0;
+    psInst->ui8OUTEndpoint = DATA_OUT_ENDPOINT;
+    psInst->ui8INEndpoint = DATA_IN_ENDPOINT;
+
+    //
+    // Set the initial SCSI state to idle.
+    //
+    psInst->ui8SCSIState = STATE_SCSI_IDLE;
+    psInst->bWriteHeld = false;
+    psInst->bWriteError = false;
+    psInst->ui32DMABytes = 0;
+    //
+    // The ring counts 16-bit words of packed data.
+    //
+    USBRingBufInit(&psInst->sWriteRing,
+                   (uint8_t *)psMSCDevice->pui16WriteRing,
+                   psMSCDevice->ui32WriteRingSize / 2);
+
+    //
+    // Plug in the client's string stable to the device information
+    // structure.
+    //
+    psInst->sDevInfo.ppui8StringDescriptors =
+                                        psMSCDevice->ppui8StringDescriptors;
+    psInst->sDevInfo.ui32NumStringDescriptors =
+                                        psMSCDevice->ui32NumStringDescriptors;
+
+    psInst->ui32Flags &= ~USBD_FLAG_READY_SENT;
+
+    //
+    // Open the drive requested.
+    //
+    psInst->pvMedia = psMSCDevice->sMediaFunctions.pfnOpen(0);
+
+    if(psInst->pvMedia == 0)
+    {
+        //
+        // There is no media currently present.
+        //
+        psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
+        psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+    }
+    else
+    {
+        //
+        // Media is now ready for use.
+        //
+        psInst->ui8SenseKey = SCSI_RS_KEY_UNIT_ATTN;
+        psInst->ui16AddSenseCode = SCSI_RS_MED_NOTRDY2RDY;
+    }
+
+    //
+    // Enable Clocking to the USB controller.
+    //
+    SysCtl_enablePeripheral(SYSCTL_PERIPH_CLK_USBA);
+
+    //
+    // Turn on USB Phy clock.
+    //
+    //SysCtlUSBPLLEnable();
+    //
+    // Return the pointer to the instance indicating that everything went well.
+    //
+    return((void *)psMSCDevice);
+}
+
+//*****************************************************************************
+//
+//! Shuts down the mass storage device.
+//!
+//! \param pvMSCDevice is the pointer to the device instance structure as
+//! returned by USBDMSCInit() or USBDMSCCompositeInit().
+//!
+//! This function terminates mass storage operation for the instance supplied
+//! and removes the device from the USB bus.  Following this call, the
+//! \e pvMSCDevice instance may not me used in any other call to the mass
+//! storage device other than USBDMSCInit() or USBDMSCCompositeInit().
+//!
+//! \return None.
+//
+//*****************************************************************************
+void
+USBDMSCTerm(void *pvMSCDevice)
+{
+    tUSBDMSCDevice *psMSCDevice;
+
+    ASSERT(pvMSCDevice != 0);
+
+    //
+    // Cleanly exit device mode.
+    //
+    USBDCDTerm(0);
+
+    //
+    // Create a device instance pointer.
+    //
+    psMSCDevice = pvMSCDevice;
+
+    //
+    // If the media was opened the close it out.
+    //
+    if(psMSCDevice->sPrivateData.pvMedia != 0)
+    {
+        psMSCDevice->sPrivateData.pvMedia = 0;
+        psMSCDevice->sMediaFunctions.pfnClose(0);
+    }
+}
+
+//*****************************************************************************
+//
+// This function is called by the USB device stack whenever a non-standard
+// request is received.
+//
+// \param pvMSCDevice is instance data for this request.
+// \param pUSBRequest points to the request received.
+//
+// This call parses the provided request structure to determine the command.
+// The only mass storage command supported over endpoint 0 is the Get Max LUN
+// command.
+//
+// \return None.
+//
+//*****************************************************************************
+static void
+HandleRequests(void *pvMSCDevice, tUSBRequest *pUSBRequest)
+{
+    //
+    // This class only support a single LUN.
+    //
+    static const uint8_t ui8MaxLun = 0;
+
+    ASSERT(pvMSCDevice != 0);
+
+    //
+    // Determine the type of request.
+    //
+    switch(pUSBRequest->bRequest)
+    {
+        //
+        // A Set Report request is received from the host when it sends an
+        // Output report via endpoint 0.
+        //
+        case USBREQ_GET_MAX_LUN:
+        {
+            //
+            // Need to ACK the data on end point 0 with last data since there
+            // is no more data expected.
+            //
+            USBDevEndpointDataAck(USBA_BASE, USB_EP_0, true);
+
+            //
+            // Send our response to the host.
+            //
+            USBDCDSendDataEP0(0, (uint8_t *)&ui8MaxLun, 1);
+
+            break;
+        }
+        case USBREQ_BULK_ONLY_RESET:
+        {
+            //
+            // Need to ACK the data on end point 0 with last data since there
+            // is no more data expected.
+            //
+            USBDevEndpointDataAck(USBA_BASE, USB_EP_0, true);
+
+            //
+            // Send a null packet to the host.
+            //
+            USBDCDSendDataEP0(0, (uint8_t *)&ui8MaxLun, 0);
+
+            break;
+        }
+
+        //
+        // This request was not recognized so stall.
+        //
+        default:
+        {
+            USBDCDStallEP0(0);
+            break;
+        }
+    }
+}
+
+//*****************************************************************************
+//
+// This function sends the first ui32Size bytes of g_pui8Command as the
+// response to a command, clipped to the allocation length ui32Alloc of the
+// command and the transfer length ui32Length of the CBW, and sets a passing
+// status with the residue of the transfer.  The response overwrites the CBW
+// in g_pui8Command, so the caller reads everything it needs from the CBW
+// before it starts building the response.
+//
+// When less than the host asked for is sent and the response fills its last
+// packet, the host has no short packet to end the data phase on and would
+// take the CSW as more data (case Hi > Di of the Bulk-Only Transport).  A
+// zero-length packet follows the response in that case.
+//
+//*****************************************************************************
+static void
+USBDSCSISendData(tUSBDMSCDevice *psMSCDevice, uint32_t ui32Size,
+                 uint32_t ui32Alloc, uint32_t ui32Length)
+{
+    uint32_t ui32Residue;
+    tMSCInstance *psInst;
+
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(ui32Size > ui32Alloc)
+    {
+        ui32Size = ui32Alloc;
+    }
+    if(ui32Size > ui32Length)
+    {
+        ui32Size = ui32Length;
+    }
+
+    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
+                       ui32Size);
+    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
+
+    //
+    // Set the status so that it can be sent when this response has
+    // has be successfully sent.
+    //
+    g_sSCSICSW.bCSWStatus = 0;
+    ui32Residue = ui32Length - ui32Size;
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), ui32Residue);
+
+    if((ui32Size != 0) && (ui32Size < ui32Length) &&
+       ((ui32Size % DATA_IN_EP_MAX_SIZE) == 0))
+    {
+        psInst->ui8SCSIState = STATE_SCSI_SEND_ZLP;
+    }
+    else
+    {
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    }
+}
+
+//*****************************************************************************
+//
+// This function fails a command that is not supported in the form the host
+// sent it with an Illegal Request and the additional sense code
+// ui16AddSenseCode.  Any data phase of the command is stalled.
+//
+//*****************************************************************************
+static void
+USBDSCSIIllegalRequest(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW,
+                       uint16_t ui16AddSenseCode)
+{
+    tMSCInstance *psInst;
+
+    psInst = &psMSCDevice->sPrivateData;
+
+    g_sSCSICSW.bCSWStatus = 1;
+    g_sSCSICSW.dCSWDataResidue = psSCSICBW->dCBWDataTransferLength;
+
+    if(readusb32_t(&(psSCSICBW->dCBWDataTransferLength)) != 0)
+    {
+        if(psSCSICBW->bmCBWFlags & CBWFLAGS_DIR_IN)
+        {
+            USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
+        }
+        else
+        {
+            USBDevEndpointStall(USBA_BASE, psInst->ui8OUTEndpoint,
+                                USB_EP_DEV_OUT);
+        }
+    }
+
+    psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+    psInst->ui8SenseKey = SCSI_RS_KEY_ILGL_RQST;
+    psInst->ui16AddSenseCode = ui16AddSenseCode;
+
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+}
+
+//*****************************************************************************
+//
+// The string descriptor index of the serial number in the device descriptor.
+//
+//*****************************************************************************
+#define MSC_SERIAL_STRING       3
+
+//*****************************************************************************
+//
+// This function is used to handle an Inquiry command for a vital product data
+// page.  Block Limits reports the erase unit of the media as the optimal
+// transfer and unmap granularity, so hosts can align partitions and I/O to
+// it.  Logical Block Provisioning is reported when the media can be
+// unmapped.
+//
+//*****************************************************************************
+static void
+USBDSCSIInquiryVPD(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+{
+    uint32_t ui32Size, ui32Idx, ui32Value, ui32Alloc, ui32Length;
+    const uint8_t *pui8String;
+    tMSCInstance *psInst;
+    uint8_t ui8Page;
+
+    psInst = &psMSCDevice->sPrivateData;
+
+    //
+    // The response is built over the CBW.
+    //
+    ui8Page = psSCSICBW->CBWCB[2];
+    ui32Alloc = (psSCSICBW->CBWCB[3] << 8) | psSCSICBW->CBWCB[4];
+    ui32Length = readusb32_t(&(psSCSICBW->dCBWDataTransferLength));
+
+    //
+    // Logical Block Provisioning is only there when the media can be
+    // unmapped.
+    //
+    if(((ui8Page != SCSI_VPD_SUPPORTED) && (ui8Page != SCSI_VPD_SERIAL) &&
+        (ui8Page != SCSI_VPD_BLOCK_LIMITS) && (ui8Page != SCSI_VPD_BDC) &&
+        (ui8Page != SCSI_VPD_LBP)) ||
+       ((ui8Page == SCSI_VPD_LBP) &&
+        (psMSCDevice->sMediaFunctions.pfnTrim == 0)))
+    {
+        USBDSCSIIllegalRequest(psMSCDevice, psSCSICBW, SCSI_RS_INVALID_CDB);
+        return;
+    }
+
+    for(ui32Idx = 0; ui32Idx < COMMAND_BUFFER_SIZE; ui32Idx++)
+    {
+        g_pui8Command[ui32Idx] = 0;
+    }
+
+    //
+    // Direct Access device followed by the page code.
+    //
+    g_pui8Command[0] = SCSI_INQ_PDT_SBC;
+    g_pui8Command[1] = ui8Page;
+
+    switch(ui8Page)
+    {
+        case SCSI_VPD_SUPPORTED:
+        {
+            ui32Size = 4;
+            g_pui8Command[ui32Size++] = SCSI_VPD_SUPPORTED;
+            g_pui8Command[ui32Size++] = SCSI_VPD_SERIAL;
+            g_pui8Command[ui32Size++] = SCSI_VPD_BLOCK_LIMITS;
+            g_pui8Command[ui32Size++] = SCSI_VPD_BDC;
+            if(psMSCDevice->sMediaFunctions.pfnTrim)
+            {
+                g_pui8Command[ui32Size++] = SCSI_VPD_LBP;
+            }
+            break;
+        }
+        case SCSI_VPD_SERIAL:
+        {
+            //
+            // The ASCII form of the USB serial number string, which is
+            // UTF-16LE.
+            //
+            ui32Size = 4;
+            if(psMSCDevice->ui32NumStringDescriptors > MSC_SERIAL_STRING)
+            {
+                pui8String =
+                    psMSCDevice->ppui8StringDescriptors[MSC_SERIAL_STRING];
+                for(ui32Idx = 2; (ui32Idx < pui8String[0]) &&
+                    (ui32Size < COMMAND_BUFFER_SIZE); ui32Idx += 2)
+                {
+                    g_pui8Command[ui32Size++] = pui8String[ui32Idx];
+                }
+            }
+            break;
+        }
+        case SCSI_VPD_BLOCK_LIMITS:
+        {
+            ui32Size = SCSI_VPD_BLOCK_LIMITS_SZ;
+
+            //
+            // Optimal transfer length granularity, in blocks.
+            //
+            ui32Value = 0;
+            if(psMSCDevice->sMediaFunctions.pfnEraseBlocks)
+            {
+                ui32Value = psMSCDevice->sMediaFunctions.pfnEraseBlocks(
+                                                            psInst->pvMedia);
+            }
+            g_pui8Command[6] = 0xff & (ui32Value >> 8);
+            g_pui8Command[7] = 0xff & ui32Value;
+
+            if(psMSCDevice->sMediaFunctions.pfnTrim && psInst->pvMedia)
+            {
+                //
+                // Any number of blocks can be unmapped, in as many
+                // descriptors as the staging buffer holds.  Unmapping whole
+                // erase units lets the media pre-erase them.
+                //
+                g_pui8Command[20] = 0xff;
+                g_pui8Command[21] = 0xff;
+                g_pui8Command[22] = 0xff;
+                g_pui8Command[23] = 0xff;
+                ui32Idx = (psMSCDevice->ui32BlockBufferSize -
+                           SCSI_UNMAP_HEADER_SZ) / SCSI_UNMAP_DESC_SZ;
+                g_pui8Command[26] = 0xff & (ui32Idx >> 8);
+                g_pui8Command[27] = 0xff & ui32Idx;
+                g_pui8Command[30] = 0xff & (ui32Value >> 8);
+                g_pui8Command[31] = 0xff & ui32Value;
+                if(ui32Value)
+                {
+                    g_pui8Command[32] = SCSI_VPD_UGAVALID;
+                }
+            }
+            break;
+        }
+        case SCSI_VPD_BDC:
+        {
+            //
+            // Flash media, which does not rotate.
+            //
+            ui32Size = SCSI_VPD_BDC_SZ;
+            g_pui8Command[4] = SCSI_VPD_NON_ROTATING >> 8;
+            g_pui8Command[5] = SCSI_VPD_NON_ROTATING & 0xff;
+            break;
+        }
+        //
+        // SCSI_VPD_LBP, the only page left.
+        //
+        default:
+        {
+            //
+            // UNMAP is supported.  No threshold, and unmapped blocks read
+            // back as whatever the flash holds.
+            //
+            ui32Size = 8;
+            g_pui8Command[5] = SCSI_VPD_LBP_LBPU;
+            break;
+        }
+    }
+
+    //
+    // Page length, which does not count the 4 byte header.
+    //
+    g_pui8Command[3] = ui32Size - 4;
+
+    USBDSCSISendData(psMSCDevice, ui32Size, ui32Alloc, ui32Length);
+}
+
+//*****************************************************************************
+//
+// This function is used to handle the SCSI Inquiry command when it is received
+// from the host.
+//
+//*****************************************************************************
+static void
+USBDSCSIInquiry(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+{
+    int32_t i32Idx;
+    tMSCInstance *psInst;
+    uint32_t *pui32Data;
+
+    //
+    // Vital product data is returned by its own handler.
+    //
+    if(psSCSICBW->CBWCB[1] & SCSI_INQ_EVPD)
+    {
+        USBDSCSIInquiryVPD(psMSCDevice, psSCSICBW);
+        return;
+    }
+
+    //
+    // Create a local 32-bit pointer to the command.
+    //
+    pui32Data = (uint32_t *)g_pui8Command;
+
+    //
+    // Create the serial instance data.
+    //
+    psInst = &psMSCDevice->sPrivateData;
 
     //
-    // Check parameter validity.
+    // Direct Access device, Removable storage and SCSI 1 responses.
     //
-    ASSERT(ui32Index == 0);
-    ASSERT(psMSCDevice);
-    ASSERT(psMSCDevice->ppui8StringDescriptors);
-    ASSERT(psCompEntry != 0);
+    pui32Data[0] = SCSI_INQ_PDT_SBC | (SCSI_INQ_RMB << 8);
 
     //
-    // Initialize the workspace in the passed instance structure.
+    // Additional Length is fixed at 31 bytes.
     //
-    psInst = &psMSCDevice->sPrivateData;
-    psInst->ui32USBBase = USBA_BASE;
-    psInst->bConnected = false;
-    psInst->iMediaStatus = eUSBDMSCMediaUnknown;
+    pui32Data[1] = 31;
 
     //
-    // Initialize the composite entry that is used by the composite device
-    // class.
+    // Copy the Vendor string.
     //
-    if(psCompEntry != 0)
+    for(i32Idx = 0; i32Idx < 8; i32Idx++)
     {
-        psCompEntry->psDevInfo = &psInst->sDevInfo;
-        psCompEntry->pvInstance = (void *)psMSCDevice;
+        g_pui8Command[i32Idx + 8] = psMSCDevice->pui8Vendor[i32Idx];
     }
 
     //
-    // Initialize the device information structure.
+    // Copy the Product string.
     //
-    psInst->sDevInfo.psCallbacks = &g_sMSCHandlers;
-    psInst->sDevInfo.pui8DeviceDescriptor = g_pui8MSCDeviceDescriptor;
-    psInst->sDevInfo.ppsConfigDescriptors = g_ppsMSCConfigDescriptors;
-    psInst->sDevInfo.ppui8StringDescriptors = 0;
-    psInst->sDevInfo.ui32NumStringDescriptors = 0;
+    for(i32Idx = 0; i32Idx < 16; i32Idx++)
+    {
+        g_pui8Command[i32Idx + 16] = psMSCDevice->pui8Product[i32Idx];
+    }
 
     //
-    // Initialize the device info structure for the mass storage device.
+    // Copy the Version string.
     //
-    USBDCDDeviceInfoInit(0, &psInst->sDevInfo);
+    for(i32Idx = 0; i32Idx < 4; i32Idx++)
+    {
+        g_pui8Command[i32Idx + 32] = psMSCDevice->pui8Version[i32Idx];
+    }
 
     //
-    // Set the initial interface and endpoints.
+    // Send the SCSI Inquiry Response.
     //
-    psInst->ui8Interface = 0;
-    psInst->ui8OUTEndpoint = DATA_OUT_ENDPOINT;
-    psInst->ui8INEndpoint = DATA_IN_ENDPOINT;
+    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
+                           36);
 
     //
-    // Set the initial SCSI state to idle.
+    // Send the data to the host.
     //
-    psInst->ui8SCSIState = STATE_SCSI_IDLE;
+    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
 
     //
-    // Plug in the client's string stable to the device information
-    // structure.
+    // Set the status so that it can be sent when this response has
+    // has be successfully sent.
     //
-    psInst->sDevInfo.ppui8StringDescriptors =
-                                        psMSCDevice->ppui8StringDescriptors;
-    psInst->sDevInfo.ui32NumStringDescriptors =
-                                        psMSCDevice->ui32NumStringDescriptors;
+    g_sSCSICSW.bCSWStatus = 0;
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+}
+
+//*****************************************************************************
+//
+// This function is used to handle the SCSI Read Capacities command when it is
+// received from the host.
+//
+//*****************************************************************************
+static void
+USBDSCSIReadCapacities(tUSBDMSCDevice *psMSCDevice)
+{
+    uint32_t ui32Blocks;
+    tMSCInstance *psInst;
+    uint32_t *pui32Data;
 
     //
-    // Open the drive requested.
+    // Create a local 32-bit pointer to the command.
     //
-    psInst->pvMedia = psMSCDevice->sMediaFunctions.pfnOpen(0);
+    pui32Data = (uint32_t *)g_pui8Command;
 
-    if(psInst->pvMedia == 0)
+    //
+    // Get our instance data pointer.
+    //
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(psInst->pvMedia != 0)
     {
+        if(psMSCDevice->sMediaFunctions.pfnBlockSize)
+        {
+            //
+            // Query the block size for the device
+            //
+            g_pui32BlockSize =
+                     psMSCDevice->sMediaFunctions.pfnBlockSize(psInst->pvMedia);
+        }
+        ui32Blocks =
+                    psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
+
+        pui32Data[0] = 0x08000000;
+
         //
-        // There is no media currently present.
+        // Fill in the number of blocks, the bytes endianness must be changed.
+        //
+        g_pui8Command[4] = ui32Blocks >> 24;
+        g_pui8Command[5] = 0xff & (ui32Blocks >> 16);
+        g_pui8Command[6] = 0xff & (ui32Blocks >> 8);
+        g_pui8Command[7] = 0xff & (ui32Blocks);
+
+        //
+        // Current media capacity
+        //
+        g_pui8Command[8] = 0x2;
+
+        //
+        // Fill in the block size, which is g_pui32BlockSize.
+        //
+        g_pui8Command[9] = 0xff & (g_pui32BlockSize >> 16);
+        g_pui8Command[10] = 0xff & (g_pui32BlockSize >> 8);
+        g_pui8Command[11] = 0xff & g_pui32BlockSize;
+
+        //
+        // Send out the 12 bytes that are in this response.
+        //
+        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
+                               12);
+        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_TRANS_IN);
+
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 0;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+    }
+    else
+    {
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 1;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+
+        //
+        // Stall the IN endpoint
+        //
+        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
+
+        //
+        // Mark the sense code as valid and indicate that these is no media
+        // present.
+        //
+        psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+        psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
+        psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+    }
+
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+}
+
+//*****************************************************************************
+//
+// This function is used to handle the SCSI Read Capacity command when it is
+// received from the host.
+//
+//*****************************************************************************
+static void
+USBDSCSIReadCapacity(tUSBDMSCDevice *psMSCDevice)
+{
+    uint32_t ui32Blocks;
+    tMSCInstance *psInst;
+
+    //
+    // Get our instance data pointer.
+    //
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(psMSCDevice->sMediaFunctions.pfnBlockSize)
+    {
+        //
+        // Query the block size for the device
+        //
+        g_pui32BlockSize =
+                 psMSCDevice->sMediaFunctions.pfnBlockSize(psInst->pvMedia);
+    }
+
+    ui32Blocks = psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
+
+    //
+    // Only decrement if any blocks were found.
+    //
+    if(ui32Blocks != 0)
+    {
+        //
+        // One less than the maximum number is the last addressable
+        // block.
+        //
+        ui32Blocks--;
+    }
+
+    if(psInst->pvMedia != 0)
+    {
+        //
+        // Fill in the number of blocks, the bytes endianness must be changed.
+        //
+        g_pui8Command[0] = 0xff & (ui32Blocks >> 24);
+        g_pui8Command[1] = 0xff & (ui32Blocks >> 16);
+        g_pui8Command[2] = 0xff & (ui32Blocks >> 8);
+        g_pui8Command[3] = 0xff & (ui32Blocks);
+
+        g_pui8Command[4] = 0;
+
+        //
+        // Fill in the block size, which is g_pui32BlockSize.
+        //
+        g_pui8Command[5] = 0xff & (g_pui32BlockSize >> 16);
+        g_pui8Command[6] = 0xff & (g_pui32BlockSize >> 8);
+        g_pui8Command[7] = 0xff & g_pui32BlockSize;
+
+        //
+        // Send the SCSI Inquiry Response.
         //
+        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
+                               8);
+        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_TRANS_IN);
+
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 0;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+    }
+    else
+    {
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 1;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+
+        //
+        // Stall the IN endpoint
+        //
+        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
+
+        //
+        // Mark the sense code as valid and indicate that these is no media
+        // present.
+        //
+        psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
     }
-    else
+
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+}
+
+//*****************************************************************************
+//
+// This function is used to handle the SCSI Request Sense command when it is
+// received from the host.
+//
+//*****************************************************************************
+static void
+USBDSCSIRequestSense(tUSBDMSCDevice *psMSCDevice)
+{
+    tMSCInstance *psInst;
+    int32_t i32Idx;
+
+    //
+    // Zero out the response data.
+    //
+    for(i32Idx = 0; i32Idx < 18; i32Idx++)
     {
-        //
-        // Media is now ready for use.
-        //
-        psInst->ui8SenseKey = SCSI_RS_KEY_UNIT_ATTN;
-        psInst->ui16AddSenseCode = SCSI_RS_MED_NOTRDY2RDY;
+        g_pui8Command[i32Idx] = 0;
     }
 
     //
-    // Enable Clocking to the USB controller.
+    // Get our instance data pointer.
     //
-    SysCtl_enablePeripheral(SYSCTL_PERIPH_CLK_USBA);
+    psInst = &psMSCDevice->sPrivateData;
 
     //
-    // Turn on USB Phy clock.
+    // The request sense response.
     //
-    //SysCtlUSBPLLEnable();
+    g_pui8Command[0] = psInst->ui8ErrorCode;
+    g_pui8Command[2] = psInst->ui8SenseKey;
+
     //
-    // Return the pointer to the instance indicating that everything went well.
+    // There are 10 more bytes of data.
     //
-    return((void *)psMSCDevice);
-}
+    g_pui8Command[7] = 10;
 
-//*****************************************************************************
-//
-//! Shuts down the mass storage device.
-//!
-//! \param pvMSCDevice is the pointer to the device instance structure as
-//! returned by USBDMSCInit() or USBDMSCCompositeInit().
-//!
-//! This function terminates mass storage operation for the instance supplied
-//! and removes the device from the USB bus.  Following this call, the
-//! \e pvMSCDevice instance may not me used in any other call to the mass
-//! storage device other than USBDMSCInit() or USBDMSCCompositeInit().
-//!
-//! \return None.
-//
-//*****************************************************************************
-void
-USBDMSCTerm(void *pvMSCDevice)
-{
-    tUSBDMSCDevice *psMSCDevice;
+    //
+    // Transition from not ready to ready.
+    //
+    g_pui8Command[12] = (uint8_t)psInst->ui16AddSenseCode;
+    g_pui8Command[13] = (uint8_t)(psInst->ui16AddSenseCode >> 8);
 
-    ASSERT(pvMSCDevice != 0);
+    //
+    // Send the SCSI Inquiry Response.
+    //
+    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
+                           18);
+    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
 
     //
-    // Cleanly exit device mode.
+    // Reset the valid flag on errors.
     //
-    USBDCDTerm(0);
+    psInst->ui8ErrorCode = SCSI_RS_CUR_ERRORS;
 
     //
-    // Create a device instance pointer.
+    // Set the status so that it can be sent when this response has
+    // has be successfully sent.
     //
-    psMSCDevice = pvMSCDevice;
+    g_sSCSICSW.bCSWStatus = 0;
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
 
     //
-    // If the media was opened the close it out.
+    // Move on to the status phase.
     //
-    if(psMSCDevice->sPrivateData.pvMedia != 0)
-    {
-        psMSCDevice->sPrivateData.pvMedia = 0;
-        psMSCDevice->sMediaFunctions.pfnClose(0);
-    }
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
 }
 
 //*****************************************************************************
 //
-// This function is called by the USB device stack whenever a non-standard
-// request is received.
-//
-// \param pvMSCDevice is instance data for this request.
-// \param pUSBRequest points to the request received.
-//
-// This call parses the provided request structure to determine the command.
-// The only mass storage command supported over endpoint 0 is the Get Max LUN
-// command.
-//
-// \return None.
+// This function is used to handle the SCSI Read 10 command when it is
+// received from the host.
 //
 //*****************************************************************************
 static void
-HandleRequests(void *pvMSCDevice, tUSBRequest *pUSBRequest)
+USBDSCSIRead10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
 {
+    uint16_t ui16NumBlocks;
+    tMSCInstance *psInst;
+
     //
-    // This class only support a single LUN.
+    // Default the number of blocks.
     //
-    static const uint8_t ui8MaxLun = 0;
-
-    ASSERT(pvMSCDevice != 0);
+    ui16NumBlocks = 0;
 
     //
-    // Determine the type of request.
+    // Get our instance data pointer.
     //
-    switch(pUSBRequest->bRequest)
+    psInst = &psMSCDevice->sPrivateData;
+
+    if(psInst->pvMedia != 0)
     {
         //
-        // A Set Report request is received from the host when it sends an
-        // Output report via endpoint 0.
+        // Get the logical block from the CBW structure. This switching
+        // is required to convert from big to little endian.
         //
-        case USBREQ_GET_MAX_LUN:
-        {
-            //
-            // Need to ACK the data on end point 0 with last data since there
-            // is no more data expected.
-            //
-            USBDevEndpointDataAck(USBA_BASE, USB_EP_0, true);
-
-            //
-            // Send our response to the host.
-            //
-            USBDCDSendDataEP0(0, (uint8_t *)&ui8MaxLun, 1);
+        psInst->ui32CurrentLBA = (((uint32_t)psSCSICBW->CBWCB[2]) << 24) |
+                                 (((uint32_t)psSCSICBW->CBWCB[3]) << 16) |
+                                 (((uint32_t)psSCSICBW->CBWCB[4]) << 8) |
+                                 (psSCSICBW->CBWCB[5] << 0);
 
-            break;
-        }
-        case USBREQ_BULK_ONLY_RESET:
-        {
-            //
-            // Need to ACK the data on end point 0 with last data since there
-            // is no more data expected.
-            //
-            USBDevEndpointDataAck(USBA_BASE, USB_EP_0, true);
+        //
+        // More bytes to read.
+        //
+        ui16NumBlocks = (psSCSICBW->CBWCB[7] << 8) | psSCSICBW->CBWCB[8];
 
-            //
-            // Send a null packet to the host.
-            //
-            USBDCDSendDataEP0(0, (uint8_t *)&ui8MaxLun, 0);
+        //
+        // Schedule the bytes to send.
+        //
+        psInst->ui32BytesToTransfer = (g_pui32BlockSize * ui16NumBlocks);
 
-            break;
+        //
+        // A transfer length of 0 reads nothing and is not an error.  Any
+        // data the host expects is refused by stalling the IN endpoint.
+        //
+        if(ui16NumBlocks == 0)
+        {
+            g_sSCSICSW.bCSWStatus = 0;
+            g_sSCSICSW.dCSWDataResidue = psSCSICBW->dCBWDataTransferLength;
+            if(readusb32_t(&(psSCSICBW->dCBWDataTransferLength)) != 0)
+            {
+                USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                    USB_EP_DEV_IN);
+            }
+            psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+            return;
         }
 
         //
-        // This request was not recognized so stall.
+        // Read the first logical blocks from the storage device.
         //
-        default:
+        if(FillBlockBuffer(psMSCDevice) == 0)
         {
-            USBDCDStallEP0(0);
-            break;
+            psInst->pvMedia = 0;
+            psMSCDevice->sMediaFunctions.pfnClose(0);
         }
     }
-}
-
-//*****************************************************************************
-//
-// This function is used to handle the SCSI Inquiry command when it is received
-// from the host.
-//
-//*****************************************************************************
-static void
-USBDSCSIInquiry(tUSBDMSCDevice *psMSCDevice)
-{
-    int32_t i32Idx;
-    tMSCInstance *psInst;
-    uint32_t *pui32Data;
-
-    //
-    // Create a local 32-bit pointer to the command.
-    //
-    pui32Data = (uint32_t *)g_pui8Command;
-
-    //
-    // Create the serial instance data.
-    //
-    psInst = &psMSCDevice->sPrivateData;
-
-    //
-    // Direct Access device, Removable storage and SCSI 1 responses.
-    //
-    pui32Data[0] = SCSI_INQ_PDT_SBC | (SCSI_INQ_RMB << 8);
-
-    //
-    // Additional Length is fixed at 31 bytes.
-    //
-    pui32Data[1] = 31;
 
     //
-    // Copy the Vendor string.
+    // If there is media present then start transferring the data.
     //
-    for(i32Idx = 0; i32Idx < 8; i32Idx++)
+    if(psInst->pvMedia != 0)
     {
-        g_pui8Command[i32Idx + 8] = psMSCDevice->pui8Vendor[i32Idx];
-    }
+#if USBDMSC_DMA
+        //
+        // Hand the first logical blocks to the DMA.
+        //
+        SendBlocksDMA(psMSCDevice);
+#else
+        //
+        // Fill the IN FIFO with the first packets.
+        //
+        SendBlockPackets(psMSCDevice);
+#endif
+        //
+        // Move on and start sending blocks.
+        //
+        psInst->ui8SCSIState = STATE_SCSI_SEND_BLOCKS;
+        //psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
 
-    //
-    // Copy the Product string.
-    //
-    for(i32Idx = 0; i32Idx < 16; i32Idx++)
-    {
-        g_pui8Command[i32Idx + 16] = psMSCDevice->pui8Product[i32Idx];
+        if(psMSCDevice->pfnEventCallback)
+        {
+            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_READING,
+                                          g_pui32BlockSize * ui16NumBlocks,
+                                          0);
+        }
     }
-
-    //
-    // Copy the Version string.
-    //
-    for(i32Idx = 0; i32Idx < 4; i32Idx++)
+    else
     {
-        g_pui8Command[i32Idx + 32] = psMSCDevice->pui8Version[i32Idx];
-    }
-
-    //
-    // Send the SCSI Inquiry Response.
-    //
-    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
-                           36);
-
-    //
-    // Send the data to the host.
-    //
-    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 1;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
 
-    //
-    // Set the status so that it can be sent when this response has
-    // has be successfully sent.
-    //
-    g_sSCSICSW.bCSWStatus = 0;
-    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        //
+        // Stall the IN endpoint
+        //
+        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
 
-    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+        //
+        // Mark the sense code as valid and indicate that these is no media
+        // present.
+        //
+        psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+        psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
+        psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    }
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Read Capacities command when it is
+// This function is used to handle the SCSI Read 10 command when it is
 // received from the host.
 //
 //*****************************************************************************
 static void
-USBDSCSIReadCapacities(tUSBDMSCDevice *psMSCDevice)
+USBDSCSIWrite10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
 {
-    uint32_t ui32Blocks;
+    uint16_t ui16NumBlocks;
     tMSCInstance *psInst;
-    uint32_t *pui32Data;
 
     //
-    // Create a local 32-bit pointer to the command.
+    // Get instance data pointers.
     //
-    pui32Data = (uint32_t *)g_pui8Command;
+    psInst = &psMSCDevice->sPrivateData;
 
     //
-    // Get our instance data pointer.
+    // If there is media present then start transferring the data.
     //
-    psInst = &psMSCDevice->sPrivateData;
-
     if(psInst->pvMedia != 0)
     {
-        if(psMSCDevice->sMediaFunctions.pfnBlockSize)
-        {
-            //
-            // Query the block size for the device
-            //
-            g_pui32BlockSize =
-                     psMSCDevice->sMediaFunctions.pfnBlockSize(psInst->pvMedia);
-        }
-        ui32Blocks =
-                    psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
-
-        pui32Data[0] = 0x08000000;
-
         //
-        // Fill in the number of blocks, the bytes endianness must be changed.
+        // Get the logical block from the CBW structure. This switching
+        // is required to convert from big to little endian.
         //
-        g_pui8Command[4] = ui32Blocks >> 24;
-        g_pui8Command[5] = 0xff & (ui32Blocks >> 16);
-        g_pui8Command[6] = 0xff & (ui32Blocks >> 8);
-        g_pui8Command[7] = 0xff & (ui32Blocks);
+        psInst->ui32CurrentLBA = (((uint32_t)psSCSICBW->CBWCB[2]) << 24) |
+                                 (((uint32_t)psSCSICBW->CBWCB[3]) << 16) |
+                                 (((uint32_t)psSCSICBW->CBWCB[4]) << 8) |
+                                 (((uint32_t)psSCSICBW->CBWCB[5]) << 0);
 
         //
-        // Current media capacity
+        // More bytes to read.
         //
-        g_pui8Command[8] = 0x2;
+        ui16NumBlocks = (psSCSICBW->CBWCB[7] << 8) | psSCSICBW->CBWCB[8];
+
+        psInst->ui32BytesToTransfer = g_pui32BlockSize * ui16NumBlocks;
 
         //
-        // Fill in the block size, which is g_pui32BlockSize.
+        // Let the media know which blocks are about to be written.
         //
-        g_pui8Command[9] = 0xff & (g_pui32BlockSize >> 16);
-        g_pui8Command[10] = 0xff & (g_pui32BlockSize >> 8);
-        g_pui8Command[11] = 0xff & g_pui32BlockSize;
+        if(psMSCDevice->sMediaFunctions.pfnWriteStart)
+        {
+            psMSCDevice->sMediaFunctions.pfnWriteStart(psInst->pvMedia,
+                                                       psInst->ui32CurrentLBA,
+                                                       ui16NumBlocks);
+        }
 
         //
-        // Send out the 12 bytes that are in this response.
+        // Start sending logical blocks, these are always multiples of
+        // g_pui32BlockSize bytes.
         //
-        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
-                               12);
-        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_TRANS_IN);
+        psInst->ui8SCSIState = STATE_SCSI_RECEIVE_BLOCKS;
+        psInst->bWriteHeld = false;
+        psInst->bWriteError = false;
+        USBRingBufFlush(&psInst->sWriteRing);
+        g_bytesWritten = 0;
 
+#if USBDMSC_DMA
+        //
+        // Start the empty ring at its base so the DMA chunks never wrap, and
+        // have the DMA take the OUT packets.
+        //
+        USBRingBufInit(&psInst->sWriteRing,
+                       (uint8_t *)psMSCDevice->pui16WriteRing,
+                       psMSCDevice->ui32WriteRingSize / 2);
+        USBEndpointDMAConfigSet(USBA_BASE, psInst->ui8OUTEndpoint,
+                                USB_EP_DEV_OUT | USB_EP_DMA_MODE_1 |
+                                USB_EP_AUTO_CLEAR);
+        USBEndpointDMAEnable(USBA_BASE, psInst->ui8OUTEndpoint,
+                             USB_EP_DEV_OUT);
+        ReceiveBlocksDMA(psMSCDevice);
+#endif
+        
         //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
+        // Notify the application of the write event.
         //
-        g_sSCSICSW.bCSWStatus = 0;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        if(psMSCDevice->pfnEventCallback)
+        {
+            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_WRITING,
+                                          psInst->ui32BytesToTransfer, 0);
+        }
     }
     else
     {
@@ -1382,13 +2627,13 @@ USBDSCSIReadCapacities(tUSBDMSCDevice *psMSCDevice)
         // has be successfully sent.
         //
         g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
 
         //
         // Stall the IN endpoint
         //
-        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_EP_DEV_IN);
+        USBDevEndpointStall(USBA_BASE, psInst->ui8OUTEndpoint,
+                                USB_EP_DEV_OUT);
 
         //
         // Mark the sense code as valid and indicate that these is no media
@@ -1397,21 +2642,28 @@ USBDSCSIReadCapacities(tUSBDMSCDevice *psMSCDevice)
         psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
-    }
 
-    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    }
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Read Capacity command when it is
-// received from the host.
+// This function is used to handle the SCSI Mode Sense 6 and Mode Sense 10
+// commands when they are received from the host.  ui32HeaderSize is the size
+// of the mode parameter header of the command, 4 or 8 bytes.
+//
+// The Caching page is the only page implemented and is returned for page 08h
+// and for all pages.  WCE is set when the media has a pfnFlush function, as
+// its writes may then be held until the host sends Synchronize Cache.  Other
+// pages get the bare header.
 //
 //*****************************************************************************
 static void
-USBDSCSIReadCapacity(tUSBDMSCDevice *psMSCDevice)
+USBDSCSIModeSense(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW,
+                  uint32_t ui32HeaderSize)
 {
-    uint32_t ui32Blocks;
+    uint32_t ui32Flags, ui32Size, ui32Alloc, ui32Length, ui32Idx;
     tMSCInstance *psInst;
 
     //
@@ -1419,62 +2671,69 @@ USBDSCSIReadCapacity(tUSBDMSCDevice *psMSCDevice)
     //
     psInst = &psMSCDevice->sPrivateData;
 
-    if(psMSCDevice->sMediaFunctions.pfnBlockSize)
-    {
-        //
-        // Query the block size for the device
-        //
-        g_pui32BlockSize =
-                 psMSCDevice->sMediaFunctions.pfnBlockSize(psInst->pvMedia);
-    }
-
-    ui32Blocks = psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
-
     //
-    // Only decrement if any blocks were found.
+    // If there is media present send the response.
     //
-    if(ui32Blocks != 0)
-    {
-        //
-        // One less than the maximum number is the last addressable
-        // block.
-        //
-        ui32Blocks--;
-    }
-
     if(psInst->pvMedia != 0)
     {
         //
-        // Fill in the number of blocks, the bytes endianness must be changed.
+        // Page code and page control in the form of the SCSI_MS_* values,
+        // and the lengths, taken before the response is built over the CBW.
         //
-        g_pui8Command[0] = 0xff & (ui32Blocks >> 24);
-        g_pui8Command[1] = 0xff & (ui32Blocks >> 16);
-        g_pui8Command[2] = 0xff & (ui32Blocks >> 8);
-        g_pui8Command[3] = 0xff & (ui32Blocks);
+        ui32Flags = ((uint32_t)psSCSICBW->CBWCB[1] << 8) |
+                    ((uint32_t)psSCSICBW->CBWCB[2] << 16);
+        if(ui32HeaderSize == 4)
+        {
+            ui32Alloc = psSCSICBW->CBWCB[4];
+        }
+        else
+        {
+            ui32Alloc = (psSCSICBW->CBWCB[7] << 8) | psSCSICBW->CBWCB[8];
+        }
+        ui32Length = readusb32_t(&(psSCSICBW->dCBWDataTransferLength));
 
-        g_pui8Command[4] = 0;
+        for(ui32Idx = 0; ui32Idx < ui32HeaderSize + SCSI_MS_CACHING_SZ;
+            ui32Idx++)
+        {
+            g_pui8Command[ui32Idx] = 0;
+        }
+        ui32Size = ui32HeaderSize;
 
-        //
-        // Fill in the block size, which is g_pui32BlockSize.
-        //
-        g_pui8Command[5] = 0xff & (g_pui32BlockSize >> 16);
-        g_pui8Command[6] = 0xff & (g_pui32BlockSize >> 8);
-        g_pui8Command[7] = 0xff & g_pui32BlockSize;
+        if(((ui32Flags & SCSI_MS_PC_M) == SCSI_MS_PC_CACHING) ||
+           ((ui32Flags & SCSI_MS_PC_M) == SCSI_MS_PC_ALL))
+        {
+            g_pui8Command[ui32Size] = SCSI_MS_PC_CACHING >> 16;
+            g_pui8Command[ui32Size + 1] = SCSI_MS_CACHING_SZ - 2;
+
+            //
+            // Nothing in the page can be changed by the host.
+            //
+            if(((ui32Flags & SCSI_MS_PCTL_M) != SCSI_MS_PC_CHANGEABLE) &&
+               psMSCDevice->sMediaFunctions.pfnFlush)
+            {
+                g_pui8Command[ui32Size + 2] = SCSI_MS_CACHING_WCE;
+            }
+            ui32Size += SCSI_MS_CACHING_SZ;
+        }
 
         //
-        // Send the SCSI Inquiry Response.
+        // The mode data length does not count itself.  There are no block
+        // descriptors and the device specific parameter is 0.
         //
-        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
-                               8);
-        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_TRANS_IN);
+        if(ui32HeaderSize == 4)
+        {
+            g_pui8Command[0] = ui32Size - 1;
+        }
+        else
+        {
+            g_pui8Command[0] = 0xff & ((ui32Size - 2) >> 8);
+            g_pui8Command[1] = 0xff & (ui32Size - 2);
+        }
 
         //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
+        // Send no more than the host allocated.
         //
-        g_sSCSICSW.bCSWStatus = 0;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        USBDSCSISendData(psMSCDevice, ui32Size, ui32Alloc, ui32Length);
     }
     else
     {
@@ -1483,7 +2742,7 @@ USBDSCSIReadCapacity(tUSBDMSCDevice *psMSCDevice)
         // has be successfully sent.
         //
         g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) ,0);
 
         //
         // Stall the IN endpoint
@@ -1505,23 +2764,14 @@ USBDSCSIReadCapacity(tUSBDMSCDevice *psMSCDevice)
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Request Sense command when it is
-// received from the host.
+// This function is used to send out the response data based on the current
+// status of the mass storage class.
 //
 //*****************************************************************************
 static void
-USBDSCSIRequestSense(tUSBDMSCDevice *psMSCDevice)
+USBDSCSISendStatus(tUSBDMSCDevice *psMSCDevice)
 {
     tMSCInstance *psInst;
-    int32_t i32Idx;
-
-    //
-    // Zero out the response data.
-    //
-    for(i32Idx = 0; i32Idx < 18; i32Idx++)
-    {
-        g_pui8Command[i32Idx] = 0;
-    }
 
     //
     // Get our instance data pointer.
@@ -1529,124 +2779,207 @@ USBDSCSIRequestSense(tUSBDMSCDevice *psMSCDevice)
     psInst = &psMSCDevice->sPrivateData;
 
     //
-    // The request sense response.
+    // Respond with the requested status.
     //
-    g_pui8Command[0] = psInst->ui8ErrorCode;
-    g_pui8Command[2] = psInst->ui8SenseKey;
+    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint,
+                           (uint8_t *)&g_sSCSICSW, 13);
+    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
 
     //
-    // There are 10 more bytes of data.
+    // Move the state to status sent so that the next interrupt will move the
+    // statue to idle.
     //
-    g_pui8Command[7] = 10;
+    psInst->ui8SCSIState = STATE_SCSI_SENT_STATUS;
 
     //
-    // Transition from not ready to ready.
+    // Let the application time how long the device took to answer its first
+    // command.
     //
-    g_pui8Command[12] = (uint8_t)psInst->ui16AddSenseCode;
-    g_pui8Command[13] = (uint8_t)(psInst->ui16AddSenseCode >> 8);
+    if(!(psInst->ui32Flags & USBD_FLAG_READY_SENT))
+    {
+        psInst->ui32Flags |= USBD_FLAG_READY_SENT;
+
+        if(psMSCDevice->pfnEventCallback)
+        {
+            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_READY, 0, 0);
+        }
+    }
+}
+
+//*****************************************************************************
+//
+// This function is used to handle the Prevent/Allow Medium Removal command when it is
+// received from the host.
+//
+//*****************************************************************************
+static void
+USBDSCSIPreventAllowMediumRemoval(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+{
+    tMSCInstance *psInst;
 
     //
-    // Send the SCSI Inquiry Response.
+    // Get our instance data pointer.
     //
-    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
-                           18);
-    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
+    psInst = &psMSCDevice->sPrivateData;
 
     //
-    // Reset the valid flag on errors.
+    // If there is media present send the response.
     //
-    psInst->ui8ErrorCode = SCSI_RS_CUR_ERRORS;
+    if(psInst->pvMedia != 0)
+    {
+        //
+        // See if this was an allow or prevent removal request.
+        //
+        if((psSCSICBW->CBWCB[4] & SCSI_PE_MEDRMV_M) == SCSI_PE_MEDRMV_ALLOW)
+        {
+            psInst->ui32Flags |= USBD_FLAG_ALLOW_REMOVAL;
+        }
+        else
+        {
+            psInst->ui32Flags &= ~USBD_FLAG_ALLOW_REMOVAL;
+        }
+
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 0;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), 0);
+    }
+    else
+    {
+        //
+        // Set the status so that it can be sent when this response has
+        // has be successfully sent.
+        //
+        g_sSCSICSW.bCSWStatus = 1;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
 
-    //
-    // Set the status so that it can be sent when this response has
-    // has be successfully sent.
-    //
-    g_sSCSICSW.bCSWStatus = 0;
-    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
+        //
+        // Stall the IN endpoint
+        //
+        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
+                                USB_EP_DEV_IN);
+
+        //
+        // Mark the sense code as valid and indicate that these is no media
+        // present.
+        //
+        psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+        psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
+        psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+    }
 
-    //
-    // Move on to the status phase.
-    //
     psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Read 10 command when it is
+// This function is used to handle the SCSI Start/Stop Unit command when it is
 // received from the host.
 //
 //*****************************************************************************
 static void
-USBDSCSIRead10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+USBDSCSIStartStopUnit(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
 {
-    uint16_t ui16NumBlocks;
     tMSCInstance *psInst;
 
-    //
-    // Default the number of blocks.
-    //
-    ui16NumBlocks = 0;
-
     //
     // Get our instance data pointer.
     //
     psInst = &psMSCDevice->sPrivateData;
 
+    //
+    // If there is media present send the response.
+    //
     if(psInst->pvMedia != 0)
     {
         //
-        // Get the logical block from the CBW structure. This switching
-        // is required to convert from big to little endian.
-        //
-        psInst->ui32CurrentLBA = (((uint32_t)psSCSICBW->CBWCB[2]) << 24) |
-                                 (((uint32_t)psSCSICBW->CBWCB[3]) << 16) |
-                                 (((uint32_t)psSCSICBW->CBWCB[4]) << 8) |
-                                 (psSCSICBW->CBWCB[5] << 0);
-
-        //
-        // More bytes to read.
-        //
-        ui16NumBlocks = (psSCSICBW->CBWCB[7] << 8) | psSCSICBW->CBWCB[8];
-        g_bytesRead = 0;
-
+        // Make sure nothing is left in the media's write cache before it is
+        // stopped or ejected.  The write-back runs from the main loop and
+        // this is called again by USBDSCSIFlushDone() once it is complete.
         //
-        // Read the next logical block from the storage device.
-        //
-        if(psMSCDevice->sMediaFunctions.pfnBlockRead(psInst->pvMedia,
-               (uint8_t *)psInst->pui32Buffer, psInst->ui32CurrentLBA,g_bytesRead,1) == 0)
+        if((psInst->ui8SCSIState != STATE_SCSI_FLUSH) &&
+           psMSCDevice->sMediaFunctions.pfnFlush)
         {
-            psInst->pvMedia = 0;
-            psMSCDevice->sMediaFunctions.pfnClose(0);
+            psInst->ui8SCSIState = STATE_SCSI_FLUSH;
+            return;
         }
-    }
 
-    //
-    // If there is media present then start transferring the data.
-    //
-    if(psInst->pvMedia != 0)
-    {
-        //
-        // Schedule the remaining bytes to send.
-        //
-        psInst->ui32BytesToTransfer = (g_pui32BlockSize * ui16NumBlocks);
+        switch(psSCSICBW->CBWCB[4] & (SCSI_SS_UNIT_START | SCSI_SS_UNIT_LOEJ))
+        {
+            case 0:
+            {
+                //
+                // Media state is now stopped but not ejected.
+                //
+                psInst->iMediaStatus = eUSBDMSCMediaStopped;
 
-        //
-        // Send the Data
-        //
-        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, psInst->pui32Buffer,
-                                    MAX_TRANSFER_SIZE);
-        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
-                                        USB_TRANS_IN);
-        //
-        // Move on and start sending blocks.
-        //
-        psInst->ui8SCSIState = STATE_SCSI_SEND_BLOCKS;
-        //psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+                g_sSCSICSW.bCSWStatus = 0;
 
-        if(psMSCDevice->pfnEventCallback)
-        {
-            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_READING, 0, 0);
+                break;
+            }
+            case SCSI_SS_UNIT_START:
+            {
+                //
+                // Return to Media present.
+                //
+                psInst->iMediaStatus = eUSBDMSCMediaPresent;
+
+                g_sSCSICSW.bCSWStatus = 0;
+
+                break;
+            }
+            case SCSI_SS_UNIT_LOEJ:
+            {
+                //
+                // Only allow eject if the Prevent/Allow Medium Removal has
+                // been sent and enabled medium removal.
+                //
+                if(psInst->ui32Flags & USBD_FLAG_ALLOW_REMOVAL)
+                {
+                    psInst->iMediaStatus = eUSBDMSCMediaNotPresent;
+                    psMSCDevice->sMediaFunctions.pfnClose(0);
+                    psMSCDevice->sPrivateData.pvMedia = 0;
+                    g_sSCSICSW.bCSWStatus = 0;
+                }
+                else
+                {
+                    g_sSCSICSW.bCSWStatus = 1;
+                }
+
+                break;
+            }
+            case SCSI_SS_UNIT_START | SCSI_SS_UNIT_LOEJ:
+            {
+                //
+                // Since there was no media, check for media here.
+                //
+                psInst->pvMedia = psMSCDevice->sMediaFunctions.pfnOpen(0);
+
+                //
+                // If it is still not present then fail this command.
+                //
+                if(psInst->pvMedia != 0)
+                {
+                    g_sSCSICSW.bCSWStatus = 0;
+                }
+                else
+                {
+                    g_sSCSICSW.bCSWStatus = 1;
+                }
+                break;
+            }
+            default:
+            {
+                break;
+            }
         }
+
+        //
+        // There is no further data to send.
+        //
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) ,0);
     }
     else
     {
@@ -1670,78 +3003,48 @@ USBDSCSIRead10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
-
-        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
     }
+
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Read 10 command when it is
-// received from the host.
+// This function is used to handle the SCSI Synchronize Cache command when it
+// is received from the host.
 //
 //*****************************************************************************
 static void
-USBDSCSIWrite10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+USBDSCSISynchronizeCache(tUSBDMSCDevice *psMSCDevice)
 {
-    uint16_t ui16NumBlocks;
     tMSCInstance *psInst;
 
     //
-    // Get instance data pointers.
+    // Get our instance data pointer.
     //
     psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // If there is media present then start transferring the data.
-    //
     if(psInst->pvMedia != 0)
     {
         //
-        // Get the logical block from the CBW structure. This switching
-        // is required to convert from big to little endian.
-        //
-        psInst->ui32CurrentLBA = (((uint32_t)psSCSICBW->CBWCB[2]) << 24) |
-                                 (((uint32_t)psSCSICBW->CBWCB[3]) << 16) |
-                                 (((uint32_t)psSCSICBW->CBWCB[4]) << 8) |
-                                 (((uint32_t)psSCSICBW->CBWCB[5]) << 0);
-
-        //
-        // More bytes to read.
-        //
-        ui16NumBlocks = (psSCSICBW->CBWCB[7] << 8) | psSCSICBW->CBWCB[8];
-
-        psInst->ui32BytesToTransfer = g_pui32BlockSize * ui16NumBlocks;
-
-        //
-        // Start sending logical blocks, these are always multiples of
-        // g_pui32BlockSize bytes.
-        //
-        psInst->ui8SCSIState = STATE_SCSI_RECEIVE_BLOCKS;
-        g_bytesWritten = 0;
-        
-        //
-        // Notify the application of the write event.
+        // Write back whatever the media is caching.  The write-back runs from
+        // the main loop and the status is sent by USBDSCSIFlushDone() once it
+        // is complete.
         //
-        if(psMSCDevice->pfnEventCallback)
+        if((psInst->ui8SCSIState != STATE_SCSI_FLUSH) &&
+           psMSCDevice->sMediaFunctions.pfnFlush)
         {
-            psMSCDevice->pfnEventCallback(0, USBD_MSC_EVENT_WRITING, 0, 0);
+            psInst->ui8SCSIState = STATE_SCSI_FLUSH;
+            return;
         }
+
+        g_sSCSICSW.bCSWStatus = 0;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), 0);
     }
     else
     {
-        //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
-        //
         g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
-
-        //
-        // Stall the IN endpoint
-        //
-        USBDevEndpointStall(USBA_BASE, psInst->ui8OUTEndpoint,
-                                USB_EP_DEV_OUT);
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), 0);
 
         //
         // Mark the sense code as valid and indicate that these is no media
@@ -1750,20 +3053,73 @@ USBDSCSIWrite10(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+    }
 
-        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+}
+
+//*****************************************************************************
+//
+// This function finishes a SYNCHRONIZE CACHE or START STOP UNIT command once
+// the media has written back its cache, and sends the status that was held
+// for it.  The command block is still in g_pui8Command.
+//
+// Neither command has a data phase.  If the host sent one with a transfer
+// length anyway, the endpoint of the CBW direction is stalled and the whole
+// length is the residue, as for a command that is not supported, and the
+// status follows once the host has cleared the stall.
+//
+//*****************************************************************************
+static void
+USBDSCSIFlushDone(tUSBDMSCDevice *psMSCDevice)
+{
+    uint32_t ui32Length;
+    tMSCCBW *psSCSICBW;
+    tMSCInstance *psInst;
+
+    psInst = &psMSCDevice->sPrivateData;
+    psSCSICBW = (tMSCCBW *)g_pui8Command;
+
+    if(psSCSICBW->CBWCB[0] == SCSI_START_STOP_UNIT)
+    {
+        USBDSCSIStartStopUnit(psMSCDevice, psSCSICBW);
+    }
+    else
+    {
+        USBDSCSISynchronizeCache(psMSCDevice);
+    }
+
+    ui32Length = readusb32_t(&(psSCSICBW->dCBWDataTransferLength));
+    if(ui32Length == 0)
+    {
+        USBDSCSISendStatus(psMSCDevice);
+        return;
+    }
+
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), ui32Length);
+    if(psSCSICBW->bmCBWFlags & CBWFLAGS_DIR_IN)
+    {
+        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint, USB_EP_DEV_IN);
     }
+    else
+    {
+        USBDevEndpointStall(USBA_BASE, psInst->ui8OUTEndpoint,
+                            USB_EP_DEV_OUT);
+    }
+    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Mode Sense 6 command when it is
-// received from the host.
+// This function is used to handle the SCSI Service Action In 16 command when
+// it is received from the host.  Read Capacity 16 is the only service action
+// supported, it also reports whether logical block provisioning is enabled.
 //
 //*****************************************************************************
 static void
-USBDSCSIModeSense6(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+USBDSCSIReadCapacity16(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
 {
+    uint32_t ui32Blocks, ui32Idx, ui32Alloc, ui32Length;
     tMSCInstance *psInst;
 
     //
@@ -1771,33 +3127,73 @@ USBDSCSIModeSense6(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
     //
     psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // If there is media present send the response.
-    //
-    if(psInst->pvMedia != 0)
-    {
+    //
+    // The response is built over the CBW.
+    //
+    ui32Alloc = ((uint32_t)psSCSICBW->CBWCB[10] << 24) |
+                ((uint32_t)psSCSICBW->CBWCB[11] << 16) |
+                ((uint32_t)psSCSICBW->CBWCB[12] << 8) |
+                psSCSICBW->CBWCB[13];
+    ui32Length = readusb32_t(&(psSCSICBW->dCBWDataTransferLength));
+
+    if((psSCSICBW->CBWCB[1] & SCSI_SA_M) != SCSI_SA_READ_CAPACITY_16)
+    {
+        USBDSCSIIllegalRequest(psMSCDevice, psSCSICBW, SCSI_RS_INVALID_CDB);
+        return;
+    }
+
+    if(psInst->pvMedia != 0)
+    {
+        if(psMSCDevice->sMediaFunctions.pfnBlockSize)
+        {
+            //
+            // Query the block size for the device
+            //
+            g_pui32BlockSize =
+                 psMSCDevice->sMediaFunctions.pfnBlockSize(psInst->pvMedia);
+        }
+
+        ui32Blocks =
+                    psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
+
+        //
+        // One less than the maximum number is the last addressable block.
+        //
+        if(ui32Blocks != 0)
+        {
+            ui32Blocks--;
+        }
+
+        for(ui32Idx = 0; ui32Idx < SCSI_READ_CAPACITY_16_SZ; ui32Idx++)
+        {
+            g_pui8Command[ui32Idx] = 0;
+        }
+
         //
-        // Three extra bytes in this response.
+        // The last block address is 64 bits, the upper half is always 0.
         //
-        g_pui8Command[0] = 3;
-        g_pui8Command[1] = 0;
-        g_pui8Command[2] = 0;
-        g_pui8Command[3] = 0;
+        g_pui8Command[4] = 0xff & (ui32Blocks >> 24);
+        g_pui8Command[5] = 0xff & (ui32Blocks >> 16);
+        g_pui8Command[6] = 0xff & (ui32Blocks >> 8);
+        g_pui8Command[7] = 0xff & (ui32Blocks);
 
         //
-        // Manually send the response back to the host.
+        // Fill in the block size, which is g_pui32BlockSize.
         //
-        USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint, g_pui8Command,
-                               4);
-        USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_TRANS_IN);
+        g_pui8Command[9] = 0xff & (g_pui32BlockSize >> 16);
+        g_pui8Command[10] = 0xff & (g_pui32BlockSize >> 8);
+        g_pui8Command[11] = 0xff & g_pui32BlockSize;
 
         //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
+        // Blocks can be unmapped if the media supports it.
         //
-        g_sSCSICSW.bCSWStatus = 0;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),readusb32_t(&(psSCSICBW->dCBWDataTransferLength)) - 4);
+        if(psMSCDevice->sMediaFunctions.pfnTrim)
+        {
+            g_pui8Command[14] = SCSI_RC16_LBPME;
+        }
+
+        USBDSCSISendData(psMSCDevice, SCSI_READ_CAPACITY_16_SZ, ui32Alloc,
+                         ui32Length);
     }
     else
     {
@@ -1806,7 +3202,7 @@ USBDSCSIModeSense6(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         // has be successfully sent.
         //
         g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) ,0);
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue),0);
 
         //
         // Stall the IN endpoint
@@ -1821,95 +3217,54 @@ USBDSCSIModeSense6(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
-    }
-
-    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
-}
-
-//*****************************************************************************
-//
-// This function is used to send out the response data based on the current
-// status of the mass storage class.
-//
-//*****************************************************************************
-static void
-USBDSCSISendStatus(tUSBDMSCDevice *psMSCDevice)
-{
-    tMSCInstance *psInst;
-
-    //
-    // Get our instance data pointer.
-    //
-    psInst = &psMSCDevice->sPrivateData;
-
-    //
-    // Respond with the requested status.
-    //
-    USBEndpointDataPut(USBA_BASE, psInst->ui8INEndpoint,
-                           (uint8_t *)&g_sSCSICSW, 13);
-    USBEndpointDataSend(USBA_BASE, psInst->ui8INEndpoint, USB_TRANS_IN);
 
-    //
-    // Move the state to status sent so that the next interrupt will move the
-    // statue to idle.
-    //
-    psInst->ui8SCSIState = STATE_SCSI_SENT_STATUS;
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    }
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the Prevent/Allow Medium Removal command when it is
-// received from the host.
+// This function is used to handle the SCSI Unmap command when it is received
+// from the host.  The parameter list is collected in the staging buffer by
+// the OUT endpoint handler and then passed to USBDSCSIUnmapList().
 //
 //*****************************************************************************
 static void
-USBDSCSIPreventAllowMediumRemoval(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+USBDSCSIUnmap(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
 {
+    uint32_t ui32Length;
     tMSCInstance *psInst;
 
     //
-    // Get our instance data pointer.
+    // Get instance data pointers.
     //
     psInst = &psMSCDevice->sPrivateData;
 
-    //
-    // If there is media present send the response.
-    //
-    if(psInst->pvMedia != 0)
+    if(psMSCDevice->sMediaFunctions.pfnTrim == 0)
     {
-        //
-        // See if this was an allow or prevent removal request.
-        //
-        if((psSCSICBW->CBWCB[4] & SCSI_PE_MEDRMV_M) == SCSI_PE_MEDRMV_ALLOW)
-        {
-            psInst->ui32Flags |= USBD_FLAG_ALLOW_REMOVAL;
-        }
-        else
-        {
-            psInst->ui32Flags &= ~USBD_FLAG_ALLOW_REMOVAL;
-        }
-
-        //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
-        //
-        g_sSCSICSW.bCSWStatus = 0;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), 0);
+        USBDSCSIIllegalRequest(psMSCDevice, psSCSICBW, SCSI_RS_PV_INVALID);
+        return;
     }
-    else
+
+    ui32Length = readusb32_t(&(psSCSICBW->dCBWDataTransferLength));
+
+    if(psInst->pvMedia == 0)
     {
         //
         // Set the status so that it can be sent when this response has
         // has be successfully sent.
         //
         g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), ui32Length);
 
         //
-        // Stall the IN endpoint
+        // Stall the OUT endpoint
         //
-        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_EP_DEV_IN);
+        if(ui32Length != 0)
+        {
+            USBDevEndpointStall(USBA_BASE, psInst->ui8OUTEndpoint,
+                                    USB_EP_DEV_OUT);
+        }
 
         //
         // Mark the sense code as valid and indicate that these is no media
@@ -1918,132 +3273,131 @@ USBDSCSIPreventAllowMediumRemoval(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICB
         psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
         psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
         psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
+
+        psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+        return;
     }
 
-    psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    //
+    // The whole parameter list has to fit in the staging buffer.
+    //
+    if(ui32Length > psMSCDevice->ui32BlockBufferSize)
+    {
+        USBDSCSIIllegalRequest(psMSCDevice, psSCSICBW, SCSI_RS_PARAM_LEN);
+        return;
+    }
+
+    //
+    // An empty parameter list unmaps nothing.
+    //
+    if(ui32Length == 0)
+    {
+        g_sSCSICSW.bCSWStatus = 0;
+        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), 0);
+        return;
+    }
+
+    psInst->ui32BytesToTransfer = ui32Length;
+    psInst->ui32BufferBytes = 0;
+    psInst->ui8SCSIState = STATE_SCSI_RECEIVE_PARAMS;
 }
 
 //*****************************************************************************
 //
-// This function is used to handle the SCSI Start/Stop Unit command when it is
-// received from the host.
+// This function returns the big endian 32-bit value at byte ui32Idx of the
+// packed data pui16Data.
+//
+//*****************************************************************************
+static uint32_t
+PackedBE32(const uint16_t *pui16Data, uint32_t ui32Idx)
+{
+    uint32_t ui32Value, ui32End;
+
+    ui32Value = 0;
+    for(ui32End = ui32Idx + 4; ui32Idx < ui32End; ui32Idx++)
+    {
+        ui32Value = (ui32Value << 8) |
+                    ((pui16Data[ui32Idx / 2] >> ((ui32Idx & 1) * 8)) & 0xff);
+    }
+    return(ui32Value);
+}
+
+//*****************************************************************************
+//
+// This function handles the UNMAP parameter list once it has been received.
+// Every block descriptor is checked before any range is passed to pfnTrim,
+// so a list with a bad descriptor unmaps nothing.
 //
 //*****************************************************************************
 static void
-USBDSCSIStartStopUnit(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
+USBDSCSIUnmapList(tUSBDMSCDevice *psMSCDevice)
 {
+    uint32_t ui32Length, ui32Blocks, ui32LBA, ui32Count, ui32Idx;
+    uint16_t *pui16Data;
     tMSCInstance *psInst;
 
     //
-    // Get our instance data pointer.
+    // Get instance data pointers.
     //
     psInst = &psMSCDevice->sPrivateData;
+    pui16Data = psMSCDevice->pui16BlockBuffer;
 
-    //
-    // If there is media present send the response.
-    //
-    if(psInst->pvMedia != 0)
+    g_sSCSICSW.bCSWStatus = 0;
+
+    if(psInst->ui32BufferBytes >= SCSI_UNMAP_HEADER_SZ)
     {
-        switch(psSCSICBW->CBWCB[4] & (SCSI_SS_UNIT_START | SCSI_SS_UNIT_LOEJ))
+        //
+        // Only whole block descriptors that were received are used.
+        //
+        ui32Length = PackedBE32(pui16Data, 0) & 0xffff;
+        if(ui32Length > psInst->ui32BufferBytes - SCSI_UNMAP_HEADER_SZ)
         {
-            case 0:
-            {
-                //
-                // Media state is now stopped but not ejected.
-                //
-                psInst->iMediaStatus = eUSBDMSCMediaStopped;
-
-                g_sSCSICSW.bCSWStatus = 0;
-
-                break;
-            }
-            case SCSI_SS_UNIT_START:
-            {
-                //
-                // Return to Media present.
-                //
-                psInst->iMediaStatus = eUSBDMSCMediaPresent;
+            ui32Length = psInst->ui32BufferBytes - SCSI_UNMAP_HEADER_SZ;
+        }
+        ui32Length = SCSI_UNMAP_HEADER_SZ +
+                     (ui32Length / SCSI_UNMAP_DESC_SZ) * SCSI_UNMAP_DESC_SZ;
 
-                g_sSCSICSW.bCSWStatus = 0;
+        ui32Blocks =
+                    psMSCDevice->sMediaFunctions.pfnNumBlocks(psInst->pvMedia);
 
-                break;
-            }
-            case SCSI_SS_UNIT_LOEJ:
+        for(ui32Idx = SCSI_UNMAP_HEADER_SZ; ui32Idx < ui32Length;
+            ui32Idx += SCSI_UNMAP_DESC_SZ)
+        {
+            ui32LBA = PackedBE32(pui16Data, ui32Idx + 4);
+            ui32Count = PackedBE32(pui16Data, ui32Idx + 8);
+            if((PackedBE32(pui16Data, ui32Idx) != 0) ||
+               (ui32LBA > ui32Blocks) || (ui32Count > ui32Blocks - ui32LBA))
             {
-                //
-                // Only allow eject if the Prevent/Allow Medium Removal has
-                // been sent and enabled medium removal.
-                //
-                if(psInst->ui32Flags & USBD_FLAG_ALLOW_REMOVAL)
-                {
-                    psInst->iMediaStatus = eUSBDMSCMediaNotPresent;
-                    psMSCDevice->sMediaFunctions.pfnClose(0);
-                    psMSCDevice->sPrivateData.pvMedia = 0;
-                    g_sSCSICSW.bCSWStatus = 0;
-                }
-                else
-                {
-                    g_sSCSICSW.bCSWStatus = 1;
-                }
-
+                g_sSCSICSW.bCSWStatus = 1;
+                psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
+                psInst->ui8SenseKey = SCSI_RS_KEY_ILGL_RQST;
+                psInst->ui16AddSenseCode = SCSI_RS_LBA_RANGE;
                 break;
             }
-            case SCSI_SS_UNIT_START | SCSI_SS_UNIT_LOEJ:
-            {
-                //
-                // Since there was no media, check for media here.
-                //
-                psInst->pvMedia = psMSCDevice->sMediaFunctions.pfnOpen(0);
+        }
 
-                //
-                // If it is still not present then fail this command.
-                //
-                if(psInst->pvMedia != 0)
-                {
-                    g_sSCSICSW.bCSWStatus = 0;
-                }
-                else
-                {
-                    g_sSCSICSW.bCSWStatus = 1;
-                }
-                break;
-            }
-            default:
+        for(ui32Idx = SCSI_UNMAP_HEADER_SZ;
+            (g_sSCSICSW.bCSWStatus == 0) && (ui32Idx < ui32Length);
+            ui32Idx += SCSI_UNMAP_DESC_SZ)
+        {
+            ui32Count = PackedBE32(pui16Data, ui32Idx + 8);
+            if(ui32Count)
             {
-                break;
+                psMSCDevice->sMediaFunctions.pfnTrim(psInst->pvMedia,
+                                           PackedBE32(pui16Data, ui32Idx + 4),
+                                           ui32Count);
             }
         }
-
-        //
-        // There is no further data to send.
-        //
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) ,0);
-    }
-    else
-    {
-        //
-        // Set the status so that it can be sent when this response has
-        // has be successfully sent.
-        //
-        g_sSCSICSW.bCSWStatus = 1;
-        writeusb32_t(&(g_sSCSICSW.dCSWDataResidue) , 0);
-
-        //
-        // Stall the IN endpoint
-        //
-        USBDevEndpointStall(USBA_BASE, psInst->ui8INEndpoint,
-                                USB_EP_DEV_IN);
-
-        //
-        // Mark the sense code as valid and indicate that these is no media
-        // present.
-        //
-        psInst->ui8ErrorCode = SCSI_RS_VALID | SCSI_RS_CUR_ERRORS;
-        psInst->ui8SenseKey = SCSI_RS_KEY_NOT_READY;
-        psInst->ui16AddSenseCode = SCSI_RS_MED_NOT_PRSNT;
     }
 
+    //
+    // Anything the host did not send is the residue.
+    //
+    writeusb32_t(&(g_sSCSICSW.dCSWDataResidue), psInst->ui32BytesToTransfer);
+    psInst->ui32BytesToTransfer = 0;
+    psInst->ui32BufferBytes = 0;
     psInst->ui8SCSIState = STATE_SCSI_SEND_STATUS;
+    USBDSCSISendStatus(psMSCDevice);
 }
 
 //*****************************************************************************
@@ -2079,7 +3433,7 @@ USBDSCSICommand(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         //
         case SCSI_INQUIRY_CMD:
         {
-            USBDSCSIInquiry(psMSCDevice);
+            USBDSCSIInquiry(psMSCDevice, psSCSICBW);
 
             break;
         }
@@ -2185,7 +3539,17 @@ USBDSCSICommand(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
         //
         case SCSI_MODE_SENSE_6:
         {
-            USBDSCSIModeSense6(psMSCDevice, psSCSICBW);
+            USBDSCSIModeSense(psMSCDevice, psSCSICBW, 4);
+
+            break;
+        }
+
+        //
+        // Handle the Mode Sense 10 command.
+        //
+        case SCSI_MODE_SENSE_10:
+        {
+            USBDSCSIModeSense(psMSCDevice, psSCSICBW, 8);
 
             break;
         }
@@ -2209,6 +3573,33 @@ USBDSCSICommand(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
             break;
         }
 
+        //
+        // Handle the Synchronize Cache command.
+        //
+        case SCSI_SYNCHRONIZE_CACHE:
+        {
+            USBDSCSISynchronizeCache(psMSCDevice);
+            break;
+        }
+
+        //
+        // Handle the Read Capacity 16 command.
+        //
+        case SCSI_SERVICE_ACTION_IN:
+        {
+            USBDSCSIReadCapacity16(psMSCDevice, psSCSICBW);
+            break;
+        }
+
+        //
+        // Handle the Unmap command.
+        //
+        case SCSI_UNMAP:
+        {
+            USBDSCSIUnmap(psMSCDevice, psSCSICBW);
+            break;
+        }
+
         default:
         {
             //
@@ -2260,9 +3651,11 @@ USBDSCSICommand(tUSBDMSCDevice *psMSCDevice, tMSCCBW *psSCSICBW)
     }
 
     //
-    // If there is no data then send out the current status.
+    // If there is no data then send out the current status, unless it is
+    // held until the media has written back its cache.
     //
-    if(ui32TransferLength == 0)
+    if((ui32TransferLength == 0) &&
+       (psInst->ui8SCSIState != STATE_SCSI_FLUSH))
     {
         USBDSCSISendStatus(psMSCDevice);
     }
@@ -43,6 +43,41 @@ extern "C"
 //
 //*****************************************************************************
 
+//*****************************************************************************
+//
+//! The value returned by \e pfnBlockWrite when the media could not store the
+//! data.  The WRITE(10) command then fails with a medium error.
+//
+//*****************************************************************************
+#define USBDMSC_WRITE_ERROR     0xffffffff
+
+//*****************************************************************************
+//
+//! Set USBDMSC_DMA to 1 to have the C28x DMA move the READ(10) and WRITE(10)
+//! data between the bulk endpoint FIFOs and RAM, one packet per USB DMA
+//! request.  The CPU is then only interrupted once per staging buffer or
+//! write ring chunk, through USBDMSCDMAHandler().  It is 0 by default and the
+//! CPU moves every packet.
+//
+//*****************************************************************************
+#ifndef USBDMSC_DMA
+#define USBDMSC_DMA             0
+#endif
+
+//*****************************************************************************
+//
+//! The DMA channels used for the bulk IN and bulk OUT data when USBDMSC_DMA is
+//! set.  The application routes the interrupts of both to
+//! USBDMSCDMAHandler().
+//
+//*****************************************************************************
+#ifndef USBDMSC_DMA_TX_BASE
+#define USBDMSC_DMA_TX_BASE     DMA_CH5_BASE
+#endif
+#ifndef USBDMSC_DMA_RX_BASE
+#define USBDMSC_DMA_RX_BASE     DMA_CH6_BASE
+#endif
+
 //*****************************************************************************
 //
 //! Media Access functions.
@@ -77,33 +112,40 @@ typedef struct
     //
     //! This function reads a block of data from a device opened by the
     //! \e pfnOpen call.  The \e pvDrive parameter is the pointer that was
-    //! returned from the original call to \e pfnOpen.  The \e pui8Data
-    //! parameter is the buffer that data will be written into.  The data area
-    //! pointed to by \e pui8Data must be at least \e ui32NumBlocks * Block
-    //! Size bytes to prevent overwriting data. The \e ui32Sector is the block
+    //! returned from the original call to \e pfnOpen.  The \e pui16Data
+    //! parameter is the buffer that data will be written into, packed two
+    //! bytes per 16-bit word with the first byte in the low half.  The data
+    //! area pointed to by \e pui16Data must be at least \e ui32NumBlocks *
+    //! Block Size bytes to prevent overwriting data. The \e ui32Sector is the block
     //! address to read and \e ui32NumBlocks is the number of blocks to read.
-    //! This function returns the number of bytes that were read from the
-    //! and placed into the \e pui8Data buffer..
+    //! Whole blocks are always read, the class streams them to the host from
+    //! its staging buffer one packet at a time.  This function returns the
+    //! number of bytes that were read from the and placed into the
+    //! \e pui16Data buffer..
     //
     //*************************************************************************
-    uint32_t (*pfnBlockRead)(void *pvDrive, uint8_t *pui8Data,
-                                uint32_t ui32Sector,uint32_t offset, uint32_t ui32NumBlocks);
+    uint32_t (*pfnBlockRead)(void *pvDrive, uint16_t *pui16Data,
+                                uint32_t ui32Sector, uint32_t ui32NumBlocks);
 
     //*************************************************************************
     //
     //! This function is use to write blocks to a physical device from the
-    //! buffer pointed to by the \e pui8Data buffer. The \e pvDrive parameter
+    //! buffer pointed to by the \e pui16Data buffer. The \e pvDrive parameter
     //! is the pointer that was returned from the original call to \e pfnOpen.
-    //! The \e pui8Data is the pointer to the data to write to the storage
-    //! device and \e ui32NumBlocks is the number of blocks to write.  The
+    //! The \e pui16Data is the pointer to the data to write to the storage
+    //! device, packed the same way as for \e pfnBlockRead, and
+    //! \e ui32NumBlocks is the number of blocks to write.  The
     //! \e ui32Sector parameter is the sector number used to write the block.
     //! If the number of blocks is greater than one then the block address
     //! increments and writes to the next block until
     //! \e ui32NumBlocks * Block Size bytes are written.  This function returns
-    //! the number of bytes that were written to the device.
+    //! the number of bytes that were written to the device, 0 if the
+    //! device is busy and the same data should be offered again later, or
+    //! \b USBDMSC_WRITE_ERROR if the data could not be stored.  It is called
+    //! from USBDMSCWriteProcess(), never from the USB interrupt.
     //
     //*************************************************************************
-    uint32_t (*pfnBlockWrite)(void *pvDrive, uint8_t *pui8Data,
+    uint32_t (*pfnBlockWrite)(void *pvDrive, uint16_t *pui16Data,
                               uint32_t ui32Sector, uint32_t offset,uint32_t ui32NumBlocks);
 
     //*************************************************************************
@@ -124,6 +166,56 @@ typedef struct
     //*************************************************************************
     uint32_t (*pfnBlockSize)(void *pvDrive);
 
+    //*************************************************************************
+    //
+    //! This function writes any data the media is still holding in a volatile
+    //! cache back to the storage device.  The \e pvDrive parameter is the
+    //! pointer that was returned from the original call to \e pfnOpen.  It
+    //! is called for SYNCHRONIZE CACHE and before the media is stopped or
+    //! ejected, and may be 0 if the media has no write cache.  It is called
+    //! from USBDMSCWriteProcess() rather than the USB interrupt, and again
+    //! on every call until it returns 0; the status of the command is only
+    //! sent once the write-back is complete.
+    //
+    //*************************************************************************
+    uint32_t (*pfnFlush)(void *pvDrive);
+
+    //*************************************************************************
+    //
+    //! This function is called when a WRITE(10) command is accepted, before
+    //! any of its data is passed to \e pfnBlockWrite.  The \e ui32Sector and
+    //! \e ui32NumBlocks parameters give the range of blocks the command will
+    //! write so that the media can prepare for it, for example by erasing
+    //! flash that is going to be completely overwritten.  May be 0.
+    //
+    //*************************************************************************
+    void (*pfnWriteStart)(void *pvDrive, uint32_t ui32Sector,
+                          uint32_t ui32NumBlocks);
+
+    //*************************************************************************
+    //
+    //! This function is called for each block range of an UNMAP command.
+    //! The \e ui32NumBlocks blocks starting at \e ui32Sector no longer hold
+    //! data the host needs, so the media can stop preserving them.  It is
+    //! called from the USB interrupt and should only record the range.  If
+    //! it is 0 the device does not report logical block provisioning and
+    //! UNMAP is rejected.
+    //
+    //*************************************************************************
+    void (*pfnTrim)(void *pvDrive, uint32_t ui32Sector,
+                    uint32_t ui32NumBlocks);
+
+    //*************************************************************************
+    //
+    //! This function returns the number of blocks in the erase unit of the
+    //! media, which is reported to the host as the optimal transfer length
+    //! granularity so that it aligns partitions and writes to it.  The
+    //! \e pvDrive parameter is the pointer that was returned from the
+    //! original call to \e pfnOpen.  May be 0.
+    //
+    //*************************************************************************
+    uint32_t (*pfnEraseBlocks)(void *pvDrive);
+
 }
 tMSCDMedia;
 
@@ -201,9 +293,16 @@ typedef struct
     tUSBDMSCMediaStatus iMediaStatus;
 
     //
-    // MSC block buffer.
+    // MSC packet buffer, two bytes per word.
     //
-    uint8_t pui32Buffer[0x100];
+    uint16_t pui16Buffer[0x80];
+
+    //
+    // Bytes of the staging buffer that hold read data and how many of them
+    // have been sent.
+    //
+    uint32_t ui32BufferBytes;
+    uint32_t ui32BufferOffset;
 
     //
     // Current number of bytes to transfer.
@@ -234,6 +333,29 @@ typedef struct
     // Active SCSI state.
     //
     uint8_t ui8SCSIState;
+
+    //
+    // An OUT packet in the instance buffer is waiting for room in the write
+    // ring, so it has not been acknowledged.
+    //
+    volatile bool bWriteHeld;
+
+    //
+    // The media failed to store data of the current WRITE(10).
+    //
+    bool bWriteError;
+
+    //
+    // OUT packets received for the current WRITE(10) that have not yet been
+    // passed to the media.
+    //
+    tUSBRingBufObject sWriteRing;
+
+    //
+    // Bytes the DMA channel is moving for the current data phase, 0 while
+    // the channel is idle.  Only used when USBDMSC_DMA is set.
+    //
+    volatile uint32_t ui32DMABytes;
 }
 tMSCInstance;
 
@@ -335,6 +457,31 @@ typedef struct
     //
     const tUSBCallback pfnEventCallback;
 
+    //
+    //! The staging buffer for READ(10) data.  Whole logical blocks are read
+    //! from the media into it and sent to the host a packet at a time, so it
+    //! must hold at least one block.  Data is packed two bytes per word.
+    //
+    uint16_t * const pui16BlockBuffer;
+
+    //
+    //! The size of \e pui16BlockBuffer in bytes.
+    //
+    const uint32_t ui32BlockBufferSize;
+
+    //
+    //! The ring that WRITE(10) data is queued in by the USB interrupt until
+    //! USBDMSCWriteProcess() passes it to the media.  Data is packed two
+    //! bytes per word.
+    //
+    uint16_t * const pui16WriteRing;
+
+    //
+    //! The size of \e pui16WriteRing in bytes.  This must be a multiple of
+    //! the 64-byte packet size so queued packets never wrap.
+    //
+    const uint32_t ui32WriteRingSize;
+
     //
     //! The private instance data for this device.  This memory
     //! must remain accessible for as long as the MSC device is in use and
@@ -360,18 +507,28 @@ tUSBDMSCDevice;
 
 //*****************************************************************************
 //
-//! This event indicates that the host is reading the storage media.
+//! This event indicates that the host is reading the storage media.  The
+//! message parameter is the number of bytes of the READ(10).
 //
 //*****************************************************************************
 #define USBD_MSC_EVENT_READING  (USBD_MSC_EVENT_BASE + 1)
 
 //*****************************************************************************
 //
-//! This event indicates that the host is writing to the storage media.
+//! This event indicates that the host is writing to the storage media.  The
+//! message parameter is the number of bytes of the WRITE(10).
 //
 //*****************************************************************************
 #define USBD_MSC_EVENT_WRITING  (USBD_MSC_EVENT_BASE + 2)
 
+//*****************************************************************************
+//
+//! This event indicates that the status of the first command since the
+//! device was initialized has been sent, so the media is ready for the host.
+//
+//*****************************************************************************
+#define USBD_MSC_EVENT_READY    (USBD_MSC_EVENT_BASE + 3)
+
 //*****************************************************************************
 //
 // API Function Prototypes
@@ -385,6 +542,9 @@ extern void *USBDMSCCompositeInit(uint32_t ui32Index,
 extern void USBDMSCTerm(void *pvInstance);
 extern void USBDMSCMediaChange(void *pvInstance,
                                tUSBDMSCMediaStatus eMediaStatus);
+extern void USBDMSCWriteProcess(void *pvMSCDevice);
+extern bool USBDMSCIsIdle(void *pvMSCDevice);
+extern void USBDMSCDMAHandler(void *pvMSCDevice);
 
 //*****************************************************************************
 //
@@ -33,6 +33,17 @@
 #include "usbdevice.h"
 #include "usbdmsc.h"
 #include "usbdmsc.h"
+//*****************************************************************************
+//
+// The MSC staging buffer and write ring share RAMGS0to6 with the flash disk's
+// read-ahead buffer and block cache, which get FLASHDISK_GS_WORDS of it.
+//
+//*****************************************************************************
+#if (MSC_BLOCK_BUFFER_SIZE + MSC_WRITE_RING_SIZE) / 2 + FLASHDISK_GS_WORDS > \
+    0x7000
+#error "MSC_BLOCK_BUFFER does not fit in RAMGS0to6 next to the flash disk"
+#endif
+
 #define SDCARD_PRESENT          0x00000001
 #define SDCARD_IN_USE           0x00000002
 struct
@@ -91,6 +102,14 @@ USBDMSCStorageClose(void * pvDrive)
 {
 
     ASSERT(pvDrive != 0);
+
+    //
+    // Do not lose cached writes when the drive goes away.  This runs in the
+    // USB interrupt, so only the open flash sector is written back here and
+    // the main loop writes back the block cache.
+    //
+    disk_close();
+
     //
     // Clear all flags.
     //
@@ -108,7 +127,8 @@ USBDMSCStorageClose(void * pvDrive)
 //
 // /param pvDrive is the pointer that was returned from a call to
 // USBDMSCStorageOpen().
-// /param pucData is the buffer that data will be written into.
+// /param pucData is the buffer that data will be written into, two bytes per
+// word.
 // /param ulNumBlocks is the number of blocks to read.
 //
 // This function is use to read blocks from a physical device and return them
@@ -119,12 +139,12 @@ USBDMSCStorageClose(void * pvDrive)
 //
 //*****************************************************************************
 uint32_t USBDMSCStorageRead(void * pvDrive,
-                                 uint8_t *pucData,
-                                 uint32_t ulSector,uint32_t offset,
+                                 uint16_t *pucData,
+                                 uint32_t ulSector,
                                  uint32_t ulNumBlocks)
 {
     ASSERT(pvDrive != 0);
-    return disk_read(ulSector, pucData,offset,ulNumBlocks);
+    return disk_read(ulSector, pucData, ulNumBlocks);
 }
 
 //*****************************************************************************
@@ -134,7 +154,8 @@ uint32_t USBDMSCStorageRead(void * pvDrive,
 //
 // /param pvDrive is the pointer that was returned from a call to
 // USBDMSCStorageOpen().
-// /param pucData is the buffer that data will be used for writing.
+// /param pucData is the buffer that data will be used for writing, two bytes
+// per word.
 // /param ulNumBlocks is the number of blocks to write.
 //
 // This function is use to write blocks to a physical device from the buffer
@@ -142,16 +163,24 @@ uint32_t USBDMSCStorageRead(void * pvDrive,
 // one then the block address will increment and write to the next block until
 // /e ulNumBlocks * Block Size bytes have been written.
 //
-// /return Returns the number of bytes that were written to the device.
+// /return Returns the number of bytes that were written to the device, 0 if
+// the device is busy or USBDMSC_WRITE_ERROR if the data could not be stored.
 //
 //*****************************************************************************
 uint32_t USBDMSCStorageWrite(void * pvDrive,
-                                  uint8_t *pucData,
+                                  uint16_t *pucData,
                                   uint32_t ulSector,uint32_t offset,
                                   uint32_t ulNumBlocks)
 {
+    unsigned int ulWritten;
+
     ASSERT(pvDrive != 0);
-    return disk_write(ulSector, pucData,offset, ulNumBlocks);
+    ulWritten = disk_write(ulSector, pucData,offset, ulNumBlocks);
+    if(ulWritten == DISK_WRITE_FAILED)
+    {
+        return(USBDMSC_WRITE_ERROR);
+    }
+    return(ulWritten);
 }
 
 //*****************************************************************************
@@ -191,6 +220,84 @@ USBDMSCStorageBlockSize(void * pvDrive)
     return (sector_size);
 }
 
+//*****************************************************************************
+//
+// This function will write any cached data back to a device opened by the
+// USBDMSCStorageOpen() call.  It is called from the main loop until it
+// returns 0, each call runs one step of the write-back.
+//
+// /param pvDrive is the pointer that was returned from a call to
+// USBDMSCStorageOpen().
+//
+// /return Returns nonzero while the write-back is still in progress.
+//
+//*****************************************************************************
+uint32_t
+USBDMSCStorageFlush(void * pvDrive)
+{
+    return(disk_sync());
+}
+
+//*****************************************************************************
+//
+// This function is called at the start of a WRITE(10) command with the range
+// of blocks that the command is going to write.
+//
+// /param pvDrive is the pointer that was returned from a call to
+// USBDMSCStorageOpen().
+// /param ui32Sector is the first block that will be written.
+// /param ui32NumBlocks is the number of blocks that will be written.
+//
+// /return None.
+//
+//*****************************************************************************
+void
+USBDMSCStorageWriteStart(void * pvDrive, uint32_t ui32Sector,
+                         uint32_t ui32NumBlocks)
+{
+    disk_write_start(ui32Sector, ui32NumBlocks);
+}
+
+//*****************************************************************************
+//
+// This function is called for each block range of an UNMAP command.
+//
+// /param pvDrive is the pointer that was returned from a call to
+// USBDMSCStorageOpen().
+// /param ui32Sector is the first block that was unmapped.
+// /param ui32NumBlocks is the number of blocks that were unmapped.
+//
+// /return None.
+//
+//*****************************************************************************
+void
+USBDMSCStorageTrim(void * pvDrive, uint32_t ui32Sector,
+                   uint32_t ui32NumBlocks)
+{
+    disk_trim(ui32Sector, ui32NumBlocks);
+}
+
+//*****************************************************************************
+//
+// This function will return the number of blocks in the erase unit of a
+// device.
+//
+// /param pvDrive is the pointer that was returned from a call to
+// USBDMSCStorageOpen().
+//
+// /return Returns the number of blocks that are erased together.
+//
+//*****************************************************************************
+uint32_t
+USBDMSCStorageEraseBlocks(void * pvDrive)
+{
+    unsigned int erase_blocks = 0;
+
+    disk_ioctl(0, GET_BLOCK_SIZE, &erase_blocks);
+
+    return (erase_blocks);
+}
+
 //*****************************************************************************
 //
 // This function will return the current status of a device.
@@ -30,14 +30,24 @@
 //*****************************************************************************
 extern void * USBDMSCStorageOpen(unsigned int ulDrive);
 extern void USBDMSCStorageClose(void * pvDrive);
-extern uint32_t USBDMSCStorageRead(void * pvDrive, uint8_t *pucData,
-                                        uint32_t ulSector,uint32_t offset,
+extern uint32_t USBDMSCStorageRead(void * pvDrive, uint16_t *pucData,
+                                        uint32_t ulSector,
                                         uint32_t ulNumBlocks);
-extern uint32_t USBDMSCStorageWrite(void * pvDrive, uint8_t *pucData,
+extern uint32_t USBDMSCStorageWrite(void * pvDrive, uint16_t *pucData,
                                     uint32_t ulSector,uint32_t offset,
                                     uint32_t ulNumBlocks);
 extern uint32_t USBDMSCStorageNumBlocks(void * pvDrive);
 
 extern uint32_t USBDMSCStorageBlockSize(void * pvDrive);
 
+extern uint32_t USBDMSCStorageFlush(void * pvDrive);
+
+extern void USBDMSCStorageWriteStart(void * pvDrive, uint32_t ui32Sector,
+                                     uint32_t ui32NumBlocks);
+
+extern void USBDMSCStorageTrim(void * pvDrive, uint32_t ui32Sector,
+                               uint32_t ui32NumBlocks);
+
+extern uint32_t USBDMSCStorageEraseBlocks(void * pvDrive);
+
 #endif
@@ -277,6 +277,10 @@ PACKED tMSCCSW;
 #define SCSI_READ_CAPACITY          0x25
 #define SCSI_READ_10                0x28
 #define SCSI_WRITE_10               0x2a
+#define SCSI_SYNCHRONIZE_CACHE      0x35
+#define SCSI_UNMAP                  0x42
+#define SCSI_MODE_SENSE_10          0x5a
+#define SCSI_SERVICE_ACTION_IN      0x9e
 
 //*****************************************************************************
 //
@@ -323,6 +327,36 @@ PACKED tMSCCSW;
 #define SCSIIsRemovable(pData)                                                \
                                 (((uint8_t *)pData)[1] & SCSI_INQ_RMB)
 
+//*****************************************************************************
+//
+// Inquiry command byte 1 and the vital product data pages.
+//
+//*****************************************************************************
+#define SCSI_INQ_EVPD           0x01  // Return a vital product data page.
+#define SCSI_VPD_SUPPORTED      0x00  // Supported VPD pages.
+#define SCSI_VPD_SERIAL         0x80  // Unit Serial Number.
+#define SCSI_VPD_BLOCK_LIMITS   0xb0  // Block Limits.
+#define SCSI_VPD_BDC            0xb1  // Block Device Characteristics.
+#define SCSI_VPD_LBP            0xb2  // Logical Block Provisioning.
+
+//*****************************************************************************
+//
+// Sizes of the Block Limits and Block Device Characteristics VPD pages, and
+// their fields.
+//
+//*****************************************************************************
+#define SCSI_VPD_BLOCK_LIMITS_SZ 64
+#define SCSI_VPD_BDC_SZ         64
+#define SCSI_VPD_UGAVALID       0x80  // Unmap granularity alignment valid.
+#define SCSI_VPD_NON_ROTATING   0x0001  // Medium rotation rate of flash.
+
+//*****************************************************************************
+//
+// Offset 5 of the Logical Block Provisioning VPD page.
+//
+//*****************************************************************************
+#define SCSI_VPD_LBP_LBPU       0x80  // UNMAP is supported.
+
 //*****************************************************************************
 //
 // SCSI Read Capacity definitions.
@@ -336,6 +370,26 @@ PACKED tMSCCSW;
 //*****************************************************************************
 #define SCSI_READ_CAPACITY_SZ   0x08
 
+//*****************************************************************************
+//
+// Service action of SCSI_SERVICE_ACTION_IN for Read Capacity 16, the size of
+// its response data and the bits of offset 14 in it.
+//
+//*****************************************************************************
+#define SCSI_SA_M               0x1f
+#define SCSI_SA_READ_CAPACITY_16 0x10
+#define SCSI_READ_CAPACITY_16_SZ 32
+#define SCSI_RC16_LBPME         0x80  // Logical block provisioning enabled.
+#define SCSI_RC16_LBPRZ         0x40  // Unmapped blocks read as zero.
+
+//*****************************************************************************
+//
+// SCSI Unmap parameter list, a header followed by block descriptors.
+//
+//*****************************************************************************
+#define SCSI_UNMAP_HEADER_SZ    8
+#define SCSI_UNMAP_DESC_SZ      16
+
 //*****************************************************************************
 //
 // SCSI Mode Sense definitions, these are passed in via the ui32Flags parameter
@@ -355,8 +409,10 @@ PACKED tMSCCSW;
 // Page Code values, used in combination with Page Control values.
 //
 //*****************************************************************************
+#define SCSI_MS_PC_M            0x003f0000
 #define SCSI_MS_PC_VENDOR       0x00000000
 #define SCSI_MS_PC_DISCO        0x00020000
+#define SCSI_MS_PC_CACHING      0x00080000
 #define SCSI_MS_PC_CONTROL      0x000a0000
 #define SCSI_MS_PC_LUN          0x00180000
 #define SCSI_MS_PC_PORT         0x00190000
@@ -369,11 +425,21 @@ PACKED tMSCCSW;
 // Page Control values.
 //
 //*****************************************************************************
+#define SCSI_MS_PCTL_M          0x00c00000
 #define SCSI_MS_PC_CURRENT      0x00000000
 #define SCSI_MS_PC_CHANGEABLE   0x00400000
 #define SCSI_MS_PC_DEFAULT      0x00800000
 #define SCSI_MS_PC_SAVED        0x00c00000
 
+//*****************************************************************************
+//
+// Size of the Caching mode page and its byte 2 bits.
+//
+//*****************************************************************************
+#define SCSI_MS_CACHING_SZ      20
+#define SCSI_MS_CACHING_WCE     0x04  // Write cache enabled.
+#define SCSI_MS_CACHING_RCD     0x01  // Read cache disabled.
+
 //*****************************************************************************
 //
 // Request Sense Definitions.
@@ -421,6 +487,11 @@ PACKED tMSCCSW;
 #define SCSI_RS_MED_NOT_PRSNT   0x003a  // Medium not present.
 #define SCSI_RS_MED_NOTRDY2RDY  0x0028  // Not ready to ready transition.
 #define SCSI_RS_PV_INVALID      0x0226  // Parameter Value Invalid.
+#define SCSI_RS_PARAM_LEN       0x001a  // Parameter list length error.
+#define SCSI_RS_LBA_RANGE       0x0021  // LBA out of range.
+#define SCSI_RS_INVALID_CDB     0x0024  // Invalid field in CDB.
+#define SCSI_RS_INVALID_PARAM   0x0026  // Invalid field in parameter list.
+#define SCSI_RS_WRITE_ERROR     0x000c  // Write error.
 
 //*****************************************************************************
 //